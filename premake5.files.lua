@@ -416,9 +416,11 @@ function sumatra_files()
     "TableOfContents.*",
     "Tabs.*",
     "Tester.*",
+    "TextIndex.*",
     "TextSearch.*",
     "TextSelection.*",
     "Theme.*",
+    "TileCache.*",
     "TocEditor.*",
     "Toolbar.*",
     "Translations.*",
@@ -474,12 +476,14 @@ function utils_files()
     "SettingsUtil.*",
     "Log.*",
     "StrconvUtil.*",
+    "StrFinder.*",
     "StrFormat.*",
     "StringViewUtil.*",
     "StrSlice.*",
     "StrUtil.*",
     "StrUtil_win.cpp",
     "SquareTreeParser.*",
+    "SyncUtil.*",
     "ThreadUtil.*",
     "TgaReader.*",
     "TrivialHtmlParser.*",
@@ -854,6 +858,7 @@ function test_util_files()
     "SettingsUtil.*",
     "Log.*",
     "StrconvUtil.*",
+    "StrFinder.*",
     "StrFormat.*",
     "StringViewUtil.*",
     "StrUtil.*",
@@ -103,3 +103,146 @@ workspace "SumatraPDF"
       "src/utils/UtAssert.cpp",
       "tools/test_unix/main.cpp",
     }
+
+  -- mupdf and its dependencies, for the headless benchmark.
+  -- warnings in 3rd party code are not fatal, we don't fix them there
+
+  project "jbig2dec"
+    kind "StaticLib"
+    language "C"
+    defines { "HAVE_STRING_H=1", "JBIG_NO_MEMENTO" }
+    removeflags { "FatalWarnings" }
+    includedirs { "ext/jbig2dec" }
+    jbig2dec_files()
+
+  project "openjpeg"
+    kind "StaticLib"
+    language "C"
+    defines { "USE_JPIP", "OPJ_STATIC", "OPJ_EXPORTS", "OPJ_HAVE_STDINT_H", "OPJ_HAVE_INTTYPES_H" }
+    removeflags { "FatalWarnings" }
+    openjpeg_files()
+
+  project "libjpeg-turbo"
+    kind "StaticLib"
+    language "C"
+    removeflags { "FatalWarnings" }
+    includedirs { "ext/libjpeg-turbo", "ext/libjpeg-turbo/simd" }
+    libjpeg_turbo_files()
+    -- the simd .asm files are in win32/win64 format, use the C fallback
+    removefiles { "ext/libjpeg-turbo/simd/**" }
+    files { "ext/libjpeg-turbo/jsimd_none.c" }
+
+  project "freetype"
+    kind "StaticLib"
+    language "C"
+    defines {
+      "FT2_BUILD_LIBRARY",
+      "FT_CONFIG_MODULES_H=\"slimftmodules.h\"",
+      "FT_CONFIG_OPTIONS_H=\"slimftoptions.h\"",
+    }
+    removeflags { "FatalWarnings" }
+    includedirs { "ext/freetype/include", "ext/freetype-config" }
+    freetype_files()
+
+  project "lcms2"
+    kind "StaticLib"
+    language "C"
+    removeflags { "FatalWarnings" }
+    includedirs { "ext/lcms2/include" }
+    lcms2_files()
+
+  project "harfbuzz"
+    kind "StaticLib"
+    language "C"
+    includedirs { "ext/harfbuzz/src/hb-ucdn", "ext/freetype-config", "ext/freetype/include" }
+    defines {
+      "HAVE_FALLBACK=1",
+      "HAVE_OT",
+      "HAVE_UCDN",
+      "HB_NO_MT",
+      "hb_malloc_impl=fz_hb_malloc",
+      "hb_calloc_impl=fz_hb_calloc",
+      "hb_realloc_impl=fz_hb_realloc",
+      "hb_free_impl=fz_hb_free"
+    }
+    removeflags { "FatalWarnings" }
+    harfbuzz_files()
+
+  project "mujs"
+    kind "StaticLib"
+    language "C"
+    includedirs { "ext/mujs" }
+    removeflags { "FatalWarnings" }
+    files { "ext/mujs/one.c", "ext/mujs/mujs.h" }
+
+  project "mupdf"
+    kind "StaticLib"
+    language "C"
+    defines { "USE_JPIP", "OPJ_EXPORTS", "HAVE_LCMS2MT=1" }
+    defines { "OPJ_STATIC", "SHARE_JPEG", "OPJ_HAVE_STDINT_H", "OPJ_HAVE_INTTYPES_H" }
+    defines { "TOFU", "TOFU_CJK_LANG" }
+    removeflags { "FatalWarnings" }
+    includedirs {
+      "ext/freetype-config",
+      "mupdf/include",
+      "mupdf/generated",
+      "ext/jbig2dec",
+      "ext/libjpeg-turbo",
+      "ext/openjpeg/src/lib/openjp2",
+      "ext/zlib",
+      "ext/freetype/include",
+      "ext/mujs",
+      "ext/harfbuzz/src",
+      "ext/lcms2/include",
+    }
+    -- same fonts as the windows build, embedded with nasm
+    filter {'files:**.asm', 'platforms:x64'}
+      buildmessage '%{file.relpath}'
+      buildoutputs { '%{cfg.objdir}/%{file.basename}.o' }
+      buildcommands {
+        'nasm -f elf64 -I mupdf/ -o "%{cfg.objdir}/%{file.basename}.o" "%{file.relpath}"'
+      }
+    filter {}
+    mupdf_files()
+
+  project "bench_unix"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++17"
+
+    includedirs { "mupdf/include" }
+
+    -- order matters for gnu ld: mupdf before the libraries it uses
+    links { "mupdf", "harfbuzz", "freetype", "libjpeg-turbo", "jbig2dec", "openjpeg", "lcms2", "mujs", "zlib" }
+    links { "m", "pthread" }
+
+    files {
+      "tools/bench_unix/main.cpp",
+    }
+
+  -- load test for the bitmap cache behind RenderCache (doesn't need mupdf)
+  project "bench_cache_unix"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++17"
+
+    includedirs { "src" }
+    links { "pthread" }
+
+    files {
+      "src/TileCache.cpp",
+      "tools/bench_unix/cache_bench.cpp",
+    }
+
+  -- micro-benchmark for the substring search behind TextSearch
+  project "bench_strfind_unix"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++17"
+
+    includedirs { "src" }
+
+    files {
+      "src/utils/StrFinder.cpp",
+      "tools/bench_unix/strfind_bench.cpp",
+    }
@@ -450,6 +450,10 @@ GlobalPrefs = [
 		"actual resolution of the main screen in DPI (if this value " +
 		" isn't positive, the system's UI setting is used)",
 		expert=True, version="2.5"),
+	Field("RenderCacheSize", Int, 0,
+		"maximum amount of memory in MB used for caching rendered pages (if this " +
+		"value isn't positive, it's determined by the screen size)",
+		expert=True, version="3.2"),
 	EmptyLine(),
 
 	Field("RememberStatePerDocument", Bool, True,
@@ -6,14 +6,17 @@
 #include "utils/FileWatcher.h"
 #include "utils/UITask.h"
 #include "utils/ScopedWin.h"
+#include "utils/SyncUtil.h"
 
 #include "wingui/TreeModel.h"
 #include "EngineBase.h"
 #include "EngineEbook.h"
 
 #include "SettingsStructs.h"
+#include "Controller.h"
 #include "FileHistory.h"
 #include "GlobalPrefs.h"
+#include "DisplayModel.h"
 #include "ProgressUpdateUI.h"
 #include "Notifications.h"
 #include "SumatraPDF.h"
@@ -22,6 +25,8 @@
 #include "AppPrefs.h"
 #include "AppTools.h"
 #include "Favorites.h"
+#include "TileCache.h"
+#include "RenderCache.h"
 #include "Toolbar.h"
 #include "Translations.h"
 
@@ -226,6 +231,7 @@ bool Reload() {
     }
 
     UpdateDocumentColors();
+    gRenderCache.SetMaxMemory(gGlobalPrefs->renderCacheSize);
 
     return true;
 }
@@ -10,6 +10,7 @@
 #include "utils/WinUtil.h"
 #include "AppColors.h"
 #include "utils/ScopedWin.h"
+#include "utils/SyncUtil.h"
 
 #include "wingui/WinGui.h"
 #include "wingui/Layout.h"
@@ -28,6 +29,7 @@
 #include "EbookController.h"
 #include "Theme.h"
 #include "GlobalPrefs.h"
+#include "TileCache.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
@@ -553,7 +555,8 @@ static void DebugShowLinks(DisplayModel& dm, HDC hdc) {
             continue;
         }
 
-        Vec<PageElement*>* els = dm.GetEngine()->GetElements(pageNo);
+        // don't extract the elements of pages which haven't been loaded yet while painting
+        Vec<PageElement*>* els = dm.GetEngine()->GetElementsNoWait(pageNo);
         if (!els) {
             continue;
         }
@@ -738,6 +741,10 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
         }
     }
 
+    if (win->currentTab->findAll) {
+        PaintFindAllResult(win, hdc);
+    }
+
     if (win->showSelection) {
         PaintSelection(win, hdc);
     }
@@ -1414,6 +1421,14 @@ static void OnTimer(WindowInfo* win, HWND hwnd, WPARAM timerId) {
                     tab->AsEbook()->TriggerLayout();
             }
             break;
+
+        case PAGE_SIZES_TIMER_ID:
+            KillTimer(hwnd, PAGE_SIZES_TIMER_ID);
+            // only re-layout the visible tab (re-layouting updates the scrollbars),
+            // other tabs are updated in LoadModelIntoTab
+            if (win->AsFixed())
+                win->AsFixed()->UpdateProvisionalPageSizes();
+            break;
     }
 }
 
@@ -70,7 +70,8 @@ static const char* argNames =
     "with-preview\0"
     "x\0"
     "s\0"
-    "silent\0";
+    "silent\0"
+    "log-render-stats\0";
 
 enum {
     RegisterForPdf,
@@ -130,7 +131,8 @@ enum {
     WithPreview,
     ExtractFiles,
     Silent2,
-    Silent
+    Silent,
+    LogRenderStats
 };
 
 CommandLineInfo::~CommandLineInfo() {
@@ -144,6 +146,7 @@ CommandLineInfo::~CommandLineInfo() {
     free(stressTestPath);
     free(stressTestFilter);
     free(stressTestRanges);
+    free(renderStatsLogPath);
     free(lang);
 }
 
@@ -410,6 +413,8 @@ void ParseCommandLine(const WCHAR* cmdLine, CommandLineInfo& i) {
         } else if (is_arg_with_param(Render)) {
             handle_int_param(i.pageNumber);
             i.testRenderPage = true;
+        } else if (is_arg_with_param(LogRenderStats)) {
+            handle_string_param(i.renderStatsLogPath);
         } else if (is_arg_with_param(ExtractText)) {
             handle_int_param(i.pageNumber);
             i.testExtractPage = true;
@@ -57,6 +57,8 @@ class CommandLineInfo {
     int testPageNo = 0;
 
     bool crashOnOpen = false;
+    // log details of every rendered page to this file
+    WCHAR* renderStatsLogPath = nullptr;
 
     // deprecated flags
     char* lang = nullptr;
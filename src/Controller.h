@@ -21,10 +21,21 @@ class ControllerCallback {
     virtual void GotoLink(PageDestination* dest) = 0;
     // DisplayModel //
     virtual void Repaint() = 0;
+    // repaint all views of the document rendered by engine (may be called from any thread)
+    virtual void RepaintSharedViews(EngineBase* engine) = 0;
     virtual void UpdateScrollbars(SizeI canvas) = 0;
     virtual void RequestRendering(int pageNo) = 0;
+    // speculatively render the parts of a page which are about to be
+    // scrolled into view (area is in screen coordinates)
+    virtual void PrefetchRendering(int pageNo, RectI area) = 0;
     virtual void CleanUp(DisplayModel* dm) = 0;
     virtual void RenderThumbnail(DisplayModel* dm, SizeI size, const onBitmapRenderedCb&) = 0;
+    // tell the UI to update the ToC and page labels, which the engine
+    // has loaded in the background (cf. EngineBase::IsLoadingProperties)
+    virtual void PropertiesLoaded(Controller* ctrl) = 0;
+    // ask for UpdateProvisionalPageSizes to be called after delay ms
+    // (only for the current tab, other tabs are updated once they're shown)
+    virtual void RequestPageSizesUpdate(int delay) = 0;
     // ChmModel //
     // tell the UI to move focus back to the main window
     // (if always == false, then focus is only moved if it's inside
@@ -59,11 +59,17 @@
 #include "PdfSync.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
+#include "TextIndex.h"
 #include "TextSearch.h"
 
 // if true, we pre-render the pages right before and after the visible pages
 static bool gPredictiveRender = true;
 
+// when scrolling, also pre-render what's expected to become visible within this many ms
+#define SCROLL_LOOKAHEAD_MS 300
+// scrolling is considered to have stopped after this many ms without scrolling
+#define SCROLL_SPEED_TIMEOUT 250
+
 static int ColumnsFromDisplayMode(DisplayMode displayMode) {
     if (!IsSingle(displayMode))
         return 2;
@@ -164,9 +170,21 @@ DisplayModel::DisplayModel(EngineBase* eng, ControllerCallback* cb) : Controller
     pageSpacing.dy += 4;
 #endif
 
-    textCache = new PageTextCache(engine);
+    // extracting the text of PDF and XPS documents is slow enough to be worth
+    // doing on several threads (e.g. when searching or selecting all pages)
+    int textThreads = 0;
+    if (engine->kind == kindEnginePdf || engine->kind == kindEngineXps) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        textThreads = limitValue((int)si.dwNumberOfProcessors - 1, 0, MAX_TEXT_EXTRACTION_THREADS);
+    }
+    textCache = new PageTextCache(engine, textThreads);
+    // image collections don't have any text to search
+    if (!engine->IsImageCollection()) {
+        textIndex = TextIndex::GetForEngine(engine);
+    }
     textSelection = new TextSelection(engine, textCache);
-    textSearch = new TextSearch(engine, textCache);
+    textSearch = new TextSearch(engine, textCache, textIndex);
 }
 
 DisplayModel::~DisplayModel() {
@@ -177,8 +195,11 @@ DisplayModel::~DisplayModel() {
     delete userAnnots;
     delete textSearch;
     delete textSelection;
+    if (textIndex) {
+        textIndex->Release();
+    }
     delete textCache;
-    delete engine;
+    engine->Release();
     free(pagesInfo);
 }
 
@@ -227,16 +248,17 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
     BuildPagesInfo();
 }
 
+// how often (in ms) to check whether the engine has determined
+// the final page sizes for pages laid out provisionally
+#define PROVISIONAL_PAGE_SIZES_DELAY 200
+
 void DisplayModel::BuildPagesInfo() {
     AssertCrash(!pagesInfo);
     int pageCount = PageCount();
     pagesInfo = AllocArray<PageInfo>(pageCount);
 
-    RectD defaultRect;
-    if (0 == GetMeasurementSystem())
-        defaultRect = RectD(0, 0, 21.0 / 2.54 * engine->GetFileDPI(), 29.7 / 2.54 * engine->GetFileDPI());
-    else
-        defaultRect = RectD(0, 0, 8.5 * engine->GetFileDPI(), 11 * engine->GetFileDPI());
+    RectD defaultRect = DefaultPageRect();
+    hasProvisionalPageSizes = false;
 
     int columns = ColumnsFromDisplayMode(displayMode);
     int newStartPage = startPage;
@@ -244,10 +266,14 @@ void DisplayModel::BuildPagesInfo() {
         newStartPage--;
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
-        pageInfo->page = engine->PageMediabox(pageNo);
+        // don't block on documents which determine page sizes in the background
+        // (the provisional sizes are replaced in UpdateProvisionalPageSizes)
+        pageInfo->page = engine->PageMediaboxNoWait(pageNo, &pageInfo->provisionalSize);
         // layout pages with an empty mediabox as A4 size (resp. letter size)
         if (pageInfo->page.IsEmpty())
             pageInfo->page = defaultRect;
+        if (pageInfo->provisionalSize)
+            hasProvisionalPageSizes = true;
         pageInfo->visibleRatio = 0.0;
         pageInfo->shown = false;
         if (IsContinuous(displayMode))
@@ -255,6 +281,62 @@ void DisplayModel::BuildPagesInfo() {
         else if (newStartPage <= pageNo && pageNo < newStartPage + columns)
             pageInfo->shown = true;
     }
+    loadingProperties = engine->IsLoadingProperties();
+    if (hasProvisionalPageSizes || loadingProperties)
+        cb->RequestPageSizesUpdate(PROVISIONAL_PAGE_SIZES_DELAY);
+}
+
+RectD DisplayModel::DefaultPageRect() const {
+    if (0 == GetMeasurementSystem())
+        return RectD(0, 0, 21.0 / 2.54 * engine->GetFileDPI(), 29.7 / 2.54 * engine->GetFileDPI());
+    return RectD(0, 0, 8.5 * engine->GetFileDPI(), 11 * engine->GetFileDPI());
+}
+
+// replaces provisional page sizes with the ones the engine has determined
+// in the meantime and re-layouts (keeping the scroll position) if needed
+void DisplayModel::UpdateProvisionalPageSizes() {
+    if (loadingProperties && !engine->IsLoadingProperties()) {
+        loadingProperties = false;
+        cb->PropertiesLoaded(this);
+    }
+    if (!hasProvisionalPageSizes || !pagesInfo) {
+        if (loadingProperties)
+            cb->RequestPageSizesUpdate(PROVISIONAL_PAGE_SIZES_DELAY);
+        return;
+    }
+
+    RectD defaultRect = DefaultPageRect();
+    bool changed = false, resolved = false;
+    hasProvisionalPageSizes = false;
+    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->provisionalSize)
+            continue;
+        RectD page = engine->PageMediaboxNoWait(pageNo, &pageInfo->provisionalSize);
+        if (page.IsEmpty())
+            page = defaultRect;
+        if (page != pageInfo->page) {
+            pageInfo->page = page;
+            pageInfo->contentBox = RectD();
+            changed = true;
+        }
+        if (pageInfo->provisionalSize)
+            hasProvisionalPageSizes = true;
+        else
+            resolved = true;
+    }
+
+    if (changed) {
+        ScrollState ss = GetScrollState();
+        Relayout(zoomVirtual, rotation);
+        SetScrollState(ss);
+    } else if (resolved) {
+        // pages of progressively loaded documents only become renderable
+        // once their final size is known (cf. EngineBase::IsPageDataAvailable)
+        RepaintDisplay();
+    }
+    if (hasProvisionalPageSizes || loadingProperties)
+        cb->RequestPageSizesUpdate(PROVISIONAL_PAGE_SIZES_DELAY);
 }
 
 // TODO: a better name e.g. ShouldShow() to better distinguish between
@@ -850,9 +932,8 @@ void DisplayModel::RenderVisibleParts() {
     if (0 == firstVisiblePage)
         return;
 
-    // rendering happens LIFO except if the queue is currently
-    // empty, so request the visible pages first and last to
-    // make sure they're rendered before the predicted pages
+    // visible pages are always rendered before the predicted ones
+    // (cf. RenderPriority), so the order of the requests doesn't matter
     for (int pageNo = firstVisiblePage; pageNo <= lastVisiblePage; pageNo++) {
         cb->RequestRendering(pageNo);
     }
@@ -870,13 +951,46 @@ void DisplayModel::RenderVisibleParts() {
             cb->RequestRendering(firstVisiblePage - 1);
         if (lastVisiblePage < PageCount())
             cb->RequestRendering(lastVisiblePage + 1);
+
+        // when scrolling quickly, the pages right next to the visible ones
+        // don't suffice, so also render what's about to be scrolled into view
+        int lookahead = GetScrollLookahead();
+        if (lookahead != 0) {
+            RectI area(0, lookahead > 0 ? viewPort.dy : lookahead, viewPort.dx, abs(lookahead));
+            RectI canvasArea = area;
+            canvasArea.Offset(viewPort.x, viewPort.y);
+            for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+                PageInfo* pageInfo = GetPageInfo(pageNo);
+                if (pageInfo->shown && 0.0 == pageInfo->visibleRatio && !pageInfo->pos.Intersect(canvasArea).IsEmpty())
+                    cb->PrefetchRendering(pageNo, area);
+            }
+        }
     }
+}
 
-    // request the visible pages last so that the above requested
-    // invisible pages are not rendered if the queue fills up
-    for (int pageNo = lastVisiblePage; pageNo >= firstVisiblePage; pageNo--) {
-        cb->RequestRendering(pageNo);
+// tracks the vertical scrolling speed (in pixels per second) so that
+// RenderVisibleParts can predict which parts will be visible shortly
+void DisplayModel::UpdateScrollSpeed(int dy) {
+    DWORD now = GetTickCount();
+    DWORD elapsed = now - lastScrollTime;
+    lastScrollTime = now;
+    if (elapsed >= SCROLL_SPEED_TIMEOUT || (scrollSpeed != 0 && (dy < 0) != (scrollSpeed < 0))) {
+        // the speed can only be determined from the next scroll step
+        scrollSpeed = 0;
+        return;
     }
+    int speed = MulDiv(dy, 1000, std::max((int)elapsed, 1));
+    // smooth out irregular scroll steps (e.g. from mouse wheels)
+    scrollSpeed = 0 == scrollSpeed ? speed : (scrollSpeed + speed) / 2;
+}
+
+// returns by how many pixels the view is expected to scroll within
+// the next SCROLL_LOOKAHEAD_MS (limited to two screens in either direction)
+int DisplayModel::GetScrollLookahead() const {
+    if (GetTickCount() - lastScrollTime >= SCROLL_SPEED_TIMEOUT)
+        return 0;
+    int lookahead = MulDiv(scrollSpeed, SCROLL_LOOKAHEAD_MS, 1000);
+    return limitValue(lookahead, -2 * viewPort.dy, 2 * viewPort.dy);
 }
 
 void DisplayModel::SetViewPortSize(SizeI newViewPortSize) {
@@ -1168,6 +1282,7 @@ void DisplayModel::ScrollXBy(int dx) {
 
 void DisplayModel::ScrollYTo(int yOff) {
     int currPageNo = CurrentPageNo();
+    UpdateScrollSpeed(yOff - viewPort.y);
     viewPort.y = yOff;
     RecalcVisibleParts();
     RenderVisibleParts();
@@ -1222,6 +1337,7 @@ void DisplayModel::ScrollYBy(int dy, bool changePage) {
         return;
 
     currPageNo = CurrentPageNo();
+    UpdateScrollSpeed(newYOff - currYOff);
     viewPort.y = newYOff;
     RecalcVisibleParts();
     RenderVisibleParts();
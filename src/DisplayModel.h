@@ -17,6 +17,10 @@ struct PageInfo {
     /* data that is calculated when needed. actual content size within a page (View target) */
     RectD contentBox{};
 
+    /* true while the engine is still determining the page size in the background
+       (page then holds an estimate). Updated in DisplayModel::UpdateProvisionalPageSizes() */
+    bool provisionalSize = false;
+
     /* data that needs to be set before DisplayModel::Relayout().
        Determines whether a given page should be shown on the screen. */
     bool shown = false;
@@ -53,6 +57,7 @@ struct ScrollState {
 };
 
 class PageTextCache;
+class TextIndex;
 class TextSelection;
 class TextSearch;
 struct TextSel;
@@ -167,8 +172,12 @@ class DisplayModel : public Controller {
     Vec<PageAnnotation>* userAnnots = nullptr;
     bool userAnnotsModified = false;
     Synchronizer* pdfSync = nullptr;
+    // modification time of the file when the engine loaded it
+    // (only engines for the current version of a file are shared)
+    FILETIME fileTime = {0};
 
     PageTextCache* textCache = nullptr;
+    TextIndex* textIndex = nullptr;
     TextSelection* textSelection = nullptr;
     // access only from Search thread
     TextSearch* textSearch = nullptr;
@@ -241,6 +250,13 @@ class DisplayModel : public Controller {
     void RepaintDisplay() {
         cb->Repaint();
     }
+    // called when a tile has been rendered which other views sharing
+    // the engine might be waiting for
+    void RepaintSharedViews() {
+        if (engine->IsShared()) {
+            cb->RepaintSharedViews(engine);
+        }
+    }
 
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool dontRenderFlag = false;
@@ -249,14 +265,28 @@ class DisplayModel : public Controller {
         return presentationMode;
     }
 
+    // whether some pages are still laid out with an estimated size
+    bool HasProvisionalPageSizes() const {
+        return hasProvisionalPageSizes;
+    }
+    // whether the engine is still loading the ToC and page labels
+    bool IsLoadingProperties() const {
+        return loadingProperties;
+    }
+    // also notifies the UI once the engine has loaded the properties
+    void UpdateProvisionalPageSizes();
+
   protected:
     void BuildPagesInfo();
+    RectD DefaultPageRect() const;
     float ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) const;
     SizeD PageSizeAfterRotation(int pageNo, bool fitToContent = false) const;
     void ChangeStartPage(int startPage);
     PointI GetContentStart(int pageNo);
     void RecalcVisibleParts();
     void RenderVisibleParts();
+    void UpdateScrollSpeed(int dy);
+    int GetScrollLookahead() const;
     void AddNavPoint();
     RectD GetContentBox(int pageNo);
     void CalcZoomReal(float zoomVirtual);
@@ -300,6 +330,16 @@ class DisplayModel : public Controller {
        this value is extracted from the PDF document */
     bool displayR2L = false;
 
+    /* whether pagesInfo contains pages with provisionalSize set */
+    bool hasProvisionalPageSizes = false;
+    /* whether cb->PropertiesLoaded is still to be called */
+    bool loadingProperties = false;
+
+    /* current vertical scrolling speed in pixels per second (negative
+       when scrolling up) and the time of the latest scroll step */
+    int scrollSpeed = 0;
+    DWORD lastScrollTime = 0;
+
     /* when we're in presentation mode, _pres* contains the pre-presentation values */
     bool presentationMode = false;
     float presZoomVirtual = INVALID_ZOOM;
@@ -4,6 +4,8 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/SyncUtil.h"
+#include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -213,3 +215,130 @@ TreeItem* DocTocTree::RootAt(int n) {
     }
     return node;
 }
+
+void EngineBase::SetFileName(const WCHAR* s) {
+    fileName.SetCopy(s);
+    hasFileFingerprint = s && file::GetFingerprint(s, fileFingerprint);
+}
+
+void EngineBase::CopyFileName(const EngineBase* other) {
+    fileName.SetCopy(other->fileName);
+    memcpy(fileFingerprint, other->fileFingerprint, sizeof(fileFingerprint));
+    hasFileFingerprint = other->hasFileFingerprint;
+}
+
+bool EngineBase::IsFileUnchanged() const {
+    unsigned char fingerprint[16];
+    if (!hasFileFingerprint || !file::GetFingerprint(fileName, fingerprint)) {
+        return false;
+    }
+    return memeq(fingerprint, fileFingerprint, sizeof(fingerprint));
+}
+
+bool EngineBase::IsSameFileVersion(const EngineBase* other) const {
+    if (!hasFileFingerprint || !other->hasFileFingerprint) {
+        return false;
+    }
+    return memeq(fileFingerprint, other->fileFingerprint, sizeof(fileFingerprint));
+}
+
+// timings are sorted into buckets of < 1 ms, < 2 ms, < 4 ms, ... and >= 1024 ms
+#define RENDER_STATS_BUCKETS 12
+
+struct RenderTimings {
+    LONG count;
+    LONG64 totalUs;
+    LONG buckets[RENDER_STATS_BUCKETS];
+};
+
+// updated from several rendering threads at once (so only through Interlocked* functions)
+static LONG gRenderCounters[(int)RenderCounter::Count];
+static RenderTimings gRenderTimings[(int)RenderStage::Count];
+static LONG gMaxQueueDepth;
+// written to by the rendering threads and closed by the UI thread at exit
+static FILE* gRenderStatsLog;
+static Mutex gRenderStatsLogAccess;
+
+static const char* renderCounterNames[] = {"cache hits", "cache misses",     "compressed hits", "evictions",
+                                           "aborted",    "dropped requests", "spared",     "shared hits"};
+static const char* renderStageNames[] = {"queue wait", "load", "run", "convert", "total"};
+static_assert(dimof(renderCounterNames) == (int)RenderCounter::Count, "renderCounterNames doesn't match RenderCounter");
+static_assert(dimof(renderStageNames) == (int)RenderStage::Count, "renderStageNames doesn't match RenderStage");
+
+void RenderStatsCount(RenderCounter counter) {
+    InterlockedIncrement(&gRenderCounters[(int)counter]);
+}
+
+void RenderStatsTime(RenderStage stage, double ms) {
+    RenderTimings& t = gRenderTimings[(int)stage];
+    int bucket = 0;
+    while (bucket < RENDER_STATS_BUCKETS - 1 && ms >= (double)(1 << bucket)) {
+        bucket++;
+    }
+    InterlockedIncrement(&t.count);
+    InterlockedExchangeAdd64(&t.totalUs, (LONG64)(ms * 1000));
+    InterlockedIncrement(&t.buckets[bucket]);
+}
+
+void RenderStatsQueueDepth(size_t depth) {
+    LONG prev = gMaxQueueDepth;
+    while ((LONG)depth > prev) {
+        LONG seen = InterlockedCompareExchange(&gMaxQueueDepth, (LONG)depth, prev);
+        if (seen == prev)
+            break;
+        prev = seen;
+    }
+}
+
+char* DumpRenderStats() {
+    str::Str s;
+    LONG hits = gRenderCounters[(int)RenderCounter::CacheHit];
+    LONG misses = gRenderCounters[(int)RenderCounter::CacheMiss];
+    for (int i = 0; i < (int)RenderCounter::Count; i++) {
+        s.AppendFmt("%s: %d\r\n", renderCounterNames[i], gRenderCounters[i]);
+    }
+    if (hits + misses > 0)
+        s.AppendFmt("hit rate: %.1f%%\r\n", 100.0 * hits / (hits + misses));
+    s.AppendFmt("max. queue depth: %d\r\n", gMaxQueueDepth);
+
+    s.Append("\r\nstage       count   avg ms  <1 <2 <4 <8 <16 <32 <64 <128 <256 <512 <1024 >=1024\r\n");
+    for (int i = 0; i < (int)RenderStage::Count; i++) {
+        RenderTimings& t = gRenderTimings[i];
+        double avg = t.count > 0 ? t.totalUs / 1000.0 / t.count : 0;
+        s.AppendFmt("%-10s %6d %8.2f ", renderStageNames[i], t.count, avg);
+        for (int j = 0; j < RENDER_STATS_BUCKETS; j++) {
+            s.AppendFmt(" %d", t.buckets[j]);
+        }
+        s.Append("\r\n");
+    }
+    return s.StealData();
+}
+
+void LogRenderStatsToFile(const WCHAR* path) {
+    ScopedMutex scope(&gRenderStatsLogAccess);
+    CrashIf(gRenderStatsLog);
+    gRenderStatsLog = _wfopen(path, L"w");
+}
+
+void CloseRenderStatsLog() {
+    ScopedMutex scope(&gRenderStatsLogAccess);
+    if (gRenderStatsLog) {
+        fclose(gRenderStatsLog);
+        gRenderStatsLog = nullptr;
+    }
+}
+
+void LogRenderStats(const char* fmt, ...) {
+    // no need to format anything if logging is disabled
+    if (!gRenderStatsLog)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    AutoFree s(str::FmtV(fmt, args));
+    va_end(args);
+    ScopedMutex scope(&gRenderStatsLogAccess);
+    if (gRenderStatsLog) {
+        fprintf(gRenderStatsLog, "%s\n", s.Get());
+        fflush(gRenderStatsLog);
+    }
+}
@@ -277,6 +277,12 @@ class AbortCookie {
     // aborts a rendering request (as far as possible)
     // note: must be thread-safe
     virtual void Abort() = 0;
+    // returns how much of the rendering has been done (from 0.0 to 1.0),
+    // if the engine can tell (used for deciding whether to abort it)
+    // note: must be thread-safe (the result may be a rough estimate)
+    virtual float GetProgress() {
+        return 0.0f;
+    }
 };
 
 class EngineBase {
@@ -294,10 +300,25 @@ class EngineBase {
     char* decryptionKey = nullptr;
     bool hasPageLabels = false;
     int pageCount = -1;
+    LONG refCount = 1;
 
     virtual ~EngineBase() {
         free(decryptionKey);
     }
+
+    // an engine can be shared by several DisplayModels showing the same document
+    // (in different tabs or windows), the last one to release it deletes it
+    void AddRef() {
+        InterlockedIncrement(&refCount);
+    }
+    void Release() {
+        if (0 == InterlockedDecrement(&refCount)) {
+            delete this;
+        }
+    }
+    bool IsShared() const {
+        return refCount > 1;
+    }
     // creates a clone of this engine (e.g. for printing on a different thread)
     virtual EngineBase* Clone() = 0;
 
@@ -309,6 +330,19 @@ class EngineBase {
 
     // the box containing the visible page content (usually RectD(0, 0, pageWidth, pageHeight))
     virtual RectD PageMediabox(int pageNo) = 0;
+    // same as PageMediabox but never blocks. Engines may determine page sizes lazily
+    // (for faster loading of large documents), in which case a provisional size is
+    // returned for pages whose size isn't known yet and isProvisional is set to true
+    virtual RectD PageMediaboxNoWait(int pageNo, bool* isProvisional) {
+        *isProvisional = false;
+        return PageMediabox(pageNo);
+    }
+    // false while the data needed for rendering pageNo is still being read (for documents
+    // that are loaded progressively), in which case rendering should be retried later
+    virtual bool IsPageDataAvailable(int pageNo) {
+        UNUSED(pageNo);
+        return true;
+    }
     // the box inside PageMediabox that actually contains any relevant content
     // (used for auto-cropping in Fit Content mode, can be PageMediabox)
     virtual RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) {
@@ -349,6 +383,10 @@ class EngineBase {
     virtual WCHAR* ExtractPageText(int pageNo, RectI** coordsOut = nullptr) = 0;
     // pages where clipping doesn't help are rendered in larger tiles
     virtual bool HasClipOptimizations(int pageNo) = 0;
+    // whether RenderBitmap may be called from several threads at once
+    virtual bool HasParallelRendering() {
+        return false;
+    }
     // the layout type this document's author suggests (if the user doesn't care)
     // whether the content should be displayed as images instead of as document pages
     // (e.g. with a black background and less padding in between and without search UI)
@@ -386,6 +424,11 @@ class EngineBase {
     // returns a list of all available elements for this page
     // caller must delete the result (including all elements contained in the Vec)
     virtual Vec<PageElement*>* GetElements(int pageNo) = 0;
+    // same as GetElements but never loads the elements (e.g. for callers which paint),
+    // in which case nullptr is returned for pages whose elements haven't been loaded yet
+    virtual Vec<PageElement*>* GetElementsNoWait(int pageNo) {
+        return GetElements(pageNo);
+    }
     // returns the element at a given point or nullptr if there's none
     // caller must delete the result
     virtual PageElement* GetElementAtPos(int pageNo, PointD pt) = 0;
@@ -407,9 +450,15 @@ class EngineBase {
         return nullptr;
     }
 
+    // whether the ToC, page labels and document properties are still being loaded
+    // in the background (the UI queries them again once they've been loaded)
+    virtual bool IsLoadingProperties() const {
+        return false;
+    }
+
     // checks whether this document has explicit labels for pages (such as
     // roman numerals) instead of the default plain arabic numbering
-    bool HasPageLabels() const {
+    virtual bool HasPageLabels() const {
         return hasPageLabels;
     }
     // returns a label to be displayed instead of the page number
@@ -441,6 +490,10 @@ class EngineBase {
     const WCHAR* FileName() const {
         return fileName.Get();
     }
+    // whether the file hasn't changed since it was loaded by this engine
+    // (clones reload the file by name and would otherwise get another version)
+    bool IsFileUnchanged() const;
+    bool IsSameFileVersion(const EngineBase* other) const;
 
     virtual RenderedBitmap* GetImageForPageElement(PageElement*) {
         CrashMe();
@@ -448,13 +501,59 @@ class EngineBase {
     }
 
   protected:
-    void SetFileName(const WCHAR* s) {
-        fileName.SetCopy(s);
-    }
+    void SetFileName(const WCHAR* s);
+    // for clones which reuse the data of the given engine instead of reloading the file
+    void CopyFileName(const EngineBase* other);
 
     AutoFreeWstr fileName;
+    // cf. file::GetFingerprint (only set if the file name refers to an actual file)
+    unsigned char fileFingerprint[16] = {0};
+    bool hasFileFingerprint = false;
 };
 
+/* Counters and timing histograms for the stages of the rendering pipeline,
+   collected by RenderCache and the fitz based engines (cf. DumpRenderStats) */
+enum class RenderCounter {
+    CacheHit,
+    CacheMiss,
+    // an evicted bitmap was restored from its compressed copy
+    CompressedHit,
+    Eviction,
+    // rendering was aborted (e.g. because the page is no longer visible)
+    Aborted,
+    // a queued request was dropped because the queue was full
+    Dropped,
+    // a stale rendering wasn't aborted as it was almost done
+    Spared,
+    // a tile was painted from a bitmap rendered for another view of the same document
+    SharedHit,
+    Count
+};
+
+enum class RenderStage {
+    // time between queuing a request and a rendering thread picking it up
+    QueueWait,
+    // loading a page and creating its display list
+    Load,
+    // running the display list into a pixmap
+    Run,
+    // converting the pixmap into the final bitmap
+    Convert,
+    // everything a rendering thread does for a request
+    Total,
+    Count
+};
+
+void RenderStatsCount(RenderCounter counter);
+void RenderStatsTime(RenderStage stage, double ms);
+void RenderStatsQueueDepth(size_t depth);
+// returns a human readable summary of all counters and timings
+char* DumpRenderStats();
+// also log details of each rendered request as one JSON object per line
+void LogRenderStatsToFile(const WCHAR* path);
+void CloseRenderStatsLog();
+void LogRenderStats(const char* fmt, ...);
+
 class PasswordUI {
   public:
     virtual WCHAR* GetPassword(const WCHAR* fileName, unsigned char* fileDigest, unsigned char decryptionKeyOut[32],
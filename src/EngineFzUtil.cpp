@@ -86,6 +86,112 @@ fz_matrix fz_create_view_ctm(fz_rect mediabox, float zoom, int rotation) {
     return ctm;
 }
 
+static thread_local LONG64 gAllocatedOnThread = 0;
+
+extern "C" static void* fz_malloc_tracked(void* user, size_t size) {
+    UNUSED(user);
+    void* p = malloc(size);
+    if (p) {
+        gAllocatedOnThread += (LONG64)_msize(p);
+    }
+    return p;
+}
+
+extern "C" static void* fz_realloc_tracked(void* user, void* p, size_t size) {
+    UNUSED(user);
+    LONG64 prevSize = p ? (LONG64)_msize(p) : 0;
+    void* res = realloc(p, size);
+    if (res) {
+        gAllocatedOnThread += (LONG64)_msize(res) - prevSize;
+    } else if (0 == size) {
+        gAllocatedOnThread -= prevSize;
+    }
+    return res;
+}
+
+extern "C" static void fz_free_tracked(void* user, void* p) {
+    UNUSED(user);
+    if (p) {
+        gAllocatedOnThread -= (LONG64)_msize(p);
+    }
+    free(p);
+}
+
+FzMemTracker::FzMemTracker() {
+    alloc.user = this;
+    alloc.malloc = fz_malloc_tracked;
+    alloc.realloc = fz_realloc_tracked;
+    alloc.free = fz_free_tracked;
+}
+
+LONG64 FzMemTracker::AllocatedOnThread() {
+    return gAllocatedOnThread;
+}
+
+FzCtxPool::FzCtxPool() {
+    InitializeCriticalSection(&access);
+}
+
+FzCtxPool::~FzCtxPool() {
+    CrashIf(unused.size() > 0);
+    DeleteCriticalSection(&access);
+}
+
+void FzCtxPool::Init(fz_context* ctx, CRITICAL_SECTION* ctxAccess) {
+    this->ctx = ctx;
+    this->ctxAccess = ctxAccess;
+}
+
+static int GetProcessorCount() {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return std::max(1, (int)si.dwNumberOfProcessors);
+}
+
+// number of clones currently handed out by all FzCtxPools
+static LONG gCtxPoolClonesInUse = 0;
+
+// returns nullptr if the context can't be cloned or if there are already as many
+// clones in use as there are processors (in which case the caller should fall
+// back to using ctx under ctxAccess or not render on several threads)
+fz_context* FzCtxPool::Acquire() {
+    static int maxClonesInUse = GetProcessorCount();
+    if (InterlockedIncrement(&gCtxPoolClonesInUse) > maxClonesInUse) {
+        InterlockedDecrement(&gCtxPoolClonesInUse);
+        return nullptr;
+    }
+    {
+        ScopedCritSec scope(&access);
+        if (unused.size() > 0) {
+            return unused.Pop();
+        }
+    }
+    // fz_clone_context copies ctx which mustn't be modified in the meantime
+    ScopedCritSec scope(ctxAccess);
+    fz_context* clone = fz_clone_context(ctx);
+    if (!clone) {
+        InterlockedDecrement(&gCtxPoolClonesInUse);
+    }
+    return clone;
+}
+
+void FzCtxPool::Release(fz_context* clone) {
+    if (!clone) {
+        return;
+    }
+    InterlockedDecrement(&gCtxPoolClonesInUse);
+    ScopedCritSec scope(&access);
+    unused.Append(clone);
+}
+
+void FzCtxPool::DropAll() {
+    ScopedCritSec scope(&access);
+    for (fz_context* clone : unused) {
+        fz_drop_context(clone);
+    }
+    unused.Reset();
+}
+
 struct istream_filter {
     IStream* stream;
     unsigned char buf[4096];
@@ -145,6 +251,249 @@ fz_stream* fz_open_istream(fz_context* ctx, IStream* stream) {
     return stm;
 }
 
+extern "C" static int next_mapped_file(fz_context* ctx, fz_stream* stm, size_t max) {
+    UNUSED(ctx);
+    UNUSED(stm);
+    UNUSED(max);
+    // all data is always available through rp/wp
+    return EOF;
+}
+
+// same as seek_buffer in fitz/stream-open.c
+extern "C" static void seek_mapped_file(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    UNUSED(ctx);
+    i64 pos = stm->pos - (stm->wp - stm->rp);
+    if (whence == 1) {
+        offset += pos;
+    } else if (whence == 2) {
+        offset += stm->pos;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+    if (offset > stm->pos) {
+        offset = stm->pos;
+    }
+    stm->rp += offset - pos;
+}
+
+extern "C" static void drop_mapped_file(fz_context* ctx, void* state) {
+    UNUSED(ctx);
+    delete (file::MappedFile*)state;
+}
+
+// a mapped file can't be truncated or replaced by other programs (e.g. by a LaTeX
+// build regenerating a document while it's open) and read errors on network or
+// removable drives would become in-page exceptions, so only map read-only files
+// on fixed drives (which aren't expected to change while they're open)
+static bool ShouldMapFile(const WCHAR* filePath) {
+    if (!path::IsOnFixedDrive(filePath)) {
+        return false;
+    }
+    DWORD attrs = GetFileAttributesW(filePath);
+    return attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_READONLY) != 0;
+}
+
+// returns a stream which reads directly from a memory mapping of the file
+// (so that seeking and reading is zero-copy); returns nullptr if the file
+// can't be mapped
+static fz_stream* fz_open_mapped_file(fz_context* ctx, const WCHAR* filePath) {
+    file::MappedFile* mf = file::Map(filePath);
+    if (!mf) {
+        return nullptr;
+    }
+
+    fz_stream* stm = nullptr;
+    fz_try(ctx) {
+        stm = fz_new_stream(ctx, mf, next_mapped_file, drop_mapped_file);
+    }
+    fz_catch(ctx) {
+        delete mf;
+        fz_rethrow(ctx);
+    }
+    stm->seek = seek_mapped_file;
+    stm->rp = (u8*)mf->data.data();
+    stm->wp = stm->rp + mf->data.size();
+    stm->pos = (i64)mf->data.size();
+    return stm;
+}
+
+// returns the mapped data if stm was opened by fz_open_file2 through a file mapping
+// Note: the data is valid for as long as stm is
+std::string_view fz_stream_mapped_data(fz_stream* stm) {
+    if (!stm || stm->next != next_mapped_file) {
+        return {};
+    }
+    file::MappedFile* mf = (file::MappedFile*)stm->state;
+    return mf->data;
+}
+
+// size of the chunks in which progressively opened files are read
+#define PROGRESSIVE_READ_CHUNK_SIZE (256 * 1024)
+
+// a file which is read into memory by a background thread
+// while the data read so far can already be parsed
+struct ProgressiveFile {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE thread = nullptr;
+    u8* data = nullptr;
+    i64 size = 0;
+    // number of bytes read so far (only ever increases)
+    LONG64 available = 0;
+    // set once the reader thread is done (either at the end or after a read error)
+    LONG done = 0;
+    // note: no need for Interlocked* since this value is
+    //       only ever changed from false to true
+    bool cancel = false;
+    // signaled whenever more data has been read (cf. fz_progressive_stream_wait)
+    CRITICAL_SECTION waitAccess;
+    CONDITION_VARIABLE dataRead;
+};
+
+// wakes up all threads waiting in fz_progressive_stream_wait
+static void NotifyProgressiveRead(ProgressiveFile* pf, i64 available, bool done) {
+    {
+        ScopedCritSec scope(&pf->waitAccess);
+        InterlockedExchange64(&pf->available, available);
+        if (done) {
+            InterlockedExchange(&pf->done, 1);
+        }
+    }
+    WakeAllConditionVariable(&pf->dataRead);
+}
+
+static DWORD WINAPI ProgressiveFileReaderThread(LPVOID data) {
+    ProgressiveFile* pf = (ProgressiveFile*)data;
+    i64 pos = 0;
+    while (pos < pf->size && !pf->cancel) {
+        DWORD toRead = (DWORD)std::min(pf->size - pos, (i64)PROGRESSIVE_READ_CHUNK_SIZE);
+        DWORD read = 0;
+        BOOL ok = ReadFile(pf->hFile, pf->data + pos, toRead, &read, nullptr);
+        if (!ok || read == 0) {
+            break;
+        }
+        pos += read;
+        NotifyProgressiveRead(pf, pos, false);
+    }
+    NotifyProgressiveRead(pf, pos, true);
+    return 0;
+}
+
+// throws FZ_ERROR_TRYLATER if the requested data hasn't been read yet
+extern "C" static int next_progressive_file(fz_context* ctx, fz_stream* stm, size_t max) {
+    ProgressiveFile* pf = (ProgressiveFile*)stm->state;
+    // read done before available, so that all data is available if done is set
+    bool done = InterlockedCompareExchange(&pf->done, 0, 0) != 0;
+    i64 available = InterlockedCompareExchange64(&pf->available, 0, 0);
+    if (stm->pos >= available) {
+        if (done) {
+            return EOF;
+        }
+        fz_throw(ctx, FZ_ERROR_TRYLATER, "data at offset %lld hasn't been read yet", stm->pos);
+    }
+    size_t n = (size_t)std::min(available - stm->pos, (i64)std::max(max, (size_t)1));
+    stm->rp = pf->data + stm->pos;
+    stm->wp = stm->rp + n;
+    stm->pos += n;
+    return *stm->rp++;
+}
+
+extern "C" static void seek_progressive_file(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    UNUSED(ctx);
+    ProgressiveFile* pf = (ProgressiveFile*)stm->state;
+    if (whence == 1) {
+        offset += stm->pos - (stm->wp - stm->rp);
+    } else if (whence == 2) {
+        offset += pf->size;
+    }
+    stm->pos = std::max(std::min(offset, pf->size), (i64)0);
+    stm->rp = stm->wp = pf->data;
+}
+
+extern "C" static void drop_progressive_file(fz_context* ctx, void* state) {
+    UNUSED(ctx);
+    ProgressiveFile* pf = (ProgressiveFile*)state;
+    if (pf->thread) {
+        pf->cancel = true;
+        WaitForSingleObject(pf->thread, INFINITE);
+        CloseHandle(pf->thread);
+    }
+    if (pf->hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(pf->hFile);
+    }
+    free(pf->data);
+    DeleteCriticalSection(&pf->waitAccess);
+    delete pf;
+}
+
+// returns a progressive stream (cf. FZ_ERROR_TRYLATER) for files on slow drives,
+// which is read in the background; returns nullptr if the file can't be read
+fz_stream* fz_open_file_progressive(fz_context* ctx, const WCHAR* filePath) {
+    ProgressiveFile* pf = new ProgressiveFile();
+    InitializeCriticalSection(&pf->waitAccess);
+    InitializeConditionVariable(&pf->dataRead);
+    pf->hFile = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER size;
+    if (INVALID_HANDLE_VALUE == pf->hFile || !GetFileSizeEx(pf->hFile, &size) || size.QuadPart <= 0 ||
+        (u64)size.QuadPart > (size_t)-1) {
+        drop_progressive_file(ctx, pf);
+        return nullptr;
+    }
+    pf->size = size.QuadPart;
+    pf->data = (u8*)malloc((size_t)pf->size);
+    if (!pf->data) {
+        drop_progressive_file(ctx, pf);
+        return nullptr;
+    }
+
+    fz_stream* stm = nullptr;
+    fz_try(ctx) {
+        stm = fz_new_stream(ctx, pf, next_progressive_file, drop_progressive_file);
+    }
+    fz_catch(ctx) {
+        drop_progressive_file(ctx, pf);
+        fz_rethrow(ctx);
+    }
+    stm->seek = seek_progressive_file;
+    stm->progressive = 1;
+    pf->thread = CreateThread(nullptr, 0, ProgressiveFileReaderThread, pf, 0, nullptr);
+    if (!pf->thread) {
+        InterlockedExchange(&pf->done, 1);
+    }
+    return stm;
+}
+
+// returns the number of bytes of a stream opened with fz_open_file_progressive that
+// have been read so far resp. -1 if all data that will be read is available
+i64 fz_progressive_stream_available(fz_stream* stm) {
+    if (!stm || stm->next != next_progressive_file) {
+        return -1;
+    }
+    ProgressiveFile* pf = (ProgressiveFile*)stm->state;
+    if (InterlockedCompareExchange(&pf->done, 0, 0) != 0) {
+        return -1;
+    }
+    return InterlockedCompareExchange64(&pf->available, 0, 0);
+}
+
+// blocks until at least minAvailable bytes of a stream opened with fz_open_file_progressive
+// have been read (or all data that will be read is available) or timeout ms have passed
+// without any data being read, instead of polling fz_progressive_stream_available
+void fz_progressive_stream_wait(fz_stream* stm, i64 minAvailable, DWORD timeout) {
+    if (!stm || stm->next != next_progressive_file) {
+        return;
+    }
+    ProgressiveFile* pf = (ProgressiveFile*)stm->state;
+    ScopedCritSec scope(&pf->waitAccess);
+    while (InterlockedCompareExchange(&pf->done, 0, 0) == 0 &&
+           InterlockedCompareExchange64(&pf->available, 0, 0) < minAvailable) {
+        if (!SleepConditionVariableCS(&pf->dataRead, &pf->waitAccess, timeout)) {
+            break;
+        }
+    }
+}
+
 void* fz_memdup(fz_context* ctx, void* p, size_t size) {
     void* res = fz_malloc_no_throw(ctx, size);
     if (!res) {
@@ -192,6 +541,16 @@ fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath) {
         return stm;
     }
 
+    // larger read-only files are memory mapped so that MuPDF reads from them without
+    // copying; all others are read through fz_open_file_w's buffer, which keeps the
+    // file open but allows other programs to overwrite it (cf. ShouldMapFile)
+    if (ShouldMapFile(filePath)) {
+        stm = fz_open_mapped_file(ctx, filePath);
+        if (stm) {
+            return stm;
+        }
+    }
+
     fz_try(ctx) {
         stm = fz_open_file_w(ctx, filePath);
     }
@@ -222,6 +581,16 @@ u8* fz_extract_stream_data(fz_context* ctx, fz_stream* stream, size_t* cbCount)
 }
 
 void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, unsigned char digest[16]) {
+    fz_md5 md5;
+    // hash mapped files in place instead of copying them into a buffer first
+    std::string_view mapped = fz_stream_mapped_data(stm);
+    if (!mapped.empty()) {
+        fz_md5_init(&md5);
+        fz_md5_update(&md5, (const unsigned char*)mapped.data(), mapped.size());
+        fz_md5_final(&md5, digest);
+        return;
+    }
+
     i64 fileLen = -1;
     fz_buffer* buf = nullptr;
 
@@ -242,17 +611,38 @@ void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, unsigned char digest
     CrashIf((size_t)fileLen != size);
     fz_drop_buffer(ctx, buf);
 
-    fz_md5 md5;
     fz_md5_init(&md5);
     fz_md5_update(&md5, data, size);
     fz_md5_final(&md5, digest);
+    fz_free(ctx, data);
+}
+
+// returns the size in bytes of a DIB with the given stride and height
+// or 0 if it's invalid or too large for a DIB section (whose size is a DWORD)
+static DWORD GetDIBSize(ptrdiff_t stride, int h) {
+    if (stride <= 0 || h <= 0) {
+        return 0;
+    }
+    size_t size = (size_t)stride * (size_t)h;
+    if (size / (size_t)stride != (size_t)h || size > INT_MAX) {
+        return 0;
+    }
+    return (DWORD)size;
 }
 
 // try to produce an 8-bit palette for saving some memory
-static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
+// pixmap must either be RGBA or BGRA (isBgr)
+static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap, bool isBgr) {
     int w = pixmap->w;
     int h = pixmap->h;
+    if (w <= 0 || w > INT_MAX - 3) {
+        return nullptr;
+    }
     int rows8 = ((w + 3) / 4) * 4;
+    DWORD imgSize = GetDIBSize(rows8, h);
+    if (!imgSize) {
+        return nullptr;
+    }
     unsigned char* bmpData = (unsigned char*)calloc(rows8, h);
     if (!bmpData)
         return nullptr;
@@ -268,9 +658,15 @@ static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
     RGBQUAD c;
     for (int j = 0; j < h; j++) {
         for (int i = 0; i < w; i++) {
-            c.rgbRed = *source++;
-            c.rgbGreen = *source++;
-            c.rgbBlue = *source++;
+            if (isBgr) {
+                c.rgbBlue = *source++;
+                c.rgbGreen = *source++;
+                c.rgbRed = *source++;
+            } else {
+                c.rgbRed = *source++;
+                c.rgbGreen = *source++;
+                c.rgbBlue = *source++;
+            }
             c.rgbReserved = 0;
             source++;
 
@@ -307,7 +703,7 @@ static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
     bmih->biPlanes = 1;
     bmih->biCompression = BI_RGB;
     bmih->biBitCount = 8;
-    bmih->biSizeImage = h * rows8;
+    bmih->biSizeImage = imgSize;
     bmih->biClrUsed = paletteSize;
 
     void* data = nullptr;
@@ -354,7 +750,7 @@ static fz_pixmap* fz_convert_pixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorsp
 
 RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
     if (pixmap->n == 4 && fz_colorspace_is_rgb(ctx, pixmap->colorspace)) {
-        RenderedBitmap* res = try_render_as_palette_image(pixmap);
+        RenderedBitmap* res = try_render_as_palette_image(pixmap, false);
         if (res) {
             return res;
         }
@@ -383,9 +779,12 @@ RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
     int w = bgrPixmap->w;
     int h = bgrPixmap->h;
     int n = bgrPixmap->n;
-    int imgSize = bgrPixmap->stride * h;
-    int imgSize2 = w * h * n;
+    DWORD imgSize = GetDIBSize(bgrPixmap->stride, h);
     int bitsCount = n * 8;
+    if (!imgSize) {
+        fz_drop_pixmap(ctx, bgrPixmap);
+        return nullptr;
+    }
 
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
     bmih->biSize = sizeof(*bmih);
@@ -417,6 +816,315 @@ RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
     return new RenderedBitmap(hbmp, SizeI(w, h), hMap);
 }
 
+// creates a BGRA DIB section of the size of bbox along with a pixmap which
+// shares the DIB section's memory, so that rendering into the pixmap directly
+// produces the final bitmap (without any conversion or copying)
+// returns nullptr if the DIB section couldn't be created
+// Note: the pixmap must be dropped before the bitmap is deleted
+RenderedBitmap* new_rendered_fz_pixmap_target(fz_context* ctx, fz_irect bbox, fz_pixmap** pixOut) {
+    *pixOut = nullptr;
+    int w = bbox.x1 - bbox.x0;
+    int h = bbox.y1 - bbox.y0;
+    // 32 bits per pixel, so rows are always DWORD aligned as GDI requires
+    if (w <= 0 || w > INT_MAX / 4) {
+        return nullptr;
+    }
+    DWORD imgSize = GetDIBSize(w * 4, h);
+    if (!imgSize) {
+        return nullptr;
+    }
+
+    BITMAPINFO bmi = {};
+    BITMAPINFOHEADER* bmih = &bmi.bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = w;
+    bmih->biHeight = -h;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = 32;
+    bmih->biSizeImage = imgSize;
+
+    void* data = nullptr;
+    HANDLE hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, imgSize, nullptr);
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    if (!hbmp || !data) {
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return nullptr;
+    }
+
+    RenderedBitmap* bmp = new RenderedBitmap(hbmp, SizeI(w, h), hMap);
+    fz_try(ctx) {
+        /* BGRA is a GDI compatible format */
+        *pixOut = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), bbox, nullptr, 1, (unsigned char*)data);
+    }
+    fz_catch(ctx) {
+        delete bmp;
+        fz_rethrow(ctx);
+    }
+    return bmp;
+}
+
+// returns an 8-bit palette image instead of bmp (which is then deleted) if
+// pix (as returned by new_rendered_fz_pixmap_target) uses at most 256 colors.
+// This needs another pass over all pixels, so it isn't done for large pixmaps
+RenderedBitmap* compact_rendered_fz_pixmap(fz_pixmap* pix, RenderedBitmap* bmp) {
+    if (!bmp || (size_t)pix->w * (size_t)pix->h > MAX_PALETTE_IMAGE_PIXELS) {
+        return bmp;
+    }
+    RenderedBitmap* res = try_render_as_palette_image(pix, true);
+    if (!res) {
+        return bmp;
+    }
+    delete bmp;
+    return res;
+}
+
+// how often (in ms) the caller's cookie is synchronized with the band threads' cookies
+#define RENDER_BAND_SYNC_INTERVAL 50
+// the scale for the combined progress of all bands (cf. SyncBandCookies)
+#define RENDER_BAND_PROGRESS_MAX 1000
+// band threads which haven't had a band to render for this long (in ms) quit
+#define RENDER_BAND_THREAD_IDLE_TIMEOUT 5000
+
+struct RenderBand {
+    fz_context* ctx = nullptr;
+    fz_display_list* list = nullptr;
+    fz_matrix ctm;
+    fz_pixmap* pix = nullptr;
+    fz_irect rect;
+    // MuPDF updates progress and errors without synchronization, so band threads
+    // don't share the caller's cookie but each use their own threadCookie
+    fz_cookie* cookie = nullptr;
+    fz_cookie threadCookie;
+    // set once the band has been rendered (protected by RenderBandThreads::access)
+    bool done = false;
+    bool ok = false;
+};
+
+// the band threads are shared by all renderings (the number of bands rendered at once
+// is limited by the number of contexts FzCtxPool hands out) and reused for many bands
+struct RenderBandThreads {
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE bandQueued;
+    CONDITION_VARIABLE bandDone;
+    // bands waiting for a band thread
+    Vec<RenderBand*> queue;
+    int threadCount = 0;
+    int idleCount = 0;
+
+    RenderBandThreads() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&bandQueued);
+        InitializeConditionVariable(&bandDone);
+    }
+};
+
+// Note: never destroyed, as idle band threads might still be waiting for bands at exit
+static RenderBandThreads* GetRenderBandThreads() {
+    static RenderBandThreads* threads = new RenderBandThreads();
+    return threads;
+}
+
+static void RenderBandContent(RenderBand* band) {
+    fz_context* ctx = band->ctx;
+    fz_pixmap* sub = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(sub);
+    fz_var(dev);
+
+    fz_try(ctx) {
+        // the band's pixmap shares the samples with the full pixmap
+        sub = fz_new_pixmap_from_pixmap(ctx, band->pix, &band->rect);
+        dev = fz_new_draw_device(ctx, fz_identity, sub);
+        fz_run_display_list(ctx, band->list, dev, band->ctm, fz_rect_from_irect(band->rect), band->cookie);
+        fz_close_device(ctx, dev);
+        band->ok = true;
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, sub);
+    }
+    fz_catch(ctx) {
+        band->ok = false;
+    }
+}
+
+static DWORD WINAPI RenderBandThread(LPVOID data) {
+    RenderBandThreads* threads = (RenderBandThreads*)data;
+    EnterCriticalSection(&threads->access);
+    for (;;) {
+        if (threads->queue.size() == 0) {
+            threads->idleCount++;
+            BOOL woken =
+                SleepConditionVariableCS(&threads->bandQueued, &threads->access, RENDER_BAND_THREAD_IDLE_TIMEOUT);
+            threads->idleCount--;
+            if (!woken && threads->queue.size() == 0) {
+                break;
+            }
+            continue;
+        }
+        RenderBand* band = threads->queue.PopAt(0);
+        LeaveCriticalSection(&threads->access);
+
+        RenderBandContent(band);
+
+        EnterCriticalSection(&threads->access);
+        band->done = true;
+        WakeAllConditionVariable(&threads->bandDone);
+    }
+    threads->threadCount--;
+    LeaveCriticalSection(&threads->access);
+    return 0;
+}
+
+// passes the caller's abort flag on to the band threads and reports the progress
+// of the least advanced band as the combined progress
+static void SyncBandCookies(Vec<RenderBand>& bands, fz_cookie* cookie) {
+    float progress = 1.0f;
+    for (RenderBand& band : bands) {
+        if (band.cookie != &band.threadCookie) {
+            continue;
+        }
+        band.threadCookie.abort = cookie->abort;
+        int max = band.threadCookie.progress_max;
+        float bandProgress = max > 0 ? std::min((float)band.threadCookie.progress / max, 1.0f) : 0.0f;
+        progress = std::min(progress, bandProgress);
+    }
+    cookie->progress_max = RENDER_BAND_PROGRESS_MAX;
+    cookie->progress = (int)(progress * RENDER_BAND_PROGRESS_MAX);
+}
+
+static int GetRenderBandCount(fz_irect bbox) {
+    int dx = bbox.x1 - bbox.x0;
+    int dy = bbox.y1 - bbox.y0;
+    if ((size_t)dx * (size_t)dy < MIN_BANDED_RENDER_PIXELS) {
+        return 1;
+    }
+    static int maxBands = GetProcessorCount();
+    return std::max(1, std::min(maxBands, dy / MIN_RENDER_BAND_HEIGHT));
+}
+
+// renders list into pix. Large pixmaps are split into horizontal bands which
+// are rendered concurrently on the shared band threads with contexts from ctxPool
+// (the display list is shared by all threads, the bands are all drawn into pix's
+// samples). As there are only as many contexts as processors for all renderings,
+// fewer bands (or none) are rendered concurrently while other renderings are running
+// Note: the band threads never need ctxAccess (which is separate from MuPDF's
+// locks), callers pass nullptr for ctxPool when rendering with ctx under ctxAccess
+// Note: throws if rendering fails. While the band threads run, the calling
+// thread passes cookie->abort on to them and updates cookie->progress (as the
+// progress of the least advanced band); their errors are added up at the end
+void fz_run_display_list_banded(fz_context* ctx, FzCtxPool* ctxPool, fz_display_list* list, fz_matrix ctm,
+                                fz_pixmap* pix, fz_cookie* cookie) {
+    fz_irect bbox = fz_pixmap_bbox(ctx, pix);
+    int nBands = ctxPool ? GetRenderBandCount(bbox) : 1;
+
+    // with several bands, the calling thread only waits for the band threads
+    // (and synchronizes the cookies), so every band gets a context from ctxPool
+    RenderBand init;
+    init.list = list;
+    init.ctm = ctm;
+    init.pix = pix;
+    init.cookie = cookie;
+    memset(&init.threadCookie, 0, sizeof(init.threadCookie));
+
+    Vec<RenderBand> bands;
+    for (int i = 0; i < nBands && nBands > 1; i++) {
+        init.ctx = ctxPool->Acquire();
+        if (!init.ctx) {
+            break;
+        }
+        bands.Append(init);
+    }
+    if (bands.size() < 2) {
+        // a single band is rendered right away by the calling thread
+        for (RenderBand& band : bands) {
+            ctxPool->Release(band.ctx);
+        }
+        bands.Reset();
+        init.ctx = ctx;
+        bands.Append(init);
+    }
+
+    nBands = (int)bands.size();
+    int dy = bbox.y1 - bbox.y0;
+    for (int i = 0; i < nBands; i++) {
+        RenderBand& band = bands.at(i);
+        band.rect = bbox;
+        band.rect.y0 = bbox.y0 + dy * i / nBands;
+        band.rect.y1 = bbox.y0 + dy * (i + 1) / nBands;
+        if (nBands > 1 && cookie) {
+            band.threadCookie.abort = cookie->abort;
+            band.cookie = &band.threadCookie;
+        }
+    }
+
+    if (nBands == 1) {
+        RenderBandContent(&bands.at(0));
+    } else {
+        // bands is no longer modified, so the band threads can be given pointers into it
+        RenderBandThreads* threads = GetRenderBandThreads();
+        EnterCriticalSection(&threads->access);
+        for (RenderBand& band : bands) {
+            threads->queue.Append(&band);
+        }
+        WakeAllConditionVariable(&threads->bandQueued);
+        // only start as many new threads as there are bands which no idle thread is going to render
+        for (int i = (int)threads->queue.size() - threads->idleCount; i > 0; i--) {
+            HANDLE hThread = CreateThread(nullptr, 0, RenderBandThread, threads, 0, nullptr);
+            if (!hThread) {
+                break;
+            }
+            CloseHandle(hThread);
+            threads->threadCount++;
+        }
+
+        for (;;) {
+            bool allDone = true;
+            for (RenderBand& band : bands) {
+                if (!band.done && 0 == threads->threadCount && threads->queue.Contains(&band)) {
+                    // no band thread could be started, so render the band here
+                    threads->queue.Remove(&band);
+                    LeaveCriticalSection(&threads->access);
+                    RenderBandContent(&band);
+                    EnterCriticalSection(&threads->access);
+                    band.done = true;
+                }
+                allDone = allDone && band.done;
+            }
+            if (allDone) {
+                break;
+            }
+            SleepConditionVariableCS(&threads->bandDone, &threads->access, RENDER_BAND_SYNC_INTERVAL);
+            if (cookie) {
+                SyncBandCookies(bands, cookie);
+            }
+        }
+        LeaveCriticalSection(&threads->access);
+    }
+
+    for (RenderBand& band : bands) {
+        if (band.cookie == &band.threadCookie) {
+            cookie->errors += band.threadCookie.errors;
+            cookie->incomplete |= band.threadCookie.incomplete;
+        }
+        if (band.ctx != ctx) {
+            ctxPool->Release(band.ctx);
+        }
+    }
+
+    for (RenderBand& band : bands) {
+        if (!band.ok) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "failed to render band %d-%d", band.rect.y0, band.rect.y1);
+        }
+    }
+}
+
 static inline int wchars_per_rune(int rune) {
     if (rune & 0x1F0000)
         return 2;
@@ -1149,3 +1857,21 @@ void FzLinkifyPageText(FzPageInfo* pageInfo) {
     delete list;
     free(coords);
 }
+
+// frees everything cached for a page except for its mediabox
+void FzPageInfoDropData(fz_context* ctx, FzPageInfo* pageInfo) {
+    fz_drop_link(ctx, pageInfo->links);
+    pageInfo->links = nullptr;
+    fz_drop_stext_page(ctx, pageInfo->stext);
+    pageInfo->stext = nullptr;
+    fz_drop_display_list(ctx, pageInfo->list);
+    pageInfo->list = nullptr;
+    fz_drop_page(ctx, pageInfo->page);
+    pageInfo->page = nullptr;
+    DeleteVecMembers(pageInfo->autoLinks);
+    DeleteVecMembers(pageInfo->comments);
+    pageInfo->images.Reset();
+    pageInfo->hasText = false;
+    pageInfo->hasElements = false;
+    pageInfo->memSize = 0;
+}
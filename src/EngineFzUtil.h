@@ -9,6 +9,12 @@
 #define MAX_PAGE_RUN_CACHE 8
 // maximum estimated memory requirement allowed for the run cache of one document
 #define MAX_PAGE_RUN_MEMORY (40 * 1024 * 1024)
+// pages with more pixels than this are rendered in horizontal bands on several threads
+#define MIN_BANDED_RENDER_PIXELS (4 * 1024 * 1024)
+// minimum height of such a band in pixels
+#define MIN_RENDER_BAND_HEIGHT 256
+// only rendered bitmaps with at most this many pixels are reduced to 8-bit palette images
+#define MAX_PALETTE_IMAGE_PIXELS (4 * 1024 * 1024)
 
 class FitzAbortCookie : public AbortCookie {
   public:
@@ -19,6 +25,15 @@ class FitzAbortCookie : public AbortCookie {
     void Abort() override {
         cookie.abort = 1;
     }
+    // fz_run_display_list counts the display list nodes run so far
+    // (for banded rendering, this is the progress of the least advanced band)
+    float GetProgress() override {
+        int max = cookie.progress_max;
+        if (max <= 0) {
+            return 0.0f;
+        }
+        return std::min((float)cookie.progress / max, 1.0f);
+    }
 };
 
 struct FitzImagePos {
@@ -27,6 +42,15 @@ struct FitzImagePos {
     fz_matrix transform;
 };
 
+// the data in FzPageInfo is loaded in tiers, as rendering only
+// needs the display list while text and page elements are expensive
+// to extract and often never needed (e.g. for pages only scrolled past)
+enum class FzPageData {
+    Render,   // page and display list
+    Text,     // + stext and images
+    Elements, // + links, auto-detected links and comments
+};
+
 struct FzPageInfo {
     int pageNo = 0; // 1-based
     fz_page* page = nullptr;
@@ -41,7 +65,48 @@ struct FzPageInfo {
     fz_display_list* list = nullptr;
     fz_stext_page* stext = nullptr;
     RectD mediabox = {};
+    // set while mediabox is only a provisional size (cf. PdfEngineImpl::FinishLoading)
+    bool mediaboxProvisional = false;
     Vec<FitzImagePos> images;
+
+    // set once stext/images resp. links/autoLinks/comments have been loaded
+    // (they might be empty or nullptr even then)
+    bool hasText = false;
+    bool hasElements = false;
+
+    // estimated amount of memory used by the data above (see FzMemTracker)
+    size_t memSize = 0;
+};
+
+// allocator which keeps track of how much memory each thread allocates through it
+// (allows estimating how much memory the cached data of a page requires)
+struct FzMemTracker {
+    fz_alloc_context alloc;
+
+    FzMemTracker();
+    // net amount of memory allocated (minus freed) on the calling thread
+    // through any FzMemTracker (only meaningful as a difference)
+    static LONG64 AllocatedOnThread();
+};
+
+// clones of a fz_context, one per thread that's currently rendering, which
+// allows rendering (immutable) display lists on several threads at once.
+// All pools together hand out at most one clone per processor (which covers
+// both render workers and band threads, cf. fz_run_display_list_banded)
+// Note: the clones share the original's allocator, store and locks,
+// so DropAll() must be called before the original is dropped
+struct FzCtxPool {
+    fz_context* ctx = nullptr; // not owned
+    CRITICAL_SECTION* ctxAccess = nullptr;
+    Vec<fz_context*> unused;
+    CRITICAL_SECTION access;
+
+    FzCtxPool();
+    ~FzCtxPool();
+    void Init(fz_context* ctx, CRITICAL_SECTION* ctxAccess);
+    fz_context* Acquire();
+    void Release(fz_context* clone);
+    void DropAll();
 };
 
 struct LinkRectList {
@@ -61,10 +126,18 @@ WCHAR* pdf_clean_string(WCHAR* string);
 
 fz_stream* fz_open_istream(fz_context* ctx, IStream* stream);
 fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath);
+fz_stream* fz_open_file_progressive(fz_context* ctx, const WCHAR* filePath);
+i64 fz_progressive_stream_available(fz_stream* stm);
+void fz_progressive_stream_wait(fz_stream* stm, i64 minAvailable, DWORD timeout);
+std::string_view fz_stream_mapped_data(fz_stream* stm);
 void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, unsigned char digest[16]);
 u8* fz_extract_stream_data(fz_context* ctx, fz_stream* stream, size_t* cbCount);
 
 RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap);
+RenderedBitmap* new_rendered_fz_pixmap_target(fz_context* ctx, fz_irect bbox, fz_pixmap** pixOut);
+RenderedBitmap* compact_rendered_fz_pixmap(fz_pixmap* pix, RenderedBitmap* bmp);
+void fz_run_display_list_banded(fz_context* ctx, FzCtxPool* ctxPool, fz_display_list* list, fz_matrix ctm,
+                                fz_pixmap* pix, fz_cookie* cookie);
 
 WCHAR* fz_text_page_to_str(fz_stext_page* text, RectI** coordsOut);
 
@@ -77,5 +150,6 @@ PageElement* newFzImage(int pageNo, fz_rect rect, size_t imageIdx);
 PageElement* newFzLink(int pageNo, fz_link* link, fz_outline* outline, bool isAttachment);
 PageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointD pt);
 Vec<PageElement*>* FzGetElements(FzPageInfo* pageInfo);
+void FzPageInfoDropData(fz_context* ctx, FzPageInfo* pageInfo);
 PageElement* makePdfCommentFromPdfAnnot(fz_context* ctx, int pageNo, pdf_annot* annot);
 void FzLinkifyPageText(FzPageInfo* pageInfo);
@@ -386,7 +386,7 @@ EngineBase* ImageEngineImpl::Clone() {
     }
 
     ImageEngineImpl* clone = new ImageEngineImpl();
-    clone->SetFileName(FileName());
+    clone->CopyFileName(this);
     clone->defaultFileExt = defaultFileExt;
     clone->fileExt = fileExt;
     clone->fileDPI = fileDPI;
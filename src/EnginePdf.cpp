@@ -13,8 +13,10 @@ extern "C" {
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/HtmlParserLookup.h"
+#include "utils/SyncUtil.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
 #include "utils/Log.h"
@@ -362,8 +364,162 @@ struct PageTreeStackItem {
     }
 };
 
+// helpers for (de)serializing document metadata (cf. PdfEngineImpl::LoadMetadataCache)
+// integers are stored as 32-bit little-endian values, strings with a length prefix
+
+#define METADATA_NULL_STR ((uint32_t)-1)
+
+static void fz_append_float_le(fz_context* ctx, fz_buffer* buf, float f) {
+    uint32_t bits;
+    static_assert(sizeof(bits) == sizeof(f), "unexpected float size");
+    memcpy(&bits, &f, sizeof(bits));
+    fz_append_int32_le(ctx, buf, (int)bits);
+}
+
+static float fz_read_float_le(fz_context* ctx, fz_stream* stm) {
+    uint32_t bits = fz_read_uint32_le(ctx, stm);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static void fz_append_metadata_str(fz_context* ctx, fz_buffer* buf, const char* s) {
+    if (!s) {
+        fz_append_int32_le(ctx, buf, (int)METADATA_NULL_STR);
+        return;
+    }
+    size_t len = str::Len(s);
+    fz_append_int32_le(ctx, buf, (int)len);
+    fz_append_data(ctx, buf, s, len);
+}
+
+// returns a string allocated with fz_malloc (or nullptr)
+static char* fz_read_metadata_str(fz_context* ctx, fz_stream* stm) {
+    uint32_t len = fz_read_uint32_le(ctx, stm);
+    if (len == METADATA_NULL_STR) {
+        return nullptr;
+    }
+    if (len > fz_available(ctx, stm, len)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "premature end of file in string");
+    }
+    char* s = (char*)fz_malloc(ctx, (size_t)len + 1);
+    fz_read(ctx, stm, (unsigned char*)s, len);
+    s[len] = '\0';
+    return s;
+}
+
+static void fz_append_outline(fz_context* ctx, fz_buffer* buf, fz_outline* outline) {
+    int count = 0;
+    for (fz_outline* node = outline; node; node = node->next) {
+        count++;
+    }
+    fz_append_int32_le(ctx, buf, count);
+    for (fz_outline* node = outline; node; node = node->next) {
+        fz_append_metadata_str(ctx, buf, node->title);
+        fz_append_metadata_str(ctx, buf, node->uri);
+        fz_append_int32_le(ctx, buf, node->page);
+        fz_append_float_le(ctx, buf, node->x);
+        fz_append_float_le(ctx, buf, node->y);
+        fz_append_int32_le(ctx, buf, node->is_open);
+        fz_append_int32_le(ctx, buf, node->flags);
+        fz_append_int32_le(ctx, buf, node->has_color);
+        for (int i = 0; i < 4; i++) {
+            fz_append_float_le(ctx, buf, node->color[i]);
+        }
+        fz_append_outline(ctx, buf, node->down);
+    }
+}
+
+// outlines nested deeper than this are considered corrupted
+#define MAX_METADATA_OUTLINE_DEPTH 256
+
+static fz_outline* fz_read_outline(fz_context* ctx, fz_stream* stm, int depth = 0) {
+    if (depth > MAX_METADATA_OUTLINE_DEPTH) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "outline nested too deeply");
+    }
+    uint32_t count = fz_read_uint32_le(ctx, stm);
+    fz_outline root = {0}, *node = &root;
+
+    fz_try(ctx) {
+        for (uint32_t n = 0; n < count; n++) {
+            node = node->next = fz_new_outline(ctx);
+            node->title = fz_read_metadata_str(ctx, stm);
+            node->uri = fz_read_metadata_str(ctx, stm);
+            node->page = (int)fz_read_uint32_le(ctx, stm);
+            node->x = fz_read_float_le(ctx, stm);
+            node->y = fz_read_float_le(ctx, stm);
+            node->is_open = (int)fz_read_uint32_le(ctx, stm);
+            node->flags = (int)fz_read_uint32_le(ctx, stm);
+            node->has_color = (int)fz_read_uint32_le(ctx, stm);
+            for (int i = 0; i < 4; i++) {
+                node->color[i] = fz_read_float_le(ctx, stm);
+            }
+            node->down = fz_read_outline(ctx, stm, depth + 1);
+        }
+    }
+    fz_catch(ctx) {
+        fz_drop_outline(ctx, root.next);
+        fz_rethrow(ctx);
+    }
+    return root.next;
+}
+
+// parses a dictionary serialized with pdf_sprint_obj
+static pdf_obj* pdf_parse_metadata_dict(fz_context* ctx, pdf_document* doc, const char* s) {
+    fz_stream* stm = nullptr;
+    pdf_obj* dict = nullptr;
+    pdf_lexbuf lexbuf;
+    pdf_lexbuf_init(ctx, &lexbuf, PDF_LEXBUF_SMALL);
+
+    fz_var(stm);
+    fz_try(ctx) {
+        stm = fz_open_memory(ctx, (const unsigned char*)s, str::Len(s));
+        if (pdf_lex(ctx, stm, &lexbuf) != PDF_TOK_OPEN_DICT) {
+            fz_throw(ctx, FZ_ERROR_SYNTAX, "expected a dictionary");
+        }
+        dict = pdf_parse_dict(ctx, doc, stm, &lexbuf);
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, stm);
+        pdf_lexbuf_fin(ctx, &lexbuf);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+    return dict;
+}
+
 ///// Above are extensions to Fitz and MuPDF, now follows PdfEngine /////
 
+// for documents with more pages, the page sizes are determined in the background
+#define MAX_EAGER_MEDIABOX_PAGES 1000
+// number of page sizes determined at once by MediaboxThread
+#define MEDIABOX_BATCH_SIZE 64
+
+// the metadata of documents with at least this many pages is cached on disk
+// (cf. SetEnginePdfMetadataCacheDir)
+#define MIN_METADATA_CACHE_PAGES 200
+#define METADATA_CACHE_MAGIC 0x434d5053 /* 'SPMC' */
+// increase when changing the layout of the cache files
+#define METADATA_CACHE_VERSION 2
+#define METADATA_CACHE_EXT L".pdfmeta"
+
+// linearized files of at least this size which aren't on a fixed drive
+// (e.g. on a network share) are loaded progressively
+#define MIN_PROGRESSIVE_FILE_SIZE (4 * 1024 * 1024)
+// how often (in ms) threads waiting for more of a progressively loaded file
+// check whether they've been canceled (cf. fz_progressive_stream_wait)
+#define PROGRESSIVE_POLL_INTERVAL 50
+
+// set from the UI thread, read by engines loading on other threads
+static WCHAR* gMetadataCacheDir = nullptr;
+static Mutex gMetadataCacheDirAccess;
+
+void SetEnginePdfMetadataCacheDir(const WCHAR* dir) {
+    ScopedMutex scope(&gMetadataCacheDirAccess);
+    str::ReplacePtr(&gMetadataCacheDir, dir);
+}
+
 class PdfEngineImpl : public EngineBase {
   public:
     PdfEngineImpl();
@@ -371,6 +527,8 @@ class PdfEngineImpl : public EngineBase {
     EngineBase* Clone() override;
 
     RectD PageMediabox(int pageNo) override;
+    RectD PageMediaboxNoWait(int pageNo, bool* isProvisional) override;
+    bool IsPageDataAvailable(int pageNo) override;
     RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderBitmap(int pageNo, float zoom, int rotation,
@@ -386,6 +544,10 @@ class PdfEngineImpl : public EngineBase {
     WCHAR* ExtractPageText(int pageNo, RectI** coordsOut = nullptr) override;
 
     bool HasClipOptimizations(int pageNo) override;
+    // concurrent renderings use separate contexts from renderCtxs
+    bool HasParallelRendering() override {
+        return true;
+    }
     WCHAR* GetProperty(DocumentProperty prop) override;
 
     bool SupportsAnnotation(bool forSaving = false) const override;
@@ -394,12 +556,15 @@ class PdfEngineImpl : public EngineBase {
     bool BenchLoadPage(int pageNo) override;
 
     Vec<PageElement*>* GetElements(int pageNo) override;
+    Vec<PageElement*>* GetElementsNoWait(int pageNo) override;
     PageElement* GetElementAtPos(int pageNo, PointD pt) override;
     RenderedBitmap* GetImageForPageElement(PageElement*) override;
 
     PageDestination* GetNamedDest(const WCHAR* name) override;
     DocTocTree* GetTocTree() override;
 
+    bool IsLoadingProperties() const override;
+    bool HasPageLabels() const override;
     WCHAR* GetPageLabel(int pageNo) const override;
     int GetPageByLabel(const WCHAR* label) const override;
 
@@ -410,6 +575,14 @@ class PdfEngineImpl : public EngineBase {
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    // what ctxAccess points to; this mustn't be one of MuPDF's own mutexes, as
+    // MuPDF calls made under ctxAccess take e.g. FZ_LOCK_FREETYPE while the render
+    // contexts (which run without ctxAccess) allocate under FZ_LOCK_FREETYPE,
+    // and FZ_LOCK_ALLOC must always be the innermost lock
+    CRITICAL_SECTION docAccess;
+    // protects FzPageInfo::mediabox and ::mediaboxProvisional (which are
+    // updated by mediaboxThread); never ask for other locks while holding it
+    CRITICAL_SECTION mediaboxAccess;
 
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
@@ -418,9 +591,15 @@ class PdfEngineImpl : public EngineBase {
   protected:
     fz_context* ctx = nullptr;
     fz_locks_context fz_locks_ctx;
+    FzMemTracker memTracker;
+    // contexts for rendering outside of ctxAccess
+    FzCtxPool renderCtxs;
     fz_document* _doc = nullptr;
     fz_stream* _docStream = nullptr;
     Vec<FzPageInfo*> _pages;
+    // pages with loaded data, least recently used first (protected by pagesAccess)
+    Vec<FzPageInfo*> runCache;
+    size_t runCacheMem = 0;
     fz_outline* outline = nullptr;
     fz_outline* attachments = nullptr;
     pdf_obj* _info = nullptr;
@@ -437,8 +616,45 @@ class PdfEngineImpl : public EngineBase {
     bool LoadFromStream(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool FinishLoading();
 
+    // determines the sizes of pages that only have a provisional size after FinishLoading
+    HANDLE mediaboxThread = nullptr;
+    // note: no need for Interlocked* since this value is
+    //       only ever changed from false to true
+    bool mediaboxThreadCancel = false;
+    static DWORD WINAPI MediaboxThread(LPVOID data);
+    void LoadProvisionalMediaboxes();
+    RectD LoadPageMediabox(int pageIdx, int pageObjNum = 0);
+    void SetPageMediabox(FzPageInfo* pageInfo, RectD mediabox);
+
+    // path of the cached metadata (only set for documents that qualify for caching)
+    AutoFreeWstr metadataCachePath;
+    unsigned char metadataDigest[16] = {0};
+    void InitMetadataCachePath();
+    bool LoadMetadataCache();
+    void SaveMetadataCache();
+    void LoadMetadata(bool lazyMediaboxes, bool deferProperties = false);
+    void LoadProperties();
+
+    // set for linearized files which are still being read (cf. fz_open_file_progressive)
+    bool progressiveLoad = false;
+    // set for engines created by Clone, which get the page sizes from the original
+    // engine and neither use the metadata cache nor load the file progressively
+    bool isClone = false;
+    // offset of the end of the first page's data in a linearized file
+    i64 firstPageDataEnd = 0;
+    // set until LoadProperties has been called by MediaboxThread; outline, attachments,
+    // _info and _pageLabels may only be accessed outside of MediaboxThread once it's
+    // been reset (cf. IsLoadingProperties)
+    LONG loadingProperties = 0;
+    void WaitForPageData(int pageNo);
+
     fz_page* GetFzPage(int pageNo, bool failIfBusy = false);
-    FzPageInfo* GetFzPageInfo(int pageNo, bool failIfBusy = false);
+    FzPageInfo* GetFzPageInfo(int pageNo, bool failIfBusy = false, FzPageData need = FzPageData::Render);
+    void LoadPageText(FzPageInfo* pageInfo);
+    void LoadPageElements(FzPageInfo* pageInfo);
+    void TouchPageRun(FzPageInfo* pageInfo);
+    void AddPageRunMem(FzPageInfo* pageInfo, LONG64 memBefore);
+    void EvictPageRuns(FzPageInfo* keep);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation);
     DocTocItem* BuildTocTree(fz_outline* entry, int& idCounter, bool isAttachment);
@@ -491,38 +707,34 @@ PdfEngineImpl::PdfEngineImpl() {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    InitializeCriticalSection(&mediaboxAccess);
+    InitializeCriticalSection(&docAccess);
+    ctxAccess = &docAccess;
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_UNLIMITED);
+    ctx = fz_new_context(&memTracker.alloc, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
     installFitzErrorCallbacks(ctx);
 
     pdf_install_load_system_font_funcs(ctx);
+    renderCtxs.Init(ctx, ctxAccess);
 }
 
 PdfEngineImpl::~PdfEngineImpl() {
+    if (mediaboxThread) {
+        mediaboxThreadCancel = true;
+        WaitForSingleObject(mediaboxThread, INFINITE);
+        CloseHandle(mediaboxThread);
+    }
+
     EnterCriticalSection(&pagesAccess);
 
     // TODO: remove this lock and see what happens
     EnterCriticalSection(ctxAccess);
 
     for (auto* pi : _pages) {
-        if (pi->links) {
-            fz_drop_link(ctx, pi->links);
-        }
-        if (pi->stext) {
-            fz_drop_stext_page(ctx, pi->stext);
-        }
-        if (pi->list) {
-            fz_drop_display_list(ctx, pi->list);
-        }
-        if (pi->page) {
-            fz_drop_page(ctx, pi->page);
-        }
-        DeleteVecMembers(pi->autoLinks);
-        DeleteVecMembers(pi->comments);
+        FzPageInfoDropData(ctx, pi);
     }
 
     DeleteVecMembers(_pages);
@@ -532,6 +744,7 @@ PdfEngineImpl::~PdfEngineImpl() {
     pdf_drop_obj(ctx, _info);
 
     fz_drop_document(ctx, _doc);
+    renderCtxs.DropAll();
     fz_drop_context(ctx);
 
     delete _pageLabels;
@@ -539,11 +752,13 @@ PdfEngineImpl::~PdfEngineImpl() {
     delete tocTree;
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
         DeleteCriticalSection(&mutexes[i]);
     }
+    LeaveCriticalSection(ctxAccess);
+    DeleteCriticalSection(&docAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
+    DeleteCriticalSection(&mediaboxAccess);
 }
 
 class PasswordCloner : public PasswordUI {
@@ -564,7 +779,6 @@ class PasswordCloner : public PasswordUI {
 };
 
 EngineBase* PdfEngineImpl::Clone() {
-    ScopedCritSec scope(ctxAccess);
     if (!FileName()) {
         // before port we could clone streams but it's no longer possible
         return nullptr;
@@ -573,11 +787,19 @@ EngineBase* PdfEngineImpl::Clone() {
     // use this document's encryption key (if any) to load the clone
     PasswordCloner* pwdUI = nullptr;
     pdf_document* doc = (pdf_document*)_doc;
-    if (pdf_crypt_key(ctx, doc->crypt)) {
-        pwdUI = new PasswordCloner(pdf_crypt_key(ctx, doc->crypt));
+    bool isEncrypted;
+    {
+        ScopedCritSec scope(ctxAccess);
+        isEncrypted = doc->crypt != nullptr;
+        if (pdf_crypt_key(ctx, doc->crypt)) {
+            pwdUI = new PasswordCloner(pdf_crypt_key(ctx, doc->crypt));
+        }
     }
 
+    // the clone is loaded without ctxAccess, so that this engine can
+    // keep rendering while e.g. text extraction threads clone it
     PdfEngineImpl* clone = new PdfEngineImpl();
+    clone->isClone = true;
     bool ok = clone->Load(FileName(), pwdUI);
     if (!ok) {
         delete clone;
@@ -586,11 +808,24 @@ EngineBase* PdfEngineImpl::Clone() {
     }
     delete pwdUI;
 
-    if (!decryptionKey && doc->crypt) {
+    // instead of determining all page sizes once more, reuse the ones already known
+    // (as long as the clone got the same version of the file)
+    if (clone->PageCount() == PageCount() && clone->IsSameFileVersion(this)) {
+        for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+            bool isProvisional;
+            RectD mediabox = PageMediaboxNoWait(pageNo, &isProvisional);
+            if (!isProvisional) {
+                clone->SetPageMediabox(clone->_pages[pageNo - 1], mediabox);
+            }
+        }
+    }
+
+    if (!decryptionKey && isEncrypted) {
         free(clone->decryptionKey);
         clone->decryptionKey = nullptr;
     }
 
+    ScopedCritSec scope(ctxAccess);
     clone->UpdateUserAnnotations(&userAnnots);
 
     return clone;
@@ -613,6 +848,21 @@ static const WCHAR* findEmbedMarks(const WCHAR* fileName) {
     return embedMarks;
 }
 
+// only linearized files can be displayed before they've been read completely
+// (and reading is only slow enough to make this worthwhile for larger files
+// which aren't on a local hard drive)
+static bool ShouldLoadProgressively(const WCHAR* fileName) {
+    if (path::IsOnFixedDrive(fileName) || file::GetSize(fileName) < MIN_PROGRESSIVE_FILE_SIZE) {
+        return false;
+    }
+    // the linearization dictionary must be the first object in the file
+    char header[1024] = {0};
+    if (!file::ReadN(fileName, header, sizeof(header) - 1)) {
+        return false;
+    }
+    return str::StartsWith(header, "%PDF") && str::Find(header, "/Linearized");
+}
+
 bool PdfEngineImpl::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
     AssertCrash(!FileName() && !_doc && ctx);
     SetFileName(fileName);
@@ -626,7 +876,12 @@ bool PdfEngineImpl::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
     if (embedMarks)
         *embedMarks = '\0';
     fz_try(ctx) {
-        file = fz_open_file2(ctx, fileName);
+        if (!embedMarks && !isClone && ShouldLoadProgressively(fileName)) {
+            file = fz_open_file_progressive(ctx, fileName);
+        }
+        if (!file) {
+            file = fz_open_file2(ctx, fileName);
+        }
     }
     fz_catch(ctx) {
         file = nullptr;
@@ -696,14 +951,24 @@ bool PdfEngineImpl::LoadFromStream(fz_stream* stm, PasswordUI* pwdUI) {
         return false;
     }
 
-    fz_try(ctx) {
-        pdf_document* doc = pdf_open_document_with_stream(ctx, stm);
-        _doc = (fz_document*)doc;
-    }
-    fz_always(ctx) {
-        fz_drop_stream(ctx, stm);
+    // progressively loaded files throw FZ_ERROR_TRYLATER until
+    // enough data has been read for opening the document
+    bool tryLater = true;
+    while (!_doc && tryLater) {
+        fz_try(ctx) {
+            pdf_document* doc = pdf_open_document_with_stream(ctx, stm);
+            _doc = (fz_document*)doc;
+        }
+        fz_catch(ctx) {
+            tryLater = fz_caught(ctx) == FZ_ERROR_TRYLATER;
+        }
+        if (!_doc && tryLater) {
+            // retry as soon as the next chunk has been read
+            fz_progressive_stream_wait(stm, fz_progressive_stream_available(stm) + 1, INFINITE);
+        }
     }
-    fz_catch(ctx) {
+    fz_drop_stream(ctx, stm);
+    if (!_doc) {
         return false;
     }
 
@@ -718,6 +983,8 @@ bool PdfEngineImpl::LoadFromStream(fz_stream* stm, PasswordUI* pwdUI) {
         return false;
     }
 
+    // the fingerprint is calculated over the entire file
+    fz_progressive_stream_wait(stm, INT64_MAX, INFINITE);
     unsigned char digest[16 + 32] = {0};
     pdf_document* doc = (pdf_document*)_doc;
     fz_stream_fingerprint(ctx, doc->file, digest);
@@ -815,34 +1082,86 @@ bool PdfEngineImpl::FinishLoading() {
     allowsPrinting = fz_has_permission(ctx, _doc, FZ_PERMISSION_PRINT);
     allowsCopyingText = fz_has_permission(ctx, _doc, FZ_PERMISSION_COPY);
 
-    ScopedCritSec scope(ctxAccess);
+    // for linearized files that are still being read, the first page is displayed as soon
+    // as its data is available, everything else is loaded once the whole file has been read
+    if (doc->file_reading_linearly && fz_progressive_stream_available(_docStream) >= 0) {
+        progressiveLoad = true;
+        firstPageDataEnd = pdf_dict_get_int(ctx, doc->linear_obj, PDF_NAME(E));
+        if (firstPageDataEnd <= 0) {
+            // wait for the whole file if the linearization dictionary is broken
+            firstPageDataEnd = INT64_MAX;
+        }
+        WaitForPageData(1);
+    }
 
-    // this does the job of pdf_bound_page but without doing pdf_load_page()
-    // TODO: time pdf_load_page(), maybe it's not slow?
-    for (int i = 0; i < pageCount; i++) {
-        fz_rect mbox;
-        fz_matrix page_ctm;
+    ScopedCritSec scope(ctxAccess);
 
-        fz_try(ctx) {
-            pdf_obj* pageref = pdf_lookup_page_obj(ctx, doc, i);
-            pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
-            mbox = fz_transform_rect(mbox, page_ctm);
-        }
-        fz_catch(ctx) {
-        }
-        if (fz_is_empty_rect(mbox)) {
-            fz_warn(ctx, "cannot find page size for page %d", i);
-            mbox.x0 = 0;
-            mbox.y0 = 0;
-            mbox.x1 = 612;
-            mbox.y1 = 792;
+    bool lazyMediaboxes = false;
+    if (progressiveLoad) {
+        lazyMediaboxes = true;
+        InterlockedExchange(&loadingProperties, 1);
+        LoadMetadata(lazyMediaboxes, true);
+    } else if (isClone) {
+        // provisional page sizes are determined on demand (cf. PageMediabox)
+        lazyMediaboxes = pageCount > MAX_EAGER_MEDIABOX_PAGES;
+        LoadMetadata(lazyMediaboxes);
+    } else {
+        InitMetadataCachePath();
+        if (!LoadMetadataCache()) {
+            lazyMediaboxes = pageCount > MAX_EAGER_MEDIABOX_PAGES;
+            LoadMetadata(lazyMediaboxes);
+            // for lazyMediaboxes, the cache is saved once MediaboxThread is done
+            if (!lazyMediaboxes) {
+                SaveMetadataCache();
+            }
         }
+    }
+    // TODO: support javascript
+    AssertCrash(!pdf_js_supported(ctx, doc));
+
+    if (lazyMediaboxes && !isClone) {
+        mediaboxThread = CreateThread(nullptr, 0, MediaboxThread, this, 0, nullptr);
+    }
+
+    return true;
+}
+
+// loads page sizes, outline, attachments, document properties and page labels
+// (for deferProperties, all but the page sizes are loaded by MediaboxThread)
+// Note: make sure to only call with ctxAccess
+void PdfEngineImpl::LoadMetadata(bool lazyMediaboxes, bool deferProperties) {
+    pdf_document* doc = (pdf_document*)_doc;
+
+    // determining the sizes of all pages requires walking the whole page tree, which
+    // takes seconds for documents with many thousand pages. For such documents only
+    // the first page's size is determined right away and used as a provisional size
+    // for all other pages until MediaboxThread (or PageMediabox) has determined it
+    // (the page tree of progressively loaded documents might not be available yet)
+    RectD firstMediabox = LoadPageMediabox(0, progressiveLoad ? doc->linear_page1_obj_num : 0);
+    for (int i = 0; i < pageCount; i++) {
         FzPageInfo* pageInfo = new FzPageInfo();
-        pageInfo->mediabox = fz_rect_to_RectD(mbox);
         pageInfo->pageNo = i + 1;
+        if (i == 0) {
+            pageInfo->mediabox = firstMediabox;
+        } else if (lazyMediaboxes) {
+            pageInfo->mediabox = firstMediabox;
+            pageInfo->mediaboxProvisional = true;
+        } else {
+            pageInfo->mediabox = LoadPageMediabox(i);
+        }
         _pages.Append(pageInfo);
     }
 
+    if (!deferProperties) {
+        LoadProperties();
+    }
+}
+
+// loads outline, attachments, document properties and page labels
+// Note: make sure to only call with ctxAccess
+void PdfEngineImpl::LoadProperties() {
+    pdf_document* doc = (pdf_document*)_doc;
+
     fz_try(ctx) {
         outline = fz_load_outline(ctx, _doc);
     }
@@ -907,16 +1226,346 @@ bool PdfEngineImpl::FinishLoading() {
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load page labels");
     }
-    if (_pageLabels) {
-        hasPageLabels = true;
+}
+
+// the metadata cache file is named after the document's path, size and
+// modification time (like the text index cache), so that modified documents
+// never match an existing cache file without having to read them in full
+// Note: make sure to only call with ctxAccess
+void PdfEngineImpl::InitMetadataCachePath() {
+    pdf_document* doc = (pdf_document*)_doc;
+    // don't store the outline, etc. of encrypted documents in plain text
+    if (!FileName() || pageCount < MIN_METADATA_CACHE_PAGES || doc->crypt) {
+        return;
+    }
+    AutoFreeWstr cacheDir;
+    {
+        ScopedMutex scope(&gMetadataCacheDirAccess);
+        cacheDir.SetCopy(gMetadataCacheDir);
+    }
+    if (!cacheDir || !file::GetFingerprint(FileName(), metadataDigest)) {
+        return;
     }
+    AutoFree fingerprint(_MemToHex(&metadataDigest));
+    AutoFreeWstr fname(strconv::FromAnsi(fingerprint));
+    metadataCachePath.Set(str::Format(L"%s\\%s%s", cacheDir.Get(), fname.Get(), METADATA_CACHE_EXT));
+}
 
-    // TODO: support javascript
-    AssertCrash(!pdf_js_supported(ctx, doc));
+// Note: make sure to only call with ctxAccess
+bool PdfEngineImpl::LoadMetadataCache() {
+    if (!metadataCachePath) {
+        return false;
+    }
+    AutoFree data(file::ReadFile(metadataCachePath));
+    if (!data.data) {
+        return false;
+    }
+
+    // the cache file ends in the MD5 digest of all preceding data
+    // (so that incompletely written files are detected)
+    size_t len = data.size();
+    bool checksumOk = false;
+    if (len > 16) {
+        len -= 16;
+        unsigned char digest[16];
+        fz_md5 md5;
+        fz_md5_init(&md5);
+        fz_md5_update(&md5, (const unsigned char*)data.data, len);
+        fz_md5_final(&md5, digest);
+        checksumOk = memeq(digest, data.data + len, sizeof(digest));
+    }
 
+    pdf_document* doc = (pdf_document*)_doc;
+    fz_stream* stm = nullptr;
+    Vec<RectD> mediaboxes;
+    WStrVec* labels = nullptr;
+    fz_outline* cachedOutline = nullptr;
+    fz_outline* cachedAttachments = nullptr;
+    char* infoStr = nullptr;
+    pdf_obj* info = nullptr;
+    bool ok = false;
+
+    fz_var(stm);
+    fz_var(labels);
+    fz_var(cachedOutline);
+    fz_var(cachedAttachments);
+    fz_var(infoStr);
+    fz_var(info);
+    fz_var(ok);
+    fz_try(ctx) {
+        if (!checksumOk) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "checksum mismatch");
+        }
+        stm = fz_open_memory(ctx, (const unsigned char*)data.data, len);
+        if (fz_read_uint32_le(ctx, stm) != METADATA_CACHE_MAGIC ||
+            fz_read_uint32_le(ctx, stm) != METADATA_CACHE_VERSION) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported version");
+        }
+        unsigned char digest[16];
+        if (fz_read(ctx, stm, digest, sizeof(digest)) != sizeof(digest) ||
+            !memeq(digest, metadataDigest, sizeof(digest)) || (int)fz_read_uint32_le(ctx, stm) != pageCount) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "cache belongs to a different document");
+        }
+
+        for (int i = 0; i < pageCount; i++) {
+            RectD mbox;
+            mbox.x = fz_read_float_le(ctx, stm);
+            mbox.y = fz_read_float_le(ctx, stm);
+            mbox.dx = fz_read_float_le(ctx, stm);
+            mbox.dy = fz_read_float_le(ctx, stm);
+            mediaboxes.Append(mbox);
+        }
+
+        uint32_t labelCount = fz_read_uint32_le(ctx, stm);
+        if (labelCount != 0 && labelCount != (uint32_t)pageCount) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "unexpected number of page labels");
+        }
+        if (labelCount != 0) {
+            labels = new WStrVec();
+            for (uint32_t i = 0; i < labelCount; i++) {
+                char* label = fz_read_metadata_str(ctx, stm);
+                labels->Append(strconv::FromUtf8(label ? label : ""));
+                fz_free(ctx, label);
+            }
+        }
+
+        cachedOutline = fz_read_outline(ctx, stm);
+        cachedAttachments = fz_read_outline(ctx, stm);
+        infoStr = fz_read_metadata_str(ctx, stm);
+        if (infoStr) {
+            info = pdf_parse_metadata_dict(ctx, doc, infoStr);
+        }
+        ok = true;
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, stm);
+        fz_free(ctx, infoStr);
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "ignoring metadata cache: %s", fz_caught_message(ctx));
+    }
+
+    if (!ok) {
+        // the cache file is stale or corrupted and will be rebuilt
+        delete labels;
+        fz_drop_outline(ctx, cachedOutline);
+        fz_drop_outline(ctx, cachedAttachments);
+        pdf_drop_obj(ctx, info);
+        file::Delete(metadataCachePath);
+        return false;
+    }
+
+    for (int i = 0; i < pageCount; i++) {
+        FzPageInfo* pageInfo = new FzPageInfo();
+        pageInfo->pageNo = i + 1;
+        pageInfo->mediabox = mediaboxes.at(i);
+        _pages.Append(pageInfo);
+    }
+    outline = cachedOutline;
+    attachments = cachedAttachments;
+    _info = info;
+    _pageLabels = labels;
     return true;
 }
 
+// Note: make sure to only call with ctxAccess
+void PdfEngineImpl::SaveMetadataCache() {
+    if (!metadataCachePath) {
+        return;
+    }
+
+    Vec<RectD> mediaboxes;
+    {
+        ScopedCritSec scope(&mediaboxAccess);
+        for (FzPageInfo* pageInfo : _pages) {
+            if (pageInfo->mediaboxProvisional) {
+                return;
+            }
+            mediaboxes.Append(pageInfo->mediabox);
+        }
+    }
+
+    fz_buffer* buf = nullptr;
+    char* infoStr = nullptr;
+    std::string_view data;
+
+    fz_var(buf);
+    fz_var(infoStr);
+    fz_try(ctx) {
+        buf = fz_new_buffer(ctx, 4096);
+        fz_append_int32_le(ctx, buf, METADATA_CACHE_MAGIC);
+        fz_append_int32_le(ctx, buf, METADATA_CACHE_VERSION);
+        fz_append_data(ctx, buf, metadataDigest, sizeof(metadataDigest));
+        fz_append_int32_le(ctx, buf, pageCount);
+
+        for (RectD& mbox : mediaboxes) {
+            fz_append_float_le(ctx, buf, (float)mbox.x);
+            fz_append_float_le(ctx, buf, (float)mbox.y);
+            fz_append_float_le(ctx, buf, (float)mbox.dx);
+            fz_append_float_le(ctx, buf, (float)mbox.dy);
+        }
+
+        int labelCount = _pageLabels ? (int)_pageLabels->size() : 0;
+        fz_append_int32_le(ctx, buf, labelCount);
+        for (int i = 0; i < labelCount; i++) {
+            AutoFree label(strconv::WstrToUtf8(_pageLabels->at(i)));
+            fz_append_metadata_str(ctx, buf, label.Get());
+        }
+
+        fz_append_outline(ctx, buf, outline);
+        fz_append_outline(ctx, buf, attachments);
+        if (_info) {
+            int infoLen = 0;
+            infoStr = pdf_sprint_obj(ctx, nullptr, 0, &infoLen, _info, 1, 1);
+        }
+        fz_append_metadata_str(ctx, buf, infoStr);
+
+        unsigned char* bufData;
+        size_t bufLen = fz_buffer_storage(ctx, buf, &bufData);
+        unsigned char digest[16];
+        fz_md5 md5;
+        fz_md5_init(&md5);
+        fz_md5_update(&md5, bufData, bufLen);
+        fz_md5_final(&md5, digest);
+        fz_append_data(ctx, buf, digest, sizeof(digest));
+
+        bufLen = fz_buffer_storage(ctx, buf, &bufData);
+        data = {(const char*)bufData, bufLen};
+    }
+    fz_always(ctx) {
+        fz_free(ctx, infoStr);
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "Couldn't serialize metadata: %s", fz_caught_message(ctx));
+        fz_drop_buffer(ctx, buf);
+        return;
+    }
+
+    AutoFreeWstr cacheDir(path::GetDir(metadataCachePath));
+    if (dir::Create(cacheDir)) {
+        file::WriteFile(metadataCachePath, data);
+    }
+    fz_drop_buffer(ctx, buf);
+}
+
+// this does the job of pdf_bound_page but without doing pdf_load_page()
+// (pageObjNum is the page's object number, if already known)
+// Note: make sure to only call with ctxAccess
+RectD PdfEngineImpl::LoadPageMediabox(int pageIdx, int pageObjNum) {
+    pdf_document* doc = (pdf_document*)_doc;
+    fz_rect mbox = fz_empty_rect;
+    fz_matrix page_ctm;
+    pdf_obj* pageref = nullptr;
+
+    fz_var(pageref);
+    fz_try(ctx) {
+        if (pageObjNum > 0) {
+            pageref = pdf_load_object(ctx, doc, pageObjNum);
+        } else {
+            pageref = pdf_keep_obj(ctx, pdf_lookup_page_obj(ctx, doc, pageIdx));
+        }
+        pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+        mbox = fz_transform_rect(mbox, page_ctm);
+    }
+    fz_always(ctx) {
+        pdf_drop_obj(ctx, pageref);
+    }
+    fz_catch(ctx) {
+    }
+    if (fz_is_empty_rect(mbox)) {
+        fz_warn(ctx, "cannot find page size for page %d", pageIdx);
+        mbox.x0 = 0;
+        mbox.y0 = 0;
+        mbox.x1 = 612;
+        mbox.y1 = 792;
+    }
+    return fz_rect_to_RectD(mbox);
+}
+
+void PdfEngineImpl::SetPageMediabox(FzPageInfo* pageInfo, RectD mediabox) {
+    ScopedCritSec scope(&mediaboxAccess);
+    pageInfo->mediabox = mediabox;
+    pageInfo->mediaboxProvisional = false;
+}
+
+DWORD WINAPI PdfEngineImpl::MediaboxThread(LPVOID data) {
+    PdfEngineImpl* engine = (PdfEngineImpl*)data;
+    engine->LoadProvisionalMediaboxes();
+    return 0;
+}
+
+void PdfEngineImpl::LoadProvisionalMediaboxes() {
+    pdf_document* doc = (pdf_document*)_doc;
+
+    if (progressiveLoad) {
+        // the page tree, outline, etc. might depend on objects at the end of the file
+        while (!mediaboxThreadCancel && fz_progressive_stream_available(_docStream) >= 0) {
+            fz_progressive_stream_wait(_docStream, INT64_MAX, PROGRESSIVE_POLL_INTERVAL);
+        }
+        if (mediaboxThreadCancel) {
+            return;
+        }
+        ScopedCritSec scope(ctxAccess);
+        fz_try(ctx) {
+            // let MuPDF parse the remainder of the file
+            pdf_progressive_advance(ctx, doc, pageCount - 1);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't parse the whole linearized file");
+        }
+        LoadProperties();
+        // publishes the properties to other threads (which also means
+        // that hasPageLabels can't be set here, cf. HasPageLabels)
+        InterlockedExchange(&loadingProperties, 0);
+    }
+
+    // walking the page tree once is much faster than looking up every
+    // page individually, so first collect the object numbers of all pages
+    Vec<int> pageObjNums;
+    pageObjNums.AppendBlanks(pageCount);
+    {
+        ScopedCritSec scope(ctxAccess);
+        fz_try(ctx) {
+            pdf_load_page_tree(ctx, doc);
+            for (int i = 0; i < doc->rev_page_count; i++) {
+                int pageIdx = doc->rev_page_map[i].page;
+                if (pageIdx >= 0 && pageIdx < pageCount) {
+                    pageObjNums.at(pageIdx) = doc->rev_page_map[i].object;
+                }
+            }
+        }
+        fz_catch(ctx) {
+            // the page tree is broken, so fall back to pdf_lookup_page_obj
+            pdf_drop_page_tree(ctx, doc);
+            pageObjNums.Reset();
+            pageObjNums.AppendBlanks(pageCount);
+        }
+    }
+
+    // only hold ctxAccess for a few pages at a time so that rendering
+    // and page loading aren't blocked for too long
+    for (int i = 1; i < pageCount && !mediaboxThreadCancel; i += MEDIABOX_BATCH_SIZE) {
+        ScopedCritSec scope(ctxAccess);
+        int end = std::min(i + MEDIABOX_BATCH_SIZE, pageCount);
+        for (int pageIdx = i; pageIdx < end; pageIdx++) {
+            FzPageInfo* pageInfo = _pages[pageIdx];
+            bool isProvisional;
+            {
+                ScopedCritSec mediaboxScope(&mediaboxAccess);
+                isProvisional = pageInfo->mediaboxProvisional;
+            }
+            if (isProvisional) {
+                SetPageMediabox(pageInfo, LoadPageMediabox(pageIdx, pageObjNums.at(pageIdx)));
+            }
+        }
+    }
+
+    if (!mediaboxThreadCancel) {
+        ScopedCritSec scope(ctxAccess);
+        SaveMetadataCache();
+    }
+}
+
 static COLORREF pdfColorToCOLORREF(float color[4]) {
     return MkRgb(color[0], color[1], color[2]);
 }
@@ -975,6 +1624,10 @@ DocTocTree* PdfEngineImpl::GetTocTree() {
     if (tocTree) {
         return tocTree;
     }
+    // the UI asks again once the properties have been loaded (cf. IsLoadingProperties)
+    if (IsLoadingProperties()) {
+        return nullptr;
+    }
     if (outline == nullptr && attachments == nullptr) {
         return nullptr;
     }
@@ -1049,25 +1702,107 @@ PageDestination* PdfEngineImpl::GetNamedDest(const WCHAR* name) {
     return pageDest;
 }
 
-FzPageInfo* PdfEngineImpl::GetFzPageInfo(int pageNo, bool failIfBusy) {
-    GetFzPage(pageNo, failIfBusy);
-    return _pages[pageNo - 1];
+// Note: the returned data is only guaranteed to stay valid for as long
+// as the caller holds pagesAccess (as it might get evicted otherwise)
+FzPageInfo* PdfEngineImpl::GetFzPageInfo(int pageNo, bool failIfBusy, FzPageData need) {
+    ScopedCritSec scope(&pagesAccess);
+
+    FzPageInfo* pageInfo = _pages[pageNo - 1];
+    fz_page* page = GetFzPage(pageNo, failIfBusy);
+    if (!page || failIfBusy) {
+        return pageInfo;
+    }
+
+    bool loadText = need >= FzPageData::Text && !pageInfo->hasText;
+    bool loadElements = need >= FzPageData::Elements && !pageInfo->hasElements;
+    if (!loadText && !loadElements) {
+        return pageInfo;
+    }
+
+    ScopedCritSec ctxScope(ctxAccess);
+    LONG64 memBefore = FzMemTracker::AllocatedOnThread();
+    if (loadText) {
+        LoadPageText(pageInfo);
+    }
+    if (loadElements) {
+        LoadPageElements(pageInfo);
+    }
+    AddPageRunMem(pageInfo, memBefore);
+    EvictPageRuns(pageInfo);
+    return pageInfo;
+}
+
+// moves the page to the most recently used end of runCache
+// Note: make sure to only call with pagesAccess
+void PdfEngineImpl::TouchPageRun(FzPageInfo* pageInfo) {
+    int idx = runCache.Find(pageInfo);
+    if (idx == (int)runCache.size() - 1) {
+        return;
+    }
+    if (idx >= 0) {
+        runCache.RemoveAt(idx);
+    }
+    runCache.Append(pageInfo);
+}
+
+// all memory allocated on this thread since memBefore (while holding
+// ctxAccess) has been allocated for this page (render threads might
+// allocate at the same time, so the engine's total can't be used)
+// Note: make sure to only call with pagesAccess and ctxAccess
+void PdfEngineImpl::AddPageRunMem(FzPageInfo* pageInfo, LONG64 memBefore) {
+    LONG64 memAfter = FzMemTracker::AllocatedOnThread();
+    size_t memSize = memAfter > memBefore ? (size_t)(memAfter - memBefore) : 0;
+    pageInfo->memSize += memSize;
+    runCacheMem += memSize;
+}
+
+// frees the data of the least recently used pages until we're both
+// below MAX_PAGE_RUN_CACHE pages and below MAX_PAGE_RUN_MEMORY
+// Note: make sure to only call with pagesAccess
+void PdfEngineImpl::EvictPageRuns(FzPageInfo* keep) {
+    ScopedCritSec scope(ctxAccess);
+    size_t i = 0;
+    while (i < runCache.size() && (runCache.size() > MAX_PAGE_RUN_CACHE || runCacheMem > MAX_PAGE_RUN_MEMORY)) {
+        FzPageInfo* pageInfo = runCache.at(i);
+        if (pageInfo == keep) {
+            i++;
+            continue;
+        }
+        CrashIf(runCacheMem < pageInfo->memSize);
+        runCacheMem -= pageInfo->memSize;
+        FzPageInfoDropData(ctx, pageInfo);
+        runCache.RemoveAt(i);
+    }
 }
 
+// loads the page and its display list, which is all that's needed for rendering
+// (text and page elements are only loaded on demand through GetFzPageInfo)
+// Note: the returned page is only guaranteed to stay valid for as long
+// as the caller holds pagesAccess (as it might get evicted otherwise)
 fz_page* PdfEngineImpl::GetFzPage(int pageNo, bool failIfBusy) {
     ScopedCritSec scope(&pagesAccess);
 
     CrashIf(pageNo < 1 || pageNo > pageCount);
-    int pageIdx = pageNo - 1;
     FzPageInfo* pageInfo = _pages[pageNo - 1];
     CrashIf(pageInfo->pageNo != pageNo);
     fz_page* page = pageInfo->page;
+    if (page) {
+        TouchPageRun(pageInfo);
+        return page;
+    }
     // TODO: not sure what failIfBusy is supposed to do
-    if (page || failIfBusy) {
+    if (failIfBusy) {
         return page;
     }
+    // don't try to load pages of progressively loaded documents too early
+    // (as they'd be missing content which isn't available yet)
+    if (!IsPageDataAvailable(pageNo)) {
+        return nullptr;
+    }
 
     ScopedCritSec ctxScope(ctxAccess);
+    LONG64 memBefore = FzMemTracker::AllocatedOnThread();
+    Timer t;
     fz_var(page);
     fz_try(ctx) {
         page = fz_load_page(ctx, _doc, pageNo - 1);
@@ -1076,11 +1811,9 @@ fz_page* PdfEngineImpl::GetFzPage(int pageNo, bool failIfBusy) {
     fz_catch(ctx) {
     }
 
-    /* TODO: handle try later?
-    if (fz_caught(ctx) != FZ_ERROR_TRYLATER) {
+    if (!page) {
         return nullptr;
     }
-    */
 
     fz_display_list* list = NULL;
     fz_var(list);
@@ -1092,34 +1825,100 @@ fz_page* PdfEngineImpl::GetFzPage(int pageNo, bool failIfBusy) {
     }
 
     pageInfo->list = list;
+    RenderStatsTime(RenderStage::Load, t.GetTimeInMs());
 
+    AddPageRunMem(pageInfo, memBefore);
+    TouchPageRun(pageInfo);
+    EvictPageRuns(pageInfo);
+    return page;
+}
+
+// extracts the page's text and the positions of its images
+// Note: make sure to only call with pagesAccess and ctxAccess
+void PdfEngineImpl::LoadPageText(FzPageInfo* pageInfo) {
     fz_stext_options opts{};
     opts.flags = FZ_STEXT_PRESERVE_IMAGES;
 
     fz_try(ctx) {
-        pageInfo->stext = fz_new_stext_page_from_page(ctx, page, &opts);
+        pageInfo->stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
     }
     fz_catch(ctx) {
         pageInfo->stext = nullptr;
     }
+    fz_find_images(pageInfo->stext, pageInfo->images);
+    pageInfo->hasText = true;
+}
+
+// loads the page's links (both explicit and auto-detected ones) and comments
+// Note: make sure to only call with pagesAccess and ctxAccess
+void PdfEngineImpl::LoadPageElements(FzPageInfo* pageInfo) {
+    CrashIf(!pageInfo->hasText);
 
-    auto* links = fz_load_links(ctx, page);
+    fz_link* links = nullptr;
+    fz_var(links);
+    fz_try(ctx) {
+        links = fz_load_links(ctx, pageInfo->page);
+    }
+    fz_catch(ctx) {
+        links = nullptr;
+    }
     pageInfo->links = FixupPageLinks(links);
     FzLinkifyPageText(pageInfo);
 
     MakePageElementCommentsFromAnnotations(pageInfo);
-
-    fz_find_images(pageInfo->stext, pageInfo->images);
-    return page;
+    pageInfo->hasElements = true;
 }
 
 RectD PdfEngineImpl::PageMediabox(int pageNo) {
+    bool isProvisional;
+    RectD mediabox = PageMediaboxNoWait(pageNo, &isProvisional);
+    // the page tree isn't available before the whole file has been read
+    if (!isProvisional || !IsPageDataAvailable(pageNo)) {
+        return mediabox;
+    }
+    // determine the actual size right away instead of waiting for MediaboxThread
+    {
+        ScopedCritSec scope(ctxAccess);
+        mediabox = LoadPageMediabox(pageNo - 1);
+    }
+    SetPageMediabox(_pages[pageNo - 1], mediabox);
+    return mediabox;
+}
+
+// for progressively loaded documents, only the first page can be loaded
+// before the whole file has been read
+bool PdfEngineImpl::IsPageDataAvailable(int pageNo) {
+    if (!progressiveLoad) {
+        return true;
+    }
+    i64 available = fz_progressive_stream_available(_docStream);
+    if (available < 0) {
+        return true;
+    }
+    return pageNo == 1 && available >= firstPageDataEnd;
+}
+
+// Note: don't call this while holding pagesAccess or ctxAccess
+void PdfEngineImpl::WaitForPageData(int pageNo) {
+    i64 needed = 1 == pageNo ? firstPageDataEnd : INT64_MAX;
+    while (!IsPageDataAvailable(pageNo)) {
+        fz_progressive_stream_wait(_docStream, needed, INFINITE);
+    }
+}
+
+RectD PdfEngineImpl::PageMediaboxNoWait(int pageNo, bool* isProvisional) {
     FzPageInfo* pi = _pages[pageNo - 1];
+    ScopedCritSec scope(&mediaboxAccess);
+    *isProvisional = pi->mediaboxProvisional;
     return pi->mediabox;
 }
 
 RectD PdfEngineImpl::PageContentBox(int pageNo, RenderTarget target) {
+    ScopedCritSec pagesScope(&pagesAccess);
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
+    if (!pageInfo->list) {
+        return PageMediabox(pageNo);
+    }
 
     ScopedCritSec scope(ctxAccess);
 
@@ -1131,7 +1930,7 @@ RectD PdfEngineImpl::PageContentBox(int pageNo, RenderTarget target) {
 
     fz_var(dev);
 
-    RectD mediabox = pageInfo->mediabox;
+    RectD mediabox = PageMediabox(pageNo);
 
     fz_try(ctx) {
         dev = fz_new_bbox_device(ctx, &rect);
@@ -1173,11 +1972,29 @@ RectD PdfEngineImpl::Transform(RectD rect, int pageNo, float zoom, int rotation,
 
 RenderedBitmap* PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD* pageRect, RenderTarget target,
                                             AbortCookie** cookie_out) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
-    fz_page* page = pageInfo->page;
-
-    if (!page || !pageInfo->list) {
-        return nullptr;
+    fz_display_list* list = nullptr;
+    fz_rect pRect;
+    fz_matrix ctm;
+    WaitForPageData(pageNo);
+    {
+        ScopedCritSec scope(&pagesAccess);
+        FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
+        fz_page* page = pageInfo->page;
+        if (!page || !pageInfo->list) {
+            return nullptr;
+        }
+        // ctx is shared with e.g. MediaboxThread, so it may only be used under ctxAccess
+        ScopedCritSec ctxScope(ctxAccess);
+        // keep the display list alive even if the page's data
+        // is evicted from the run cache while we're rendering
+        list = fz_keep_display_list(ctx, pageInfo->list);
+        if (pageRect) {
+            pRect = fz_RectD_to_rect(*pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(ctx, page);
+        }
+        ctm = viewctm(page, zoom, rotation);
     }
 
     fz_cookie* fzcookie = nullptr;
@@ -1188,63 +2005,80 @@ RenderedBitmap* PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         fzcookie = &cookie->cookie;
     }
 
-    // TODO(port): I don't see why this lock is needed
-    ScopedCritSec cs(ctxAccess);
-
-    fz_rect pRect;
-    if (pageRect) {
-        pRect = fz_RectD_to_rect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+    // display lists are immutable, so they can be rendered on several threads at
+    // once as long as every thread uses its own clone of ctx (only fall back to
+    // rendering under ctxAccess if cloning fails or all clones are in use)
+    fz_context* rctx = renderCtxs.Acquire();
+    CRITICAL_SECTION* cs = nullptr;
+    if (!rctx) {
+        rctx = ctx;
+        cs = ctxAccess;
+        EnterCriticalSection(cs);
     }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
-    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
-    fz_rect cliprect = fz_rect_from_irect(bbox);
+    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
     fz_pixmap* pix = nullptr;
-    fz_device* dev = NULL;
     RenderedBitmap* bitmap = nullptr;
 
-    fz_var(dev);
     fz_var(pix);
     fz_var(bitmap);
 
-    fz_try(ctx) {
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
+    fz_try(rctx) {
+        // render directly into the bitmap's memory
+        bitmap = new_rendered_fz_pixmap_target(rctx, bbox, &pix);
+        if (!pix) {
+            fz_throw(rctx, FZ_ERROR_GENERIC, "failed to create a %dx%d bitmap", bbox.x1 - bbox.x0, bbox.y1 - bbox.y0);
+        }
         // initialize with white background
-        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        fz_clear_pixmap_with_value(rctx, pix, 0xff);
 
         // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
         // or "Print". "Export" is not used
-        dev = fz_new_draw_device(ctx, fz_identity, pix);
-        // TODO: use fz_infinite_rect instead of cliprect?
-        fz_run_display_list(ctx, pageInfo->list, dev, ctm, cliprect, fzcookie);
-        bitmap = new_rendered_fz_pixmap(ctx, pix);
-    }
-    fz_always(ctx) {
-        if (dev) {
-            fz_close_device(ctx, dev);
-            fz_drop_device(ctx, dev);
-        }
-        fz_drop_pixmap(ctx, pix);
-    }
-    fz_catch(ctx) {
-        return nullptr;
+        // large pages are split into bands which are rendered on several threads
+        // (unless we're rendering under ctxAccess)
+        Timer t;
+        fz_run_display_list_banded(rctx, cs ? nullptr : &renderCtxs, list, ctm, pix, fzcookie);
+        RenderStatsTime(RenderStage::Run, t.GetTimeInMs());
+        t.Start();
+        bitmap = compact_rendered_fz_pixmap(pix, bitmap);
+        RenderStatsTime(RenderStage::Convert, t.GetTimeInMs());
+    }
+    fz_always(rctx) {
+        fz_drop_pixmap(rctx, pix);
+        fz_drop_display_list(rctx, list);
+    }
+    fz_catch(rctx) {
+        delete bitmap;
+        bitmap = nullptr;
+    }
+
+    if (cs) {
+        LeaveCriticalSection(cs);
+    } else {
+        renderCtxs.Release(rctx);
     }
     return bitmap;
 }
 
 PageElement* PdfEngineImpl::GetElementAtPos(int pageNo, PointD pt) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
+    ScopedCritSec scope(&pagesAccess);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, FzPageData::Elements);
     return FzGetElementAtPos(pageInfo, pt);
 }
 
 Vec<PageElement*>* PdfEngineImpl::GetElements(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    auto* pageInfo = GetFzPageInfo(pageNo, false, FzPageData::Elements);
+    return FzGetElements(pageInfo);
+}
+
+Vec<PageElement*>* PdfEngineImpl::GetElementsNoWait(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
     auto* pageInfo = GetFzPageInfo(pageNo, true);
+    if (!pageInfo->hasElements) {
+        return nullptr;
+    }
     return FzGetElements(pageInfo);
 }
 
@@ -1338,7 +2172,8 @@ void PdfEngineImpl::MakePageElementCommentsFromAnnotations(FzPageInfo* pageInfo)
 }
 
 RenderedBitmap* PdfEngineImpl::GetPageImage(int pageNo, RectD rect, size_t imageIdx) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
+    ScopedCritSec pagesScope(&pagesAccess);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, FzPageData::Text);
     if (!pageInfo->page) {
         return nullptr;
     }
@@ -1375,9 +2210,10 @@ RenderedBitmap* PdfEngineImpl::GetPageImage(int pageNo, RectD rect, size_t image
     return bmp;
 }
 
-// TODO: remember this instead of re-doing
 WCHAR* PdfEngineImpl::ExtractPageText(int pageNo, RectI** coordsOut) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
+    WaitForPageData(pageNo);
+    ScopedCritSec pagesScope(&pagesAccess);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, FzPageData::Text);
     fz_stext_page* stext = pageInfo->stext;
     if (!stext) {
         return nullptr;
@@ -1461,6 +2297,7 @@ WCHAR* PdfEngineImpl::ExtractFontList() {
 
     // collect all fonts from all page objects
     for (int i = 1; i <= PageCount(); i++) {
+        ScopedCritSec pagesScope(&pagesAccess);
         fz_page* fzpage = GetFzPage(i);
         if (!fzpage) {
             continue;
@@ -1596,6 +2433,11 @@ WCHAR* PdfEngineImpl::GetProperty(DocumentProperty prop) {
         return str::Format(L"%d.%d", major, minor);
     }
 
+    // _info is only available once MediaboxThread has loaded it
+    if (IsLoadingProperties()) {
+        return nullptr;
+    }
+
     if (DocumentProperty::PdfFileStructure == prop) {
         WStrVec fstruct;
         if (pdf_to_bool(ctx, pdf_dict_gets(ctx, _info, "Linearized")))
@@ -1650,12 +2492,18 @@ bool PdfEngineImpl::SupportsAnnotation(bool forSaving) const {
         return true;
     }
     // TODO: support updating of documents where pages aren't all numbered objects?
-    size_t n = _pages.size();
-    for (size_t i = 0; i < n; i++) {
-        auto* pageInfo = _pages[i];
-        fz_page* fzpage = pageInfo->page;
-        pdf_page* page = pdf_page_from_fz_page(ctx, fzpage);
-        if (!page || pdf_to_num(ctx, page->obj) == 0) {
+    // look at the page objects directly as the pages' data might not be loaded
+    ScopedCritSec scope(ctxAccess);
+    pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+    for (int i = 0; i < pageCount; i++) {
+        pdf_obj* pageObj = nullptr;
+        fz_try(ctx) {
+            pageObj = pdf_lookup_page_obj(ctx, doc, i);
+        }
+        fz_catch(ctx) {
+            pageObj = nullptr;
+        }
+        if (!pageObj || pdf_to_num(ctx, pageObj) == 0) {
             return false;
         }
     }
@@ -1678,6 +2526,11 @@ std::string_view PdfEngineImpl::GetFileData() {
     pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
     size_t size = 0;
 
+    std::string_view mapped = fz_stream_mapped_data(doc->file);
+    if (!mapped.empty()) {
+        return {(char*)memdup(mapped.data(), mapped.size()), mapped.size()};
+    }
+
     fz_var(res);
     fz_try(ctx) {
         res = fz_extract_stream_data(ctx, doc->file, &size);
@@ -1698,9 +2551,15 @@ std::string_view PdfEngineImpl::GetFileData() {
 
 bool PdfEngineImpl::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
     AutoFreeWstr dstPath = strconv::FromUtf8(copyFileName);
-    AutoFree d = GetFileData();
-    if (!d.empty()) {
-        bool ok = file::WriteFile(dstPath, d.as_view());
+    // larger files are memory mapped and can be written out without copying them first
+    std::string_view data = fz_stream_mapped_data(_docStream);
+    AutoFree d;
+    if (data.empty()) {
+        d = GetFileData();
+        data = d.as_view();
+    }
+    if (!data.empty()) {
+        bool ok = file::WriteFile(dstPath, data);
         if (ok) {
             return !includeUserAnnots || SaveUserAnnots(copyFileName);
         }
@@ -1919,6 +2778,7 @@ bool PdfEngineImpl::SaveEmbedded(LinkSaverUI& saveUI, int num) {
 #endif
 
 bool PdfEngineImpl::HasClipOptimizations(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo) {
         return false;
@@ -1935,8 +2795,16 @@ bool PdfEngineImpl::HasClipOptimizations(int pageNo) {
     return true;
 }
 
+bool PdfEngineImpl::IsLoadingProperties() const {
+    return InterlockedCompareExchange((LONG*)&loadingProperties, 0, 0) != 0;
+}
+
+bool PdfEngineImpl::HasPageLabels() const {
+    return !IsLoadingProperties() && _pageLabels != nullptr;
+}
+
 WCHAR* PdfEngineImpl::GetPageLabel(int pageNo) const {
-    if (!_pageLabels || pageNo < 1 || PageCount() < pageNo) {
+    if (IsLoadingProperties() || !_pageLabels || pageNo < 1 || PageCount() < pageNo) {
         return EngineBase::GetPageLabel(pageNo);
     }
 
@@ -1945,7 +2813,7 @@ WCHAR* PdfEngineImpl::GetPageLabel(int pageNo) const {
 
 int PdfEngineImpl::GetPageByLabel(const WCHAR* label) const {
     int pageNo = 0;
-    if (_pageLabels) {
+    if (!IsLoadingProperties() && _pageLabels) {
         pageNo = _pageLabels->Find(label) + 1;
     }
 
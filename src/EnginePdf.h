@@ -4,3 +4,6 @@
 bool IsEnginePdfSupportedFile(const WCHAR* fileName, bool sniff = false);
 EngineBase* CreateEnginePdfFromFile(const WCHAR* fileName, PasswordUI* pwdUI = nullptr);
 EngineBase* CreateEnginePdfFromStream(IStream* stream, PasswordUI* pwdUI = nullptr);
+// enables caching of the metadata (page sizes, outline, etc.) of larger
+// documents in dir (nullptr disables caching)
+void SetEnginePdfMetadataCacheDir(const WCHAR* dir);
@@ -100,6 +100,7 @@ class EnginePdfMultiImpl : public EngineBase {
     bool BenchLoadPage(int pageNo) override;
 
     Vec<PageElement*>* GetElements(int pageNo) override;
+    Vec<PageElement*>* GetElementsNoWait(int pageNo) override;
     PageElement* GetElementAtPos(int pageNo, PointD pt) override;
 
     PageDestination* GetNamedDest(const WCHAR* name) override;
@@ -215,6 +216,11 @@ Vec<PageElement*>* EnginePdfMultiImpl::GetElements(int pageNo) {
     return e->GetElements(pageNo);
 }
 
+Vec<PageElement*>* EnginePdfMultiImpl::GetElementsNoWait(int pageNo) {
+    auto e = findEngineForPage(vbkm, pageNo);
+    return e->GetElementsNoWait(pageNo);
+}
+
 PageElement* EnginePdfMultiImpl::GetElementAtPos(int pageNo, PointD pt) {
     auto e = findEngineForPage(vbkm, pageNo);
     return e->GetElementAtPos(pageNo, pt);
@@ -227,8 +227,7 @@ class PsEngineImpl : public EngineBase {
         if (!newEngine)
             return nullptr;
         PsEngineImpl* clone = new PsEngineImpl();
-        if (FileName())
-            clone->SetFileName(FileName());
+        clone->CopyFileName(this);
         clone->pdfEngine = newEngine;
         return clone;
     }
@@ -237,6 +236,14 @@ class PsEngineImpl : public EngineBase {
         return pdfEngine->PageMediabox(pageNo);
     }
 
+    RectD PageMediaboxNoWait(int pageNo, bool* isProvisional) override {
+        return pdfEngine->PageMediaboxNoWait(pageNo, isProvisional);
+    }
+
+    bool IsPageDataAvailable(int pageNo) override {
+        return pdfEngine->IsPageDataAvailable(pageNo);
+    }
+
     RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override {
         return pdfEngine->PageContentBox(pageNo, target);
     }
@@ -280,6 +287,9 @@ class PsEngineImpl : public EngineBase {
     bool HasClipOptimizations(int pageNo) override {
         return pdfEngine->HasClipOptimizations(pageNo);
     }
+    bool HasParallelRendering() override {
+        return pdfEngine->HasParallelRendering();
+    }
 
     WCHAR* GetProperty(DocumentProperty prop) override {
         // omit properties created by Ghostscript
@@ -307,6 +317,10 @@ class PsEngineImpl : public EngineBase {
         return pdfEngine->GetElements(pageNo);
     }
 
+    Vec<PageElement*>* GetElementsNoWait(int pageNo) override {
+        return pdfEngine->GetElementsNoWait(pageNo);
+    }
+
     PageElement* GetElementAtPos(int pageNo, PointD pt) override {
         return pdfEngine->GetElementAtPos(pageNo, pt);
     }
@@ -16,6 +16,7 @@ extern "C" {
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
 #include "utils/Log.h"
@@ -208,6 +209,10 @@ class XpsEngineImpl : public EngineBase {
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
     WCHAR* ExtractPageText(int pageNo, RectI** coordsOut = nullptr) override;
     bool HasClipOptimizations(int pageNo) override;
+    // concurrent renderings use separate contexts from renderCtxs
+    bool HasParallelRendering() override {
+        return true;
+    }
     WCHAR* GetProperty(DocumentProperty prop) override;
 
     bool SupportsAnnotation(bool forSaving = false) const override;
@@ -220,6 +225,7 @@ class XpsEngineImpl : public EngineBase {
     }
 
     Vec<PageElement*>* GetElements(int pageNo) override;
+    Vec<PageElement*>* GetElementsNoWait(int pageNo) override;
     PageElement* GetElementAtPos(int pageNo, PointD pt) override;
 
     PageDestination* GetNamedDest(const WCHAR* name) override;
@@ -233,10 +239,14 @@ class XpsEngineImpl : public EngineBase {
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    // what ctxAccess points to (never one of MuPDF's mutexes, cf. PdfEngineImpl::docAccess)
+    CRITICAL_SECTION docAccess;
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
     fz_context* ctx = nullptr;
     fz_locks_context fz_locks_ctx;
+    // contexts for rendering outside of ctxAccess
+    FzCtxPool renderCtxs;
     fz_document* _doc = nullptr;
     fz_stream* _docStream = nullptr;
     Vec<FzPageInfo*> _pages;
@@ -254,7 +264,7 @@ class XpsEngineImpl : public EngineBase {
     // bool Load(fz_stream* stm);
     bool LoadFromStream(fz_stream* stm);
 
-    FzPageInfo* GetFzPageInfo(int pageNo, bool failIfBusy = false);
+    FzPageInfo* GetFzPageInfo(int pageNo, bool failIfBusy = false, FzPageData need = FzPageData::Render);
     fz_page* GetFzPage(int pageNo, bool failIfBusy = false);
     int GetPageNo(fz_page* page);
     fz_matrix viewctm(int pageNo, float zoom, int rotation) {
@@ -299,13 +309,15 @@ XpsEngineImpl::XpsEngineImpl() {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    InitializeCriticalSection(&docAccess);
+    ctxAccess = &docAccess;
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
     ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_UNLIMITED);
     installFitzErrorCallbacks(ctx);
+    renderCtxs.Init(ctx, ctxAccess);
 }
 
 XpsEngineImpl::~XpsEngineImpl() {
@@ -313,18 +325,7 @@ XpsEngineImpl::~XpsEngineImpl() {
     EnterCriticalSection(ctxAccess);
 
     for (auto* pi : _pages) {
-        if (pi->links) {
-            fz_drop_link(ctx, pi->links);
-        }
-        if (pi->stext) {
-            fz_drop_stext_page(ctx, pi->stext);
-        }
-        if (pi->list) {
-            fz_drop_display_list(ctx, pi->list);
-        }
-        if (pi->page) {
-            fz_drop_page(ctx, pi->page);
-        }
+        FzPageInfoDropData(ctx, pi);
     }
 
     DeleteVecMembers(_pages);
@@ -340,19 +341,19 @@ XpsEngineImpl::~XpsEngineImpl() {
     }
 
     fz_drop_document(ctx, _doc);
+    renderCtxs.DropAll();
     fz_drop_context(ctx);
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
         DeleteCriticalSection(&mutexes[i]);
     }
+    LeaveCriticalSection(ctxAccess);
+    DeleteCriticalSection(&docAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
 
 EngineBase* XpsEngineImpl::Clone() {
-    ScopedCritSec scope(ctxAccess);
-
     // TODO: we used to support cloning streams
     // but mupdf removed ability to clone fz_stream
     const WCHAR* path = FileName();
@@ -360,6 +361,7 @@ EngineBase* XpsEngineImpl::Clone() {
         return false;
     }
 
+    // the clone is loaded without ctxAccess (cf. PdfEngineImpl::Clone)
     XpsEngineImpl* clone = new XpsEngineImpl();
     bool ok = clone->Load(FileName());
     if (!ok) {
@@ -367,6 +369,7 @@ EngineBase* XpsEngineImpl::Clone() {
         return nullptr;
     }
 
+    ScopedCritSec scope(ctxAccess);
     clone->UpdateUserAnnotations(&userAnnots);
 
     return clone;
@@ -470,9 +473,42 @@ bool XpsEngineImpl::LoadFromStream(fz_stream* stm) {
     return true;
 }
 
-FzPageInfo* XpsEngineImpl::GetFzPageInfo(int pageNo, bool failIfBusy) {
+FzPageInfo* XpsEngineImpl::GetFzPageInfo(int pageNo, bool failIfBusy, FzPageData need) {
+    ScopedCritSec scope(&pagesAccess);
+
+    FzPageInfo* pageInfo = _pages[pageNo - 1];
     GetFzPage(pageNo, failIfBusy);
-    return _pages[pageNo - 1];
+    if (!pageInfo->list || failIfBusy) {
+        return pageInfo;
+    }
+
+    bool loadText = need >= FzPageData::Text && !pageInfo->hasText;
+    bool loadElements = need >= FzPageData::Elements && !pageInfo->hasElements;
+    if (!loadText && !loadElements) {
+        return pageInfo;
+    }
+
+    ScopedCritSec ctxScope(ctxAccess);
+    if (loadText) {
+        fz_try(ctx) {
+            pageInfo->stext = fz_new_stext_page_from_page(ctx, pageInfo->page, nullptr);
+        }
+        fz_catch(ctx) {
+            pageInfo->stext = nullptr;
+        }
+        pageInfo->hasText = true;
+    }
+    if (loadElements) {
+        fz_try(ctx) {
+            pageInfo->links = fz_load_links(ctx, pageInfo->page);
+        }
+        fz_catch(ctx) {
+            pageInfo->links = nullptr;
+        }
+        FzLinkifyPageText(pageInfo);
+        pageInfo->hasElements = true;
+    }
+    return pageInfo;
 }
 
 fz_page* XpsEngineImpl::GetFzPage(int pageNo, bool failIfBusy) {
@@ -502,6 +538,7 @@ fz_page* XpsEngineImpl::GetFzPage(int pageNo, bool failIfBusy) {
     fz_page* page = pageInfo->page;
     fz_rect bounds;
     fz_display_list* list = NULL;
+    Timer t;
     fz_device* dev = NULL;
     fz_cookie cookie = {0};
     fz_var(list);
@@ -534,16 +571,7 @@ fz_page* XpsEngineImpl::GetFzPage(int pageNo, bool failIfBusy) {
         return page;
     }
     pageInfo->list = list;
-
-    fz_try(ctx) {
-        pageInfo->stext = fz_new_stext_page_from_page(ctx, page, nullptr);
-    }
-    fz_catch(ctx) {
-        pageInfo->stext = nullptr;
-    }
-
-    pageInfo->links = fz_load_links(ctx, page);
-    FzLinkifyPageText(pageInfo);
+    RenderStatsTime(RenderStage::Load, t.GetTimeInMs());
 
     return page;
 }
@@ -622,7 +650,7 @@ RenderedBitmap* XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
     fz_page* page = pageInfo->page;
 
-    if (!page) {
+    if (!page || !pageInfo->list) {
         return nullptr;
     }
 
@@ -634,48 +662,66 @@ RenderedBitmap* XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         fzcookie = &cookie->cookie;
     }
 
-    // TODO(port): I don't see why this lock is needed
-    EnterCriticalSection(ctxAccess);
+    // display lists are immutable, so they can be rendered on several threads at
+    // once as long as every thread uses its own clone of ctx (only fall back to
+    // rendering under ctxAccess if cloning fails or all clones are in use)
+    fz_context* rctx = renderCtxs.Acquire();
+    CRITICAL_SECTION* cs = nullptr;
+    if (!rctx) {
+        rctx = ctx;
+        cs = ctxAccess;
+        EnterCriticalSection(cs);
+    }
 
     fz_rect pRect;
     if (pageRect) {
         pRect = fz_RectD_to_rect(*pageRect);
     } else {
         // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+        pRect = fz_bound_page(rctx, page);
     }
     fz_matrix ctm = viewctm(page, zoom, rotation);
     fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
-    fz_rect cliprect = fz_rect_from_irect(bbox);
+    fz_pixmap* pix = nullptr;
+    RenderedBitmap* bitmap = nullptr;
 
-    fz_pixmap* pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
-    // initialize white background
-    fz_clear_pixmap_with_value(ctx, pix, 0xff);
+    fz_var(pix);
+    fz_var(bitmap);
+
+    fz_try(rctx) {
+        // render directly into the bitmap's memory
+        bitmap = new_rendered_fz_pixmap_target(rctx, bbox, &pix);
+        if (!pix) {
+            fz_throw(rctx, FZ_ERROR_GENERIC, "failed to create a %dx%d bitmap", bbox.x1 - bbox.x0, bbox.y1 - bbox.y0);
+        }
+        // initialize white background
+        fz_clear_pixmap_with_value(rctx, pix, 0xff);
 
-    fz_device* dev = NULL;
-    fz_var(dev);
-    fz_try(ctx) {
         // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
         // or "Print". "Export" is not used
-        dev = fz_new_draw_device(ctx, fz_identity, pix);
-        // TODO: use fz_infinite_rect instead of cliprect?
-        fz_run_display_list(ctx, pageInfo->list, dev, ctm, cliprect, fzcookie);
-        fz_close_device(ctx, dev);
+        // large pages are split into bands which are rendered on several threads
+        // (unless we're rendering under ctxAccess)
+        Timer t;
+        fz_run_display_list_banded(rctx, cs ? nullptr : &renderCtxs, pageInfo->list, ctm, pix, fzcookie);
+        RenderStatsTime(RenderStage::Run, t.GetTimeInMs());
+        t.Start();
+        bitmap = compact_rendered_fz_pixmap(pix, bitmap);
+        RenderStatsTime(RenderStage::Convert, t.GetTimeInMs());
     }
-    fz_always(ctx) {
-        fz_drop_device(ctx, dev);
-        LeaveCriticalSection(ctxAccess);
+    fz_always(rctx) {
+        fz_drop_pixmap(rctx, pix);
     }
-    fz_catch(ctx) {
-        fz_drop_pixmap(ctx, pix);
-        return nullptr;
+    fz_catch(rctx) {
+        delete bitmap;
+        bitmap = nullptr;
     }
 
-    RenderedBitmap* bitmap = new_rendered_fz_pixmap(ctx, pix);
-    fz_drop_pixmap(ctx, pix);
+    if (cs) {
+        LeaveCriticalSection(cs);
+    } else {
+        renderCtxs.Release(rctx);
+    }
     return bitmap;
 }
 
@@ -684,6 +730,11 @@ std::string_view XpsEngineImpl::GetFileData() {
     ScopedCritSec scope(ctxAccess);
     size_t cbCount;
 
+    std::string_view mapped = fz_stream_mapped_data(_docStream);
+    if (!mapped.empty()) {
+        return {(char*)memdup(mapped.data(), mapped.size()), mapped.size()};
+    }
+
     fz_var(res);
     fz_try(ctx) {
         res = fz_extract_stream_data(ctx, _docStream, &cbCount);
@@ -705,9 +756,15 @@ std::string_view XpsEngineImpl::GetFileData() {
 bool XpsEngineImpl::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
     UNUSED(includeUserAnnots);
     AutoFreeWstr dstPath = strconv::FromUtf8(copyFileName);
-    AutoFree d = GetFileData();
-    if (!d.empty()) {
-        bool ok = file::WriteFile(dstPath, d.as_view());
+    // larger files are memory mapped and can be written out without copying them first
+    std::string_view data = fz_stream_mapped_data(_docStream);
+    AutoFree d;
+    if (data.empty()) {
+        d = GetFileData();
+        data = d.as_view();
+    }
+    if (!data.empty()) {
+        bool ok = file::WriteFile(dstPath, data);
         if (ok) {
             return true;
         }
@@ -783,16 +840,24 @@ void XpsEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation>* list) {
 }
 
 PageElement* XpsEngineImpl::GetElementAtPos(int pageNo, PointD pt) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, FzPageData::Elements);
     return FzGetElementAtPos(pageInfo, pt);
 }
 
 Vec<PageElement*>* XpsEngineImpl::GetElements(int pageNo) {
-    fz_page* page = GetFzPage(pageNo, true);
-    if (!page) {
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, FzPageData::Elements);
+    if (!pageInfo->page) {
+        return nullptr;
+    }
+    return FzGetElements(pageInfo);
+}
+
+Vec<PageElement*>* XpsEngineImpl::GetElementsNoWait(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+    if (!pageInfo->page || !pageInfo->hasElements) {
         return nullptr;
     }
-    FzPageInfo* pageInfo = _pages[pageNo - 1];
     return FzGetElements(pageInfo);
 }
 
@@ -804,7 +869,7 @@ RenderedBitmap* XpsEngineImpl::GetImageForPageElement(PageElement* pel) {
 }
 
 WCHAR* XpsEngineImpl::ExtractPageText(int pageNo, RectI** coordsOut) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, FzPageData::Text);
     fz_stext_page* stext = pageInfo->stext;
     if (!stext) {
         return nullptr;
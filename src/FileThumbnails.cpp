@@ -14,9 +14,16 @@
 #include "FileHistory.h"
 
 #include "AppTools.h"
+#include "EnginePdf.h"
+#include "TextSelection.h"
+#include "TextIndex.h"
 #include "FileThumbnails.h"
 
 #define THUMBNAILS_DIR_NAME L"sumatrapdfcache"
+// cf. METADATA_CACHE_EXT in EnginePdf.cpp
+#define METADATA_CACHE_PATTERN L"*.pdfmeta"
+// cf. TEXT_INDEX_CACHE_EXT in TextIndex.cpp
+#define TEXT_INDEX_CACHE_PATTERN L"*.textindex"
 
 // TODO: create in TEMP directory instead?
 static WCHAR* GetThumbnailPath(const WCHAR* filePath) {
@@ -48,6 +55,43 @@ static WCHAR* GetThumbnailPath(const WCHAR* filePath) {
     return str::Format(L"%s\\%s.png", thumbsPath.Get(), fname.Get());
 }
 
+struct CachedFileInfo {
+    WCHAR* name;
+    FILETIME modified;
+};
+
+static int CmpCachedFileInfoNewestFirst(const void* a, const void* b) {
+    return CompareFileTime(&((CachedFileInfo*)b)->modified, &((CachedFileInfo*)a)->modified);
+}
+
+// cached metadata and text indexes are named after the document's content (or
+// its path and modification time), so only keep as many of the most recently
+// cached files as there are frequently used documents
+static void CleanUpMetadataCache(const WCHAR* cachePath, const WCHAR* filePattern, size_t maxFiles) {
+    AutoFreeWstr pattern(path::Join(cachePath, filePattern));
+
+    Vec<CachedFileInfo> files;
+    WIN32_FIND_DATA fdata;
+
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            files.Append({str::Dup(fdata.cFileName), fdata.ftLastWriteTime});
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    files.Sort(CmpCachedFileInfoNewestFirst);
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i >= maxFiles) {
+            AutoFreeWstr filePath(path::Join(cachePath, files.at(i).name));
+            file::Delete(filePath);
+        }
+        free(files.at(i).name);
+    }
+}
+
 // removes thumbnails that don't belong to any frequently used item in file history
 void CleanUpThumbnailCache(const FileHistory& fileHistory) {
     AutoFreeWstr thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
@@ -84,6 +128,25 @@ void CleanUpThumbnailCache(const FileHistory& fileHistory) {
         AutoFreeWstr bmpPath(path::Join(thumbsPath, files.at(i)));
         file::Delete(bmpPath);
     }
+
+    size_t maxCached = std::min(list.size(), (size_t)FILE_HISTORY_MAX_FREQUENT * 2);
+    CleanUpMetadataCache(thumbsPath, METADATA_CACHE_PATTERN, maxCached);
+    CleanUpMetadataCache(thumbsPath, TEXT_INDEX_CACHE_PATTERN, maxCached);
+}
+
+// lets the PDF engine cache the metadata of larger documents (and TextIndex the
+// text indexes of slowly indexed documents) next to the thumbnails
+void EnableMetadataCache(bool enable) {
+    AutoFreeWstr cachePath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!cachePath) {
+        enable = false;
+    }
+    SetEnginePdfMetadataCacheDir(enable ? cachePath.Get() : nullptr);
+    SetTextIndexCacheDir(enable ? cachePath.Get() : nullptr);
+    if (!enable && cachePath) {
+        CleanUpMetadataCache(cachePath, METADATA_CACHE_PATTERN, 0);
+        CleanUpMetadataCache(cachePath, TEXT_INDEX_CACHE_PATTERN, 0);
+    }
 }
 
 using namespace Gdiplus;
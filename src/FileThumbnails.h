@@ -6,6 +6,7 @@
 #define THUMBNAIL_DY 150
 
 void CleanUpThumbnailCache(const FileHistory& fileHistory);
+void EnableMetadataCache(bool enable);
 
 bool LoadThumbnail(DisplayState& ds);
 bool HasThumbnail(DisplayState& ds);
@@ -140,6 +140,7 @@ static MenuDef menuDefGoTo[] = {
     { _TRN("F&orward\tAlt+Right Arrow"),    IDM_GOTO_NAV_FORWARD,       0 },
     { SEP_ITEM,                             0,                          MF_NOT_FOR_EBOOK_UI },
     { _TRN("Fin&d...\tCtrl+F"),             IDM_FIND_FIRST,             MF_NOT_FOR_EBOOK_UI },
+    { _TRN("Find &All\tCtrl+Shift+F"),      IDM_FIND_ALL,               MF_NOT_FOR_EBOOK_UI | MF_NOT_FOR_CHM },
 };
 //] ACCESSKEY_GROUP GoTo Menu
 
@@ -206,6 +207,7 @@ static MenuDef menuDefDebug[] = {
     { "Mui debug paint",                    IDM_DEBUG_MUI,              MF_NO_TRANSLATE },
     { "Annotation from Selection",          IDM_DEBUG_ANNOTATION,       MF_NO_TRANSLATE },
     { "Download symbols",                   IDM_DEBUG_DOWNLOAD_SYMBOLS, MF_NO_TRANSLATE },
+    { "Copy render stats",                  IDM_DEBUG_RENDER_STATS,     MF_NO_TRANSLATE },
 };
 //] ACCESSKEY_GROUP Debug Menu
 
@@ -466,6 +468,7 @@ void MenuUpdateStateForWindow(WindowInfo* win) {
         IDM_GOTO_NAV_FORWARD,
         IDM_GOTO_PAGE,
         IDM_FIND_FIRST,
+        IDM_FIND_ALL,
         IDM_SAVEAS,
         IDM_SAVEAS_BOOKMARK,
         IDM_SEND_BY_EMAIL,
@@ -533,6 +536,7 @@ void MenuUpdateStateForWindow(WindowInfo* win) {
 
     if (tab && tab->AsFixed()) {
         win::menu::SetEnabled(win->menu, IDM_FIND_FIRST, !tab->AsFixed()->GetEngine()->IsImageCollection());
+        win::menu::SetEnabled(win->menu, IDM_FIND_ALL, !tab->AsFixed()->GetEngine()->IsImageCollection());
     }
 
     if (win->IsDocLoaded() && !fileExists) {
@@ -3,6 +3,8 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/SyncUtil.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 #include "utils/Log.h"
 
@@ -13,122 +15,150 @@
 #include "Controller.h"
 #include "DisplayModel.h"
 #include "GlobalPrefs.h"
+#include "TileCache.h"
 #include "RenderCache.h"
 #include "TextSelection.h"
 
 #pragma warning(disable : 28159) // silence /analyze: Consider using 'GetTickCount64' instead of 'GetTickCount'
 
-// TODO: remove this and always conserve memory?
-/* Define if you want to conserve memory by always freeing cached bitmaps
-   for pages not visible. Disabling this might lead to pages not rendering
-   due to insufficient (GDI) memory. */
+/* Define if you want to conserve memory by freeing cached tiles of a page
+   as soon as it has been completely painted at a different resolution. */
 #define CONSERVE_MEMORY
 
 // define to view the tile boundaries
 #undef SHOW_TILE_LAYOUT
 
+// creates a top-down DIB section of the given format (cf. try_render_as_palette_image)
+static RenderedBitmap* CreateTileDIB(SizeI size, int bpp, const std::vector<uint32_t>& palette, uint8_t** bitsOut) {
+    ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
+    if (!bmi || palette.size() > 256)
+        return nullptr;
+    BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = size.dx;
+    bmih->biHeight = -size.dy;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = (WORD)bpp;
+    bmih->biSizeImage = ((size.dx * bpp + 31) / 32) * 4 * size.dy;
+    bmih->biClrUsed = (DWORD)palette.size();
+    if (palette.size() > 0)
+        memcpy(bmi.Get()->bmiColors, palette.data(), palette.size() * sizeof(RGBQUAD));
+
+    void* data = nullptr;
+    HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
+    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    if (!hbmp) {
+        if (hMap)
+            CloseHandle(hMap);
+        return nullptr;
+    }
+    *bitsOut = (uint8_t*)data;
+    return new RenderedBitmap(hbmp, size, hMap);
+}
+
+// makes a RenderedBitmap's pixels available to TileCache (which owns it)
+class RenderedTileBitmap : public TileBitmap {
+    // dsBm.bmBitsPixel and dsBm.bmWidthBytes are also set for device dependent bitmaps
+    DIBSECTION info = {0};
+    // read when the bitmap is added, as it can't be selected into a DC while it's painted
+    uint32_t palette[256];
+    int paletteSize = 0;
+
+  public:
+    RenderedBitmap* bmp;
+
+    explicit RenderedTileBitmap(RenderedBitmap* bmp) : bmp(bmp) {
+        GetObject(bmp->GetBitmap(), sizeof(info), &info);
+        if (8 == info.dsBm.bmBitsPixel && info.dsBm.bmBits) {
+            HDC hdc = CreateCompatibleDC(nullptr);
+            HGDIOBJ prevBmp = SelectObject(hdc, bmp->GetBitmap());
+            paletteSize = GetDIBColorTable(hdc, 0, dimof(palette), (RGBQUAD*)palette);
+            SelectObject(hdc, prevBmp);
+            DeleteDC(hdc);
+        }
+    }
+    ~RenderedTileBitmap() override {
+        delete bmp;
+    }
+    int Dx() const override {
+        return bmp->Size().dx;
+    }
+    int Dy() const override {
+        return bmp->Size().dy;
+    }
+    int Bpp() const override {
+        return info.dsBm.bmBitsPixel ? info.dsBm.bmBitsPixel : 32;
+    }
+    int Stride() const override {
+        return info.dsBm.bmWidthBytes ? info.dsBm.bmWidthBytes : Dx() * 4;
+    }
+    uint8_t* GetBits() override {
+        // only top-down DIB sections (which all rendered bitmaps are)
+        if (info.dsBmih.biHeight > 0)
+            return nullptr;
+        return (uint8_t*)info.dsBm.bmBits;
+    }
+    const uint32_t* GetPalette(int* count) override {
+        *count = paletteSize;
+        return paletteSize > 0 ? palette : nullptr;
+    }
+};
+
+static RenderedBitmap* GetRenderedBitmap(TileCacheEntry* entry) {
+    return entry->bitmap ? ((RenderedTileBitmap*)entry->bitmap)->bmp : nullptr;
+}
+
 RenderCache::RenderCache()
-    : cacheCount(0),
-      requestCount(0),
+    : cache(this),
+      workerCount(0),
       maxTileSize(GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)),
       isRemoteSession(GetSystemMetrics(SM_REMOTESESSION)) {
     textColor = WIN_COL_BLACK;
     backgroundColor = WIN_COL_WHITE;
 
-    InitializeCriticalSection(&cacheAccess);
-    InitializeCriticalSection(&requestAccess);
-
-    startRendering = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    renderThread = CreateThread(nullptr, 0, RenderCacheThread, this, 0, 0);
-    AssertCrash(nullptr != renderThread);
+    SetMaxMemory(0);
+
+    // leave one processor for the UI thread
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int threads = limitValue((int)si.dwNumberOfProcessors - 1, 1, MAX_RENDER_THREADS);
+    for (int i = 0; i < threads; i++) {
+        RenderWorker* worker = &workers[workerCount];
+        worker->cache = this;
+        worker->curReq = nullptr;
+        bool ok = worker->thread.Start(RenderCacheThread, worker);
+        AssertCrash(ok);
+        if (ok)
+            workerCount++;
+    }
 }
 
 RenderCache::~RenderCache() {
-    EnterCriticalSection(&requestAccess);
-    EnterCriticalSection(&cacheAccess);
+    ScopedMutex scope(&requestAccess);
 
-    CloseHandle(renderThread);
-    CloseHandle(startRendering);
-    AssertCrash(!curReq && 0 == requestCount && 0 == cacheCount);
-
-    LeaveCriticalSection(&cacheAccess);
-    DeleteCriticalSection(&cacheAccess);
-    LeaveCriticalSection(&requestAccess);
-    DeleteCriticalSection(&requestAccess);
+    for (int i = 0; i < workerCount; i++) {
+        AssertCrash(!workers[i].curReq);
+    }
+    AssertCrash(0 == requests.size() && 0 == cache.Count() && 0 == cache.CompressedCount());
 }
 
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
-   <rotation> and <zoom> in the cache - call DropCacheEntry when you
+   <rotation> and <zoom> in the cache - call cache.DropCacheEntry when you
    no longer need a found entry. */
-BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
-    ScopedCritSec scope(&cacheAccess);
-    rotation = NormalizeRotation(rotation);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* entry = cache[i];
-        if ((dm == entry->dm) && (pageNo == entry->pageNo) && (rotation == entry->rotation) &&
-            (INVALID_ZOOM == zoom || zoom == entry->zoom) && (!tile || entry->tile == *tile)) {
-            entry->refs++;
-            return entry;
-        }
-    }
-    return nullptr;
+TileCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
+    return cache.Find(dm, pageNo, NormalizeRotation(rotation), zoom, tile);
 }
 
 bool RenderCache::Exists(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
-    BitmapCacheEntry* entry = Find(dm, pageNo, rotation, zoom, tile);
-    if (entry)
-        DropCacheEntry(entry);
-    return entry != nullptr;
-}
-
-bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
-    ScopedCritSec scope(&cacheAccess);
-    AssertCrash(entry);
-    if (!entry) {
-        return true;
-    }
-    if (0 == --entry->refs) {
-        delete entry;
-        return true;
-    }
-    return false;
+    return cache.Exists(dm, pageNo, NormalizeRotation(rotation), zoom, tile);
 }
 
 void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bitmap) {
-    ScopedCritSec scope(&cacheAccess);
     AssertCrash(req.dm);
-
     req.rotation = NormalizeRotation(req.rotation);
-    AssertCrash(cacheCount <= MAX_BITMAPS_CACHED);
-
-    /* It's possible there still is a cached bitmap with different zoom/rotation */
-    FreePage(req.dm, req.pageNo, &req.tile);
-
-    if (cacheCount >= MAX_BITMAPS_CACHED) {
-        // free an invisible page of the same DisplayModel ...
-        for (int i = 0; i < cacheCount; i++) {
-            if (cache[i]->dm == req.dm && !req.dm->PageVisibleNearby(cache[i]->pageNo)) {
-                DropCacheEntry(cache[i]);
-                cacheCount--;
-                memmove(&cache[i], &cache[i + 1], (cacheCount - i) * sizeof(cache[0]));
-                break;
-            }
-        }
-        // ... or just the oldest cached page
-        if (cacheCount >= MAX_BITMAPS_CACHED) {
-            DropCacheEntry(cache[0]);
-            cacheCount--;
-            memmove(&cache[0], &cache[1], cacheCount * sizeof(cache[0]));
-        }
-    }
-
-    // Copy the PageRenderRequest as it will be reused
-    cache[cacheCount] = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap);
-    CrashIf(!cache[cacheCount]);
-    if (!cache[cacheCount])
-        delete bitmap;
-    else
-        cacheCount++;
+    TileBitmap* tileBmp = bitmap ? new RenderedTileBitmap(bitmap) : nullptr;
+    cache.Add(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, tileBmp);
 }
 
 static RectD GetTileRect(RectD pagerect, TilePosition tile) {
@@ -184,83 +214,114 @@ static bool IsTileVisible(DisplayModel* dm, int pageNo, TilePosition tile, float
     return !tileOnScreen.Intersect(screen).IsEmpty();
 }
 
-/* Free all bitmaps in the cache that are of a specific page (or all pages
-   of the given DisplayModel, or even all invisible pages). */
-void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
-    ScopedCritSec scope(&cacheAccess);
-    int cacheCountTmp = cacheCount;
-    int curPos = 0;
-
-    for (int i = 0; i < cacheCountTmp; i++) {
-        BitmapCacheEntry* entry = cache[i];
-        bool shouldFree;
-        if (dm && pageNo != INVALID_PAGE_NO) {
-            // a specific page
-            shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
-            if (tile) {
-                // a given tile of the page or all tiles not rendered at a given resolution
-                // (and at resolution 0 for quick zoom previews)
-                shouldFree =
-                    shouldFree && (entry->tile == *tile ||
-                                   tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
-                                   tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
-            }
-        } else if (dm) {
-            // all pages of this DisplayModel
-            shouldFree = (cache[i]->dm == dm);
-        } else {
-            // all invisible pages resp. page tiles
-            shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
-            if (!shouldFree && entry->tile.res > 1)
-                shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
-        }
+// bitmaps for pages not visible nearby are evicted first, then bitmaps for tiles not visible
+bool RenderCache::IsNearby(TileCacheEntry* entry) {
+    return ((DisplayModel*)entry->owner)->PageVisibleNearby(entry->pageNo);
+}
+
+bool RenderCache::IsVisible(TileCacheEntry* entry) {
+    return IsTileVisible((DisplayModel*)entry->owner, entry->pageNo, entry->tile);
+}
+
+void RenderCache::Evicted(TileCacheEntry* entry) {
+    UNUSED(entry);
+    RenderStatsCount(RenderCounter::Eviction);
+}
+
+// DisplayModels sharing an engine (i.e. views of the same document
+// in several tabs or windows) also share their rendered tiles
+void* RenderCache::GetDocument(void* owner) {
+    return ((DisplayModel*)owner)->GetEngine();
+}
+
+// whether req renders exactly the tile dm needs, only for another view of the same
+// document (in which case the rendered bitmap is shared, cf. TileCache::Find)
+static bool IsSharedRequest(PageRenderRequest* req, DisplayModel* dm, int pageNo, int rotation, float zoom,
+                            TilePosition tile) {
+    return req->dm != dm && req->dm->GetEngine() == dm->GetEngine() && req->pageNo == pageNo &&
+           req->rotation == rotation && req->zoom == zoom && req->tile == tile && !req->renderCb && !req->abort;
+}
 
-        if (shouldFree) {
-            DropCacheEntry(entry);
-            cache[i] = nullptr;
-            cacheCount--;
+// restores a bitmap for the request from its compressed copy (if there is one)
+RenderedBitmap* RenderCache::Decompress(PageRenderRequest& req) {
+    int rotation = NormalizeRotation(req.rotation);
+    CompressedCacheEntry* centry = cache.TakeCompressed(req.dm, req.pageNo, rotation, req.zoom, req.tile);
+    if (!centry)
+        return nullptr;
+
+    // the entry is moved back into the cache by the caller
+    uint8_t* bits = nullptr;
+    RenderedBitmap* bmp = CreateTileDIB(SizeI(centry->dx, centry->dy), centry->bpp, centry->palette, &bits);
+    if (bmp) {
+        int stride = ((centry->dx * centry->bpp + 31) / 32) * 4;
+        if (stride == centry->stride && centry->Decompress(bits)) {
+            RenderStatsCount(RenderCounter::CompressedHit);
+        } else {
+            delete bmp;
+            bmp = nullptr;
         }
+    }
+    delete centry;
+    return bmp;
+}
 
-        if (curPos != i)
-            cache[curPos] = cache[i];
-        if (!shouldFree)
-            curPos++;
+void RenderCache::SetMaxMemory(int sizeInMB) {
+    size_t maxMemory;
+    if (sizeInMB > 0) {
+        maxMemory = (size_t)std::min((u64)sizeInMB * 1024 * 1024, (u64)SIZE_MAX / 2);
+    } else {
+        // high resolution screens need proportionally more memory for the same number of pages
+        size_t screenSize = (size_t)GetSystemMetrics(SM_CXSCREEN) * GetSystemMetrics(SM_CYSCREEN) * 4;
+        maxMemory = screenSize * BITMAPS_CACHED_SCREENS;
+        maxMemory = limitValue(maxMemory, (size_t)MIN_BITMAPS_MEMORY, (size_t)MAX_BITMAPS_MEMORY);
     }
+
+    cache.SetMaxMemory(maxMemory);
 }
 
 // keep the cached bitmaps for visible pages to avoid flickering during a reload.
 // mark invisible pages as out-of-date to prevent inconsistencies
 void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm) {
-    ScopedCritSec scope(&cacheAccess);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == oldDm) {
-            if (oldDm->PageVisible(cache[i]->pageNo))
-                cache[i]->dm = newDm;
+    ScopedMutex scope(&cache.access);
+    cache.FreeCompressed(oldDm);
+    // entries are only re-indexed after the loop, as that moves them to the end of the list
+    Vec<TileCacheEntry*> kept;
+    for (TileCacheEntry* entry = cache.First(); entry; entry = entry->lruNext) {
+        if (entry->owner == oldDm) {
+            if (oldDm->PageVisible(entry->pageNo) && oldDm != newDm)
+                kept.Append(entry);
             // make sure that the page is rerendered eventually
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
         }
     }
+    for (TileCacheEntry* entry : kept) {
+        cache.Remove(entry);
+        entry->owner = newDm;
+        cache.Insert(entry);
+    }
 }
 
 // marks all tiles containing rect of pageNo as out of date
 void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectD rect) {
-    ScopedCritSec scopeReq(&requestAccess);
+    ScopedMutex scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo)
-        AbortCurrentRequest();
+    AbortCurrentRequests(dm, pageNo);
 
-    ScopedCritSec scopeCache(&cacheAccess);
+    ScopedMutex scopeCache(&cache.access);
+    cache.FreeCompressedForDocument(dm, pageNo);
 
+    // tiles shared with other views of the document are out of date as well
     RectD mediabox = dm->GetEngine()->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            !GetTileRect(mediabox, cache[i]->tile).Intersect(rect).IsEmpty()) {
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+    for (TileCacheEntry* entry = cache.First(); entry; entry = entry->lruNext) {
+        if (GetDocument(entry->owner) == dm->GetEngine() && entry->pageNo == pageNo &&
+            !GetTileRect(mediabox, entry->tile).Intersect(rect).IsEmpty()) {
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
         }
     }
+    dm->RepaintSharedViews();
 }
 
 // determine the count of tiles required for a page at a given zoom level
@@ -293,16 +354,29 @@ USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
     return std::min(res, (USHORT)30);
 }
 
-// get the maximum resolution available for the given page
-USHORT RenderCache::GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation) {
-    ScopedCritSec scope(&cacheAccess);
-    USHORT maxRes = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo && cache[i]->rotation == rotation) {
-            maxRes = std::max(cache[i]->tile.res, maxRes);
+// collects all tiles at resolution res which intersect area (in screen coordinates)
+void RenderCache::GetTilesInArea(DisplayModel* dm, int pageNo, USHORT res, RectI area, Vec<TilePosition>& tiles) {
+    PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+    int rotation = dm->GetRotation();
+    float zoom = dm->GetZoomReal(pageNo);
+
+    // only subdivide tiles which are at least partially inside area
+    Vec<TilePosition> queue;
+    queue.Append(TilePosition(0, 0, 0));
+    while (queue.size() > 0) {
+        TilePosition tile = queue.PopAt(0);
+        RectI tileOnScreen = GetTileOnScreen(dm->GetEngine(), pageNo, rotation, zoom, tile, pageInfo->pageOnScreen);
+        if (tileOnScreen.Intersect(area).IsEmpty())
+            continue;
+        if (tile.res == res) {
+            tiles.Append(tile);
+            continue;
         }
+        queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2));
+        queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2 + 1));
+        queue.Append(TilePosition(tile.res + 1, tile.row * 2 + 1, tile.col * 2));
+        queue.Append(TilePosition(tile.res + 1, tile.row * 2 + 1, tile.col * 2 + 1));
     }
-    return maxRes;
 }
 
 // reduce the size of tiles in order to hopefully use less memory overall
@@ -311,8 +385,8 @@ bool RenderCache::ReduceTileSize() {
     if (maxTileSize.dx < 200 || maxTileSize.dy < 200)
         return false;
 
-    ScopedCritSec scope1(&requestAccess);
-    ScopedCritSec scope2(&cacheAccess);
+    ScopedMutex scope1(&requestAccess);
+    ScopedMutex scope2(&cache.access);
 
     if (maxTileSize.dx > maxTileSize.dy)
         maxTileSize.dx /= 2;
@@ -320,34 +394,119 @@ bool RenderCache::ReduceTileSize() {
         maxTileSize.dy /= 2;
 
     // invalidate all rendered bitmaps and all requests
-    while (cacheCount > 0)
-        FreeForDisplayModel(cache[0]->dm);
-    while (requestCount > 0)
-        ClearQueueForDisplayModel(requests[0].dm);
-    AbortCurrentRequest();
+    while (cache.First())
+        FreeForDisplayModel((DisplayModel*)cache.First()->owner);
+    while (requests.size() > 0)
+        ClearQueueForDisplayModel(requests.at(0).dm);
+    AbortCurrentRequests();
 
     return true;
 }
 
 void RenderCache::RequestRendering(DisplayModel* dm, int pageNo) {
     TilePosition tile(GetTileRes(dm, pageNo), 0, 0);
+    // pages rendered in several tiles get a base layer to paint
+    // until all tiles have been rendered (e.g. after zooming)
+    if (tile.res > 0 && dm->PageVisible(pageNo))
+        RequestBaseLayer(dm, pageNo);
     // only honor the request if there's a good chance that the
     // rendered tile will actually be used
     if (tile.res > 1)
         return;
 
-    RequestRendering(dm, pageNo, tile);
+    RenderPriority priority = dm->PageVisible(pageNo) ? RenderPriority::Visible : RenderPriority::Nearby;
+    RequestRendering(dm, pageNo, tile, priority);
     // render both tiles of the first row when splitting a page in four
     // (which always happens on larger displays for Fit Width)
     if (tile.res == 1 && !IsRenderQueueFull()) {
         tile.col = 1;
-        RequestRendering(dm, pageNo, tile, false);
+        RequestRendering(dm, pageNo, tile, priority, false);
+    }
+}
+
+void RenderCache::Prefetch(DisplayModel* dm, int pageNo, RectI area) {
+    PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+    if (!pageInfo || !pageInfo->shown)
+        return;
+
+    Vec<TilePosition> tiles;
+    GetTilesInArea(dm, pageNo, GetTileRes(dm, pageNo), area, tiles);
+
+    // start with the tiles closest to the visible part of the view,
+    // as only the first MAX_PREFETCH_TILES tiles are requested
+    SizeI view = dm->GetViewPort().Size();
+    int rotation = dm->GetRotation();
+    float zoom = dm->GetZoomReal(pageNo);
+    auto distance = [&](TilePosition tile) {
+        RectI r = GetTileOnScreen(dm->GetEngine(), pageNo, rotation, zoom, tile, pageInfo->pageOnScreen);
+        int dx = std::max(std::max(-(r.x + r.dx), r.x - view.dx), 0);
+        int dy = std::max(std::max(-(r.y + r.dy), r.y - view.dy), 0);
+        return dx + dy;
+    };
+    std::stable_sort(tiles.begin(), tiles.end(),
+                     [&](TilePosition t1, TilePosition t2) { return distance(t1) < distance(t2); });
+    for (size_t i = 0; i < tiles.size() && i < MAX_PREFETCH_TILES; i++) {
+        RequestRendering(dm, pageNo, tiles.at(i), RenderPriority::Prefetch, false);
     }
 }
 
+// the zoom level at which the whole page fits into 1/BASE_LAYER_SCALE of a screen
+// (or the current zoom level if the page is smaller than that)
+float RenderCache::GetBaseLayerZoom(DisplayModel* dm, int pageNo) {
+    EngineBase* engine = dm->GetEngine();
+    float zoom = dm->GetZoomReal(pageNo);
+    RectD pixelbox = engine->Transform(engine->PageMediabox(pageNo), pageNo, zoom, dm->GetRotation());
+    double pixels = pixelbox.dx * pixelbox.dy;
+    double maxPixels = (double)maxTileSize.dx * maxTileSize.dy / BASE_LAYER_SCALE;
+    if (pixels > maxPixels)
+        zoom *= (float)sqrt(maxPixels / pixels);
+    return zoom;
+}
+
+/* The base layer is a rendering of the whole page (i.e. the tile at resolution 0)
+   at a low zoom level. It's kept in the cache as long as the page is visible, so
+   that after zooming it can be painted scaled until the sharp tiles are available.
+   Any up-to-date tile at resolution 0 (e.g. one rendered at a previous zoom level) will do. */
+void RenderCache::RequestBaseLayer(DisplayModel* dm, int pageNo) {
+    ScopedMutex scope(&requestAccess);
+    if (dm->dontRenderFlag)
+        return;
+
+    TilePosition tile(0, 0, 0);
+    int rotation = NormalizeRotation(dm->GetRotation());
+    TileCacheEntry* entry = cache.Find(dm, pageNo, rotation, INVALID_ZOOM, &tile);
+    if (entry) {
+        bool outOfDate;
+        {
+            ScopedMutex scopeCache(&cache.access);
+            outOfDate = entry->outOfDate;
+        }
+        cache.DropCacheEntry(entry);
+        // invalidated tiles are only kept until they've been rerendered
+        if (!outOfDate)
+            return;
+    }
+    // already queued or being rendered
+    if (GetRenderDelay(dm, pageNo, tile) != RENDER_DELAY_UNDEFINED)
+        return;
+
+    float zoom = GetBaseLayerZoom(dm, pageNo);
+    if (Render(dm, pageNo, rotation, zoom, RenderPriority::Nearby, &tile)) {
+        // no rendering thread can have picked up the request, as we're still holding requestAccess
+        requests.Last().isBaseLayer = true;
+    }
+}
+
+static void AbortRequest(PageRenderRequest* req) {
+    if (req->abortCookie)
+        req->abortCookie->Abort();
+    req->abort = true;
+}
+
 /* Render a bitmap for page <pageNo> in <dm>. */
-void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage) {
-    ScopedCritSec scope(&requestAccess);
+void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, RenderPriority priority,
+                                   bool clearQueueForPage) {
+    ScopedMutex scope(&requestAccess);
     AssertCrash(dm);
     if (!dm || dm->dontRenderFlag)
         return;
@@ -355,37 +514,50 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
-        if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
-            /* we're already rendering exactly the same page */
+    for (int i = 0; i < workerCount; i++) {
+        PageRenderRequest* curReq = workers[i].curReq;
+        if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+            if ((curReq->zoom == zoom) && (curReq->rotation == rotation) && !curReq->abort) {
+                /* we're already rendering exactly the same page */
+                return;
+            }
+            /* Currently rendered page is for the same page but with different zoom
+            or rotation, so abort it */
+            AbortRequest(curReq);
+        } else if (curReq && IsSharedRequest(curReq, dm, pageNo, rotation, zoom, tile)) {
+            /* another view of the same document is already rendering this tile */
             return;
         }
-        /* Currently rendered page is for the same page but with different zoom
-        or rotation, so abort it */
-        AbortCurrentRequest();
     }
 
     // clear requests for tiles of different resolution and invisible tiles
     if (clearQueueForPage)
         ClearQueueForDisplayModel(dm, pageNo, &tile);
 
-    for (int i = 0; i < requestCount; i++) {
-        PageRenderRequest* req = &(requests[i]);
-        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
-            if ((req->zoom == zoom) && (req->rotation == rotation)) {
-                /* Request with exactly the same parameters already queued for
-                   rendering. Move it to the top of the queue so that it'll
-                   be rendered faster. */
-                PageRenderRequest tmp;
-                tmp = requests[requestCount - 1];
-                requests[requestCount - 1] = *req;
-                *req = tmp;
-            } else {
-                /* There was a request queued for the same page but with different
-                   zoom or rotation, so only replace this request */
-                req->zoom = zoom;
-                req->rotation = rotation;
+    for (size_t i = 0; i < requests.size(); i++) {
+        PageRenderRequest req = requests.at(i);
+        bool isShared = IsSharedRequest(&req, dm, pageNo, rotation, zoom, tile);
+        if ((req.pageNo == pageNo) && (req.dm == dm || isShared) && (req.tile == tile)) {
+            /* There was a request queued for the same tile, so only update it (in
+               case zoom or rotation have changed) and move it to the end of the
+               queue so that it'll be rendered before other requests of the same
+               priority. A request queued by another view of the same document is
+               taken over, as that view might no longer need the tile. */
+            req.dm = dm;
+            if ((req.zoom != zoom) || (req.rotation != rotation)) {
+                req.zoom = zoom;
+                req.rotation = rotation;
+                req.pageRect = GetTileRectUser(dm->GetEngine(), pageNo, rotation, zoom, tile);
             }
+            req.isBaseLayer = false;
+            req.priority = std::min(req.priority, priority);
+            // keep the prefetch request from timing out
+            if (RenderPriority::Prefetch == req.priority)
+                req.timestamp = GetTickCount();
+            requests.RemoveAt(i);
+            requests.Append(req);
+            if (RenderPriority::Visible == req.priority)
+                AbortStaleRequest();
             return;
         }
     }
@@ -396,122 +568,197 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
         return;
     }
 
-    Render(dm, pageNo, rotation, zoom, &tile);
+    Render(dm, pageNo, rotation, zoom, priority, &tile);
 }
 
 void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectD pageRect,
                          RenderingCallback& callback) {
-    bool ok = Render(dm, pageNo, rotation, zoom, nullptr, &pageRect, &callback);
+    bool ok = Render(dm, pageNo, rotation, zoom, RenderPriority::Visible, nullptr, &pageRect, &callback);
     if (!ok)
         callback.Callback();
 }
 
-bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile, RectD* pageRect,
-                         RenderingCallback* renderCb) {
+bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RenderPriority priority,
+                         TilePosition* tile, RectD* pageRect, RenderingCallback* renderCb) {
     AssertCrash(dm);
     if (!dm || dm->dontRenderFlag)
         return false;
 
-    AssertCrash(tile || pageRect && renderCb);
+    AssertCrash(tile || (pageRect && renderCb));
     if (!tile && !(pageRect && renderCb))
         return false;
 
-    ScopedCritSec scope(&requestAccess);
-    PageRenderRequest* newRequest;
-
-    /* add request to the queue */
-    if (requestCount == MAX_PAGE_REQUESTS) {
-        /* queue is full -> remove the oldest items on the queue */
-        if (requests[0].renderCb)
-            requests[0].renderCb->Callback();
-        memmove(&(requests[0]), &(requests[1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - 1));
-        newRequest = &(requests[MAX_PAGE_REQUESTS - 1]);
-    } else {
-        newRequest = &(requests[requestCount]);
-        requestCount++;
+    ScopedMutex scope(&requestAccess);
+
+    if (IsRenderQueueFull()) {
+        /* queue is full -> remove the oldest of the least important requests
+           (unless they're all more important than the new one) */
+        size_t drop = PickRequestToDrop(requests.LendData(), requests.size());
+        if (requests.at(drop).priority < priority)
+            return false;
+        if (requests.at(drop).renderCb)
+            requests.at(drop).renderCb->Callback();
+        requests.RemoveAt(drop);
+        RenderStatsCount(RenderCounter::Dropped);
     }
-    AssertCrash(requestCount <= MAX_PAGE_REQUESTS);
 
-    newRequest->dm = dm;
-    newRequest->pageNo = pageNo;
-    newRequest->rotation = rotation;
-    newRequest->zoom = zoom;
+    PageRenderRequest newRequest;
+    newRequest.dm = dm;
+    newRequest.pageNo = pageNo;
+    newRequest.rotation = rotation;
+    newRequest.zoom = zoom;
+    newRequest.priority = priority;
     if (tile) {
-        newRequest->pageRect = GetTileRectUser(dm->GetEngine(), pageNo, rotation, zoom, *tile);
-        newRequest->tile = *tile;
+        newRequest.pageRect = GetTileRectUser(dm->GetEngine(), pageNo, rotation, zoom, *tile);
+        newRequest.tile = *tile;
     } else if (pageRect) {
-        newRequest->pageRect = *pageRect;
+        newRequest.pageRect = *pageRect;
         // can't cache bitmaps that aren't for a given tile
         AssertCrash(renderCb);
     } else
         AssertCrash(0);
-    newRequest->abort = false;
-    newRequest->abortCookie = nullptr;
-    newRequest->timestamp = GetTickCount();
-    newRequest->renderCb = renderCb;
-
-    SetEvent(startRendering);
+    newRequest.abort = false;
+    newRequest.isBaseLayer = false;
+    newRequest.abortCookie = nullptr;
+    newRequest.timestamp = GetTickCount();
+    newRequest.renderCb = renderCb;
+    requests.Append(newRequest);
+    RenderStatsQueueDepth(requests.size());
+
+    if (RenderPriority::Visible == priority)
+        AbortStaleRequest();
+    startRendering.Set();
 
     return true;
 }
 
+// if all rendering threads are busy, abort one that renders a page which
+// is no longer visible nearby or has only been requested speculatively, so
+// that visible tiles don't have to wait for it (it's requested again if needed).
+// Of these, the one that has made the least progress is aborted, while renderings
+// which are almost done are only demoted to Prefetch priority and allowed to finish
+// (as restarting them after a small scroll back would take much longer)
+void RenderCache::AbortStaleRequest() {
+    ScopedMutex scope(&requestAccess);
+    PageRenderRequest* stale = nullptr;
+    float staleProgress = ALMOST_DONE_PROGRESS;
+    for (int i = 0; i < workerCount; i++) {
+        PageRenderRequest* req = workers[i].curReq;
+        if (!req || req->abort)
+            return;
+        if (req->renderCb)
+            continue;
+        if (RenderPriority::Prefetch != req->priority && req->dm->PageVisibleNearby(req->pageNo))
+            continue;
+        float progress = req->abortCookie ? req->abortCookie->GetProgress() : 0.0f;
+        if (progress >= ALMOST_DONE_PROGRESS) {
+            if (RenderPriority::Prefetch != req->priority)
+                RenderStatsCount(RenderCounter::Spared);
+            req->priority = RenderPriority::Prefetch;
+        } else if (progress < staleProgress) {
+            stale = req;
+            staleProgress = progress;
+        }
+    }
+    if (stale)
+        AbortRequest(stale);
+}
+
 UINT RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile) {
-    ScopedCritSec scope(&requestAccess);
+    ScopedMutex scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile)
-        return GetTickCount() - curReq->timestamp;
+    // requests of other views of the same document count if they're for the same zoom level
+    int rotation = NormalizeRotation(dm->GetRotation());
+    float zoom = dm->GetZoomReal(pageNo);
+    for (int i = 0; i < workerCount; i++) {
+        PageRenderRequest* curReq = workers[i].curReq;
+        if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile)
+            return GetTickCount() - curReq->timestamp;
+        if (curReq && IsSharedRequest(curReq, dm, pageNo, rotation, zoom, tile))
+            return GetTickCount() - curReq->timestamp;
+    }
 
-    for (int i = 0; i < requestCount; i++)
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile)
-            return GetTickCount() - requests[i].timestamp;
+    for (PageRenderRequest& req : requests) {
+        if (req.pageNo == pageNo && req.dm == dm && req.tile == tile)
+            return GetTickCount() - req.timestamp;
+        if (IsSharedRequest(&req, dm, pageNo, rotation, zoom, tile))
+            return GetTickCount() - req.timestamp;
+    }
 
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest* req) {
-    ScopedCritSec scope(&requestAccess);
-
-    if (requestCount == 0)
+/* Pick the most important request (and the most recent one among requests
+   of the same importance). Requests for engines which can't render several
+   pages at once are skipped while another thread is rendering for them. */
+bool RenderCache::GetNextRequest(RenderWorker* worker, PageRenderRequest* req) {
+    ScopedMutex scope(&requestAccess);
+
+    int next = PickNextRequest(requests.LendData(), requests.size(), [this](const PageRenderRequest& candidate) {
+        EngineBase* engine = candidate.dm->GetEngine();
+        return engine->HasParallelRendering() || !IsRendering(engine);
+    });
+    if (-1 == next) {
+        // wait until another request is queued or another thread is done
+        startRendering.Reset();
         return false;
+    }
 
-    AssertCrash(requestCount > 0);
-    AssertCrash(requestCount <= MAX_PAGE_REQUESTS);
-    requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
-    AssertCrash(requestCount >= 0);
+    *req = requests.at(next);
+    requests.RemoveAt(next);
+    worker->curReq = req;
     AssertCrash(!req->abort);
 
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest() {
-    ScopedCritSec scope(&requestAccess);
-    if (curReq)
-        delete curReq->abortCookie;
-    curReq = nullptr;
+void RenderCache::ClearCurrentRequest(RenderWorker* worker) {
+    ScopedMutex scope(&requestAccess);
+    if (worker->curReq)
+        delete worker->curReq->abortCookie;
+    worker->curReq = nullptr;
 
-    bool isQueueEmpty = requestCount == 0;
-    return isQueueEmpty;
+    // requests skipped because of the finished one can be rendered now
+    if (requests.size() > 0)
+        startRendering.Set();
+}
+
+bool RenderCache::IsRendering(DisplayModel* dm) {
+    ScopedMutex scope(&requestAccess);
+    for (int i = 0; i < workerCount; i++) {
+        if (workers[i].curReq && workers[i].curReq->dm == dm)
+            return true;
+    }
+    return false;
+}
+
+// engines may be shared by several DisplayModels
+bool RenderCache::IsRendering(EngineBase* engine) {
+    ScopedMutex scope(&requestAccess);
+    for (int i = 0; i < workerCount; i++) {
+        if (workers[i].curReq && workers[i].curReq->dm->GetEngine() == engine)
+            return true;
+    }
+    return false;
 }
 
-/* Wait until rendering of a page beloging to <dm> has finished. */
+/* Wait until rendering of all pages beloging to <dm> has finished. */
 /* TODO: this might take some time, would be good to show a dialog to let the
    user know he has to wait until we finish */
 void RenderCache::CancelRendering(DisplayModel* dm) {
     ClearQueueForDisplayModel(dm);
 
     for (;;) {
-        EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        requestAccess.Lock();
+        if (!IsRendering(dm)) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
-            LeaveCriticalSection(&requestAccess);
+            requestAccess.Unlock();
             return;
         }
 
-        AbortCurrentRequest();
-        LeaveCriticalSection(&requestAccess);
+        AbortCurrentRequests(dm);
+        requestAccess.Unlock();
 
         /* TODO: busy loop is not good, but I don't have a better idea */
         Sleep(50);
@@ -519,49 +766,51 @@ void RenderCache::CancelRendering(DisplayModel* dm) {
 }
 
 void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePosition* tile) {
-    ScopedCritSec scope(&requestAccess);
-    int reqCount = requestCount;
-    int curPos = 0;
-    for (int i = 0; i < reqCount; i++) {
-        PageRenderRequest* req = &(requests[i]);
-        bool shouldRemove = req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
-                            (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
-        if (i != curPos)
-            requests[curPos] = requests[i];
+    ScopedMutex scope(&requestAccess);
+    for (size_t i = requests.size(); i > 0; i--) {
+        PageRenderRequest* req = &requests.at(i - 1);
+        // base layers are still needed while tiles of a different resolution are rendered
+        bool shouldRemove =
+            req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
+            (!tile || (req->tile.res != tile->res && !req->isBaseLayer) || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
         if (shouldRemove) {
             if (req->renderCb)
                 req->renderCb->Callback();
-            requestCount--;
-        } else
-            curPos++;
+            requests.RemoveAt(i - 1);
+        }
     }
 }
 
-void RenderCache::AbortCurrentRequest() {
-    ScopedCritSec scope(&requestAccess);
-    if (!curReq)
-        return;
-    if (curReq->abortCookie)
-        curReq->abortCookie->Abort();
-    curReq->abort = true;
+// aborts the requests currently being rendered (optionally only
+// those for a given DisplayModel or page)
+void RenderCache::AbortCurrentRequests(DisplayModel* dm, int pageNo) {
+    ScopedMutex scope(&requestAccess);
+    for (int i = 0; i < workerCount; i++) {
+        PageRenderRequest* req = workers[i].curReq;
+        if (req && (!dm || req->dm == dm) && (INVALID_PAGE_NO == pageNo || req->pageNo == pageNo))
+            AbortRequest(req);
+    }
 }
 
-DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
-    RenderCache* cache = (RenderCache*)data;
+void RenderCache::RenderCacheThread(void* data) {
+    RenderWorker* worker = (RenderWorker*)data;
+    RenderCache* cache = worker->cache;
     PageRenderRequest req;
     RenderedBitmap* bmp;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
-            DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
-            // Is it not a page render request?
-            if (WAIT_OBJECT_0 != waitResult)
-                continue;
+        cache->ClearCurrentRequest(worker);
+        if (!cache->GetNextRequest(worker, &req)) {
+            cache->startRendering.Wait();
+            continue;
         }
+        DWORD waitMs = GetTickCount() - req.timestamp;
+        RenderStatsTime(RenderStage::QueueWait, waitMs);
 
-        if (!cache->GetNextRequest(&req))
+        bool isSpeculative = RenderPriority::Prefetch == req.priority;
+        if (!isSpeculative && !req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb)
             continue;
-        if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb)
+        if (isSpeculative && GetTickCount() - req.timestamp > PREFETCH_TIMEOUT)
             continue;
         if (req.dm->dontRenderFlag) {
             if (req.renderCb)
@@ -569,19 +818,37 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             continue;
         }
 
-        // make sure that we have extracted page text for
-        // all rendered pages to allow text selection and
-        // searching without any further delays
-        if (!req.dm->textCache->HasData(req.pageNo))
-            req.dm->textCache->GetData(req.pageNo);
+        // the page is requested again once the document's page sizes have been
+        // determined (cf. DisplayModel::UpdateProvisionalPageSizes)
+        if (!req.dm->GetEngine()->IsPageDataAvailable(req.pageNo)) {
+            if (req.renderCb)
+                req.renderCb->Callback();
+            continue;
+        }
 
-        CrashIf(req.abortCookie != nullptr);
-        bmp = req.dm->GetEngine()->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View,
-                                                &req.abortCookie);
+        // evicted tiles are restored from their compressed copy if possible
+        Timer t;
+        bmp = req.renderCb ? nullptr : cache->Decompress(req);
+        bool isDecompressed = bmp != nullptr;
+        if (!isDecompressed) {
+            CrashIf(req.abortCookie != nullptr);
+            bmp = req.dm->GetEngine()->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect,
+                                                    RenderTarget::View, &req.abortCookie);
+        }
+        double renderMs = t.GetTimeInMs();
+        RenderStatsTime(RenderStage::Total, renderMs);
+        LogRenderStats(
+            "{\"page\": %d, \"zoom\": %.4f, \"rotation\": %d, \"tile\": [%d, %d, %d], \"priority\": %d, "
+            "\"wait_ms\": %u, \"render_ms\": %.2f, \"decompressed\": %s, \"failed\": %s, \"aborted\": %s}",
+            req.pageNo, req.zoom, req.rotation, req.tile.res, req.tile.row, req.tile.col, (int)req.priority, waitMs,
+            renderMs, isDecompressed ? "true" : "false", bmp ? "false" : "true", req.abort ? "true" : "false");
         if (req.abort) {
+            RenderStatsCount(RenderCounter::Aborted);
             delete bmp;
             if (req.renderCb)
                 req.renderCb->Callback();
+            else
+                req.dm->RepaintSharedViews();
             continue;
         }
 
@@ -590,12 +857,21 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             req.renderCb->Callback(bmp);
             req.renderCb = (RenderingCallback*)1; // will crash if accessed again, which should not happen
         } else {
-            // don't replace colors for individual images
-            if (bmp && !req.dm->GetEngine()->IsImageCollection())
+            // don't replace colors for individual images (or twice)
+            if (bmp && !isDecompressed && !req.dm->GetEngine()->IsImageCollection())
                 UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
             cache->Add(req, bmp);
             req.dm->RepaintDisplay();
+            req.dm->RepaintSharedViews();
         }
+
+        // make sure that we have extracted page text for
+        // all rendered pages to allow text selection and
+        // searching without any further delays
+        // Note: this is done after rendering so that the page
+        // is displayed as soon as possible
+        if (!req.dm->textCache->HasData(req.pageNo))
+            req.dm->textCache->GetData(req.pageNo);
     }
 }
 
@@ -604,8 +880,13 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
 UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo, TilePosition tile, RectI tileOnScreen,
                             bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement) {
     float zoom = dm->GetZoomReal(pageNo);
-    BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
+    TileCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
     UINT renderDelay = 0;
+    // only count the tiles which are actually needed
+    if (renderMissing && entry)
+        RenderStatsCount(entry->owner == dm ? RenderCounter::CacheHit : RenderCounter::SharedHit);
+    else if (renderMissing)
+        RenderStatsCount(RenderCounter::CacheMiss);
 
     if (!entry) {
         if (!isRemoteSession) {
@@ -614,13 +895,13 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo,
             entry = Find(dm, pageNo, dm->GetRotation(), INVALID_ZOOM, &tile);
         }
         renderDelay = GetRenderDelay(dm, pageNo, tile);
-        if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay && !IsRenderQueueFull())
-            RequestRendering(dm, pageNo, tile);
+        if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay)
+            RequestRendering(dm, pageNo, tile, RenderPriority::Visible);
     }
-    RenderedBitmap* renderedBmp = entry ? entry->bitmap : nullptr;
+    RenderedBitmap* renderedBmp = entry ? GetRenderedBitmap(entry) : nullptr;
     HBITMAP hbmp = renderedBmp ? renderedBmp->GetBitmap() : nullptr;
 
-    if (!hbmp) {
+    if (!hbmp && !(entry && entry->isSolid)) {
         if (entry && !(renderedBmp && ReduceTileSize())) {
             renderDelay = RENDER_DELAY_FAILED;
         } else if (0 == renderDelay) {
@@ -628,12 +909,21 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo,
         }
 
         if (entry) {
-            DropCacheEntry(entry);
+            cache.DropCacheEntry(entry);
         }
         return renderDelay;
     }
 
-    HDC bmpDC = CreateCompatibleDC(hdc);
+    if (entry->isSolid) {
+        RECT rc = bounds.ToRECT();
+        // color order in DIB is blue-green-red-alpha
+        uint32_t c = entry->solidColor;
+        HBRUSH brush = CreateSolidBrush(RGB((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF));
+        FillRect(hdc, &rc, brush);
+        DeleteObject(brush);
+    }
+
+    HDC bmpDC = hbmp ? CreateCompatibleDC(hdc) : nullptr;
     if (bmpDC) {
         SizeI bmpSize = renderedBmp->Size();
         int xSrc = -std::min(tileOnScreen.x, 0);
@@ -664,7 +954,7 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo,
         CrashIf(renderedReplacement && !*renderedReplacement);
     }
 
-    DropCacheEntry(entry);
+    cache.DropCacheEntry(entry);
     return 0;
 }
 
@@ -696,13 +986,24 @@ UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo, Pag
     int rotation = dm->GetRotation();
     float zoom = dm->GetZoomReal(pageNo);
     USHORT targetRes = GetTileRes(dm, pageNo);
-    USHORT maxRes = GetMaxTileRes(dm, pageNo, rotation);
+    USHORT maxRes = cache.GetMaxTileRes(dm, pageNo, rotation);
     if (maxRes < targetRes) {
         maxRes = targetRes;
     }
 
+    // lower resolution tiles (such as the base layer) are only painted as
+    // replacements, so skip them if all tiles at target resolution are available
     Vec<TilePosition> queue;
-    queue.Append(TilePosition(0, 0, 0));
+    if (targetRes > 0)
+        GetTilesInArea(dm, pageNo, targetRes, bounds, queue);
+    for (size_t i = 0; i < queue.size(); i++) {
+        if (!Exists(dm, pageNo, rotation, zoom, &queue.at(i))) {
+            queue.Reset();
+            break;
+        }
+    }
+    if (0 == queue.size())
+        queue.Append(TilePosition(0, 0, 0));
     UINT renderDelayMin = RENDER_DELAY_UNDEFINED;
     bool neededScaling = false;
 
@@ -742,9 +1043,8 @@ UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo, Pag
             *renderOutOfDateCue = false;
         // free tiles with different resolution
         TilePosition tile(targetRes, (USHORT)-1, 0);
-        FreePage(dm, pageNo, &tile);
+        cache.FreePage(dm, pageNo, &tile);
     }
-    FreeNotVisible();
 #endif
 
     return renderDelayMin;
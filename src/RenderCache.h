@@ -3,12 +3,31 @@
 
 #define RENDER_DELAY_UNDEFINED ((UINT)-1)
 #define RENDER_DELAY_FAILED ((UINT)-2)
-#define INVALID_TILE_RES ((USHORT)-1)
 
-#define MAX_PAGE_REQUESTS 8
-// keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-#define MAX_BITMAPS_CACHED 64
+// number of queued requests after which the least important ones are dropped
+#define MAX_PAGE_REQUESTS 64
+// upper limit for the number of rendering threads (there's one per
+// processor, minus one for the UI thread)
+#define MAX_RENDER_THREADS 4
+// without an explicit limit, the cache holds this many screen-sized bitmaps ...
+#define BITMAPS_CACHED_SCREENS 16
+// ... but uses at least MIN_BITMAPS_MEMORY and at most MAX_BITMAPS_MEMORY bytes
+#define MIN_BITMAPS_MEMORY (32 * 1024 * 1024)
+#ifdef _WIN64
+#define MAX_BITMAPS_MEMORY (1024 * 1024 * 1024)
+#else
+#define MAX_BITMAPS_MEMORY (256 * 1024 * 1024)
+#endif
+// at most this many tiles are requested per page when prefetching
+#define MAX_PREFETCH_TILES 8
+// prefetch requests not rendered within this many ms are dropped
+// (the view will have scrolled past them by then)
+#define PREFETCH_TIMEOUT 500
+// the base layer of a page has at most 1/BASE_LAYER_SCALE as many pixels as a screen
+#define BASE_LAYER_SCALE 4
+// renderings which are at least this far along aren't aborted when their page
+// is scrolled out of view (e.g. because of scroll jitter)
+#define ALMOST_DONE_PROGRESS 0.8f
 
 class RenderingCallback {
   public:
@@ -17,60 +36,31 @@ class RenderingCallback {
     }
 };
 
-/* A page is split into tiles of at most TILE_MAX_W x TILE_MAX_H pixels.
-   A given tile starts at (col / 2^res * page_width, row / 2^res * page_height). */
-struct TilePosition {
-    USHORT res, row, col;
-
-    explicit TilePosition(USHORT res = INVALID_TILE_RES, USHORT row = -1, USHORT col = -1)
-        : res(res), row(row), col(col) {
-    }
-    bool operator==(const TilePosition& other) const {
-        return res == other.res && row == other.row && col == other.col;
-    }
-};
-
-/* We keep a cache of rendered bitmaps. BitmapCacheEntry keeps data
-   that uniquely identifies rendered page (dm, pageNo, rotation, zoom)
-   and the corresponding rendered bitmap. */
-struct BitmapCacheEntry {
-    DisplayModel* dm;
-    int pageNo;
-    int rotation;
-    float zoom;
-    TilePosition tile;
-
-    // owned by the BitmapCacheEntry
-    RenderedBitmap* bitmap;
-    bool outOfDate;
-    int refs;
-
-    BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile, RenderedBitmap* bitmap)
-        : dm(dm),
-          pageNo(pageNo),
-          rotation(rotation),
-          zoom(zoom),
-          tile(tile),
-          bitmap(bitmap),
-          outOfDate(false),
-          refs(1) {
-    }
-    ~BitmapCacheEntry() {
-        delete bitmap;
-    }
+/* Requests are rendered in order of priority (and the most recent
+   request first within the same priority) */
+enum class RenderPriority {
+    // tiles currently visible on screen (or explicitly requested bitmaps)
+    Visible,
+    // pages next to the visible ones (cf. DisplayModel::PageVisibleNearby)
+    Nearby,
+    // pages which might become visible soon
+    Prefetch,
 };
 
-/* Even though this looks a lot like a BitmapCacheEntry, we keep it
+/* Even though this looks a lot like a TileCacheEntry, we keep it
    separate for clarity in the code (PageRenderRequests are reused,
-   while BitmapCacheEntries are ref-counted) */
+   while TileCacheEntries are ref-counted) */
 struct PageRenderRequest {
     DisplayModel* dm;
     int pageNo;
     int rotation;
     float zoom;
     TilePosition tile;
+    RenderPriority priority;
 
     RectD pageRect; // calculated from TilePosition
+    // a low resolution rendering of the whole page (cf. RenderCache::RequestBaseLayer)
+    bool isBaseLayer;
     bool abort;
     AbortCookie* abortCookie;
     DWORD timestamp;
@@ -79,19 +69,30 @@ struct PageRenderRequest {
     RenderingCallback* renderCb;
 };
 
-class RenderCache {
-  private:
-    BitmapCacheEntry* cache[MAX_BITMAPS_CACHED];
-    int cacheCount;
-    // make sure to never ask for requestAccess in a cacheAccess
-    // protected critical section in order to avoid deadlocks
-    CRITICAL_SECTION cacheAccess;
-
-    PageRenderRequest requests[MAX_PAGE_REQUESTS];
-    int requestCount;
+class RenderCache;
+
+/* state of one of the rendering threads */
+struct RenderWorker {
+    RenderCache* cache;
+    Thread thread;
+    // the request currently being rendered by this thread (or nullptr)
     PageRenderRequest* curReq;
-    CRITICAL_SECTION requestAccess;
-    HANDLE renderThread;
+};
+
+// the rendered tiles are kept in a TileCache, for which RenderCache
+// decides which ones to evict first (cf. TileCachePolicy)
+class RenderCache : public TileCachePolicy {
+  private:
+    // entries are owned by DisplayModels. Make sure to never ask for
+    // requestAccess while holding cache.access in order to avoid deadlocks
+    TileCache cache;
+
+    // requests are appended at the end (see GetNextRequest for the order
+    // in which they're processed)
+    Vec<PageRenderRequest> requests;
+    Mutex requestAccess;
+    RenderWorker workers[MAX_RENDER_THREADS];
+    int workerCount;
 
     SizeI maxTileSize;
     bool isRemoteSession;
@@ -104,51 +105,66 @@ class RenderCache {
     ~RenderCache();
 
     void RequestRendering(DisplayModel* dm, int pageNo);
+    // renders the tiles of a page intersecting area (in screen coordinates)
+    // with low priority, as they're expected to become visible soon
+    void Prefetch(DisplayModel* dm, int pageNo, RectI area);
     void Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectD pageRect, RenderingCallback& callback);
     void CancelRendering(DisplayModel* dm);
     bool Exists(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM, TilePosition* tile = nullptr);
     void FreeForDisplayModel(DisplayModel* dm) {
-        FreePage(dm);
+        cache.FreePage(dm);
     }
     void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm);
     void Invalidate(DisplayModel* dm, int pageNo, RectD rect);
+    // limits the memory used for cached bitmaps to sizeInMB (or to a limit
+    // based on the screen size, if sizeInMB isn't positive)
+    void SetMaxMemory(int sizeInMB);
     // returns how much time in ms has past since the most recent rendering
     // request for the visible part of the page if nothing at all could be
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     UINT Paint(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue);
 
   protected:
-    /* Interface for page rendering thread */
-    HANDLE startRendering;
+    /* Interface for page rendering threads */
+    // set while there are queued requests
+    Event startRendering;
 
-    bool ClearCurrentRequest();
-    bool GetNextRequest(PageRenderRequest* req);
+    void ClearCurrentRequest(RenderWorker* worker);
+    bool GetNextRequest(RenderWorker* worker, PageRenderRequest* req);
     void Add(PageRenderRequest& req, RenderedBitmap* bitmap);
 
   private:
     USHORT GetTileRes(DisplayModel* dm, int pageNo);
-    USHORT GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation);
+    void GetTilesInArea(DisplayModel* dm, int pageNo, USHORT res, RectI area, Vec<TilePosition>& tiles);
     bool ReduceTileSize();
 
     bool IsRenderQueueFull() const {
-        return requestCount == MAX_PAGE_REQUESTS;
+        return requests.size() >= MAX_PAGE_REQUESTS;
     }
     UINT GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile);
-    void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage = true);
-    bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
-                RectD* pageRect = nullptr, RenderingCallback* callback = nullptr);
+    void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, RenderPriority priority,
+                          bool clearQueueForPage = true);
+    float GetBaseLayerZoom(DisplayModel* dm, int pageNo);
+    void RequestBaseLayer(DisplayModel* dm, int pageNo);
+    bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RenderPriority priority,
+                TilePosition* tile = nullptr, RectD* pageRect = nullptr, RenderingCallback* callback = nullptr);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = INVALID_PAGE_NO, TilePosition* tile = nullptr);
-    void AbortCurrentRequest();
-
-    static DWORD WINAPI RenderCacheThread(LPVOID data);
-
-    BitmapCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM,
-                           TilePosition* tile = nullptr);
-    bool DropCacheEntry(BitmapCacheEntry* entry);
-    void FreePage(DisplayModel* dm = nullptr, int pageNo = -1, TilePosition* tile = nullptr);
-    void FreeNotVisible() {
-        FreePage();
-    }
+    void AbortCurrentRequests(DisplayModel* dm = nullptr, int pageNo = INVALID_PAGE_NO);
+    void AbortStaleRequest();
+    bool IsRendering(DisplayModel* dm);
+    bool IsRendering(EngineBase* engine);
+
+    static void RenderCacheThread(void* data);
+
+    TileCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM,
+                         TilePosition* tile = nullptr);
+    RenderedBitmap* Decompress(PageRenderRequest& req);
+
+    // TileCachePolicy
+    bool IsNearby(TileCacheEntry* entry) override;
+    bool IsVisible(TileCacheEntry* entry) override;
+    void Evicted(TileCacheEntry* entry) override;
+    void* GetDocument(void* owner) override;
 
     UINT PaintTile(HDC hdc, RectI bounds, DisplayModel* dm, int pageNo, TilePosition tile, RectI tileOnScreen,
                    bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement);
@@ -47,6 +47,13 @@ WStrVec gDdeOpenOnStartup;
 
 NotificationGroupId NG_FIND_PROGRESS = "findProgress";
 
+// "Find all" passes its matches to the UI thread in batches of FIND_ALL_BATCH_SIZE
+// matches and waits while FIND_ALL_MAX_PENDING_BATCHES batches haven't been merged
+#define FIND_ALL_BATCH_SIZE 256
+#define FIND_ALL_MAX_PENDING_BATCHES 4
+// only this many rectangles are kept for highlighting (about 5 MB)
+#define FIND_ALL_MAX_RECTS (1 << 18)
+
 // don't show the Search UI for document types that don't
 // support extracting text and/or navigating to a specific
 // text selection; default to showing it, since most users
@@ -362,6 +369,198 @@ void FindTextOnThread(WindowInfo* win, TextSearchDirection direction, bool showP
     ftd->thread = win->findThread; // safe because only accesssed on ui thread
 }
 
+struct FindAllThreadData : public ProgressUpdateUI {
+    WindowInfo* win;
+    AutoFreeWstr text;
+    bool matchCase;
+    // owned by the tab, only compare it to the tab's current result
+    // (the tab might have been closed before a batch is merged)
+    FindAllResult* result;
+    // owned by win->notifications
+    NotificationWnd* wnd = nullptr;
+    HANDLE thread = nullptr;
+    // batches posted to the UI thread which haven't been merged yet
+    LONG volatile pendingBatches = 0;
+    int lastProgressPage = 0;
+
+    FindAllThreadData(WindowInfo* win, const WCHAR* text, bool matchCase, FindAllResult* result)
+        : win(win), text(str::Dup(text)), matchCase(matchCase), result(result) {
+    }
+    ~FindAllThreadData() {
+        CloseHandle(thread);
+    }
+
+    void ShowUI() {
+        auto notificationsInCb = this->win->notifications;
+        wnd = new NotificationWnd(win->hwndCanvas, 0);
+        wnd->wndRemovedCb = [notificationsInCb](NotificationWnd* wnd) {
+            notificationsInCb->RemoveNotification(wnd);
+        };
+        wnd->Create(L"", _TR("Searching %d of %d..."));
+        win->notifications->Add(wnd, NG_FIND_PROGRESS);
+    }
+
+    void HideUI(bool canceled) {
+        if (!win->notifications->Contains(wnd)) {
+            /* our notification has been replaced or closed */;
+        } else if (canceled) {
+            win->notifications->RemoveNotification(wnd);
+        } else if (0 == result->count) {
+            wnd->UpdateMessage(_TR("No matches were found"), 3000);
+        } else {
+            AutoFreeWstr buf(str::Format(_TR("Found %d matches"), result->count));
+            wnd->UpdateMessage(buf, 3000);
+        }
+    }
+
+    // only to be called on the UI thread
+    bool IsCurrent() {
+        if (!WindowInfoStillValid(win) || win->findThread != thread) {
+            return false;
+        }
+        return win->currentTab && win->currentTab->findAll == result;
+    }
+
+    // called on the find thread for every batch of matches
+    bool PostHits(TextSearchHits* hits) {
+        // don't let a search with very many matches get ahead of the UI thread
+        while (pendingBatches >= FIND_ALL_MAX_PENDING_BATCHES && !WasCanceled()) {
+            Sleep(1);
+        }
+        if (WasCanceled()) {
+            delete hits;
+            return false;
+        }
+        InterlockedIncrement(&pendingBatches);
+        FindAllThreadData* fad = this;
+        uitask::Post([=] { FindAllHitsTask(fad, hits); });
+        return true;
+    }
+
+    static void FindAllHitsTask(FindAllThreadData* fad, TextSearchHits* hits) {
+        InterlockedDecrement(&fad->pendingBatches);
+        if (fad->IsCurrent() && fad->win->AsFixed()) {
+            FindAllResult* res = fad->result;
+            res->count += (int)hits->hits.size();
+            res->pages.Append(hits->pages.LendData(), hits->pages.size());
+            res->rects.Append(hits->rects.LendData(), hits->rects.size());
+            DisplayModel* dm = fad->win->AsFixed();
+            for (int pageNo : hits->pages) {
+                if (dm->PageVisible(pageNo)) {
+                    fad->win->RepaintAsync();
+                    break;
+                }
+            }
+        }
+        delete hits;
+    }
+
+    virtual void UpdateProgress(int current, int total) {
+        // FindNext reports the page of every match, so skip repeats
+        if (current == lastProgressPage || WasCanceled()) {
+            return;
+        }
+        lastProgressPage = current;
+        WindowInfo* win = this->win;
+        NotificationWnd* wnd = this->wnd;
+        uitask::Post([=] { UpdateFindStatusTask(win, wnd, current, total); });
+    }
+
+    virtual bool WasCanceled() {
+        return !WindowInfoStillValid(win) || win->findCanceled;
+    }
+};
+
+static void FindAllEndTask(FindAllThreadData* fad, bool canceled) {
+    WindowInfo* win = fad->win;
+    if (WindowInfoStillValid(win) && win->findThread == fad->thread) {
+        // the result is gone if the document has been closed or reloaded in the meantime
+        fad->HideUI(canceled || !fad->IsCurrent());
+        win->findThread = nullptr;
+    }
+    delete fad;
+}
+
+static DWORD WINAPI FindAllThread(LPVOID data) {
+    FindAllThreadData* fad = (FindAllThreadData*)data;
+    AssertCrash(fad && fad->win && fad->win->ctrl && fad->win->ctrl->AsFixed());
+    WindowInfo* win = fad->win;
+    DisplayModel* dm = win->AsFixed();
+
+    // use a separate TextSearch so that dm->textSearch's
+    // Find Next continues from where it left off
+    TextSearch search(dm->GetEngine(), dm->textCache, dm->textIndex);
+    search.SetSensitive(fad->matchCase);
+    auto onHits = [fad](TextSearchHits* hits) { return fad->PostHits(hits); };
+    search.FindAll(fad->text, onHits, FIND_ALL_BATCH_SIZE, FIND_ALL_MAX_RECTS, fad);
+
+    bool canceled = fad->WasCanceled();
+    uitask::Post([=] { FindAllEndTask(fad, canceled); });
+    return 0;
+}
+
+// highlights all matches of the find box's text in the current document,
+// merging them in batches as they're found on a separate thread
+void OnMenuFindAll(WindowInfo* win) {
+    if (!win->IsDocLoaded() || !NeedsFindUI(win))
+        return;
+    AutoFreeWstr text(win::GetText(win->hwndFindBox));
+    if (str::IsEmpty(text.Get())) {
+        OnMenuFind(win);
+        return;
+    }
+
+    AbortFinding(win, true);
+    ClearFindAllResult(win);
+
+    WORD state = (WORD)SendMessage(win->hwndToolbar, TB_GETSTATE, IDM_FIND_MATCH, 0);
+    bool matchCase = (state & TBSTATE_CHECKED) != 0;
+    win->currentTab->findAll = new FindAllResult();
+    FindAllThreadData* fad = new FindAllThreadData(win, text, matchCase, win->currentTab->findAll);
+
+    fad->ShowUI();
+    win->findThread = nullptr;
+    win->findThread = CreateThread(nullptr, 0, FindAllThread, fad, 0, 0);
+    fad->thread = win->findThread; // safe because only accesssed on ui thread
+}
+
+void ClearFindAllResult(WindowInfo* win) {
+    if (!win->currentTab || !win->currentTab->findAll) {
+        return;
+    }
+    delete win->currentTab->findAll;
+    win->currentTab->findAll = nullptr;
+    win->RepaintAsync();
+}
+
+void PaintFindAllResult(WindowInfo* win, HDC hdc) {
+    CrashIf(!win->AsFixed());
+    DisplayModel* dm = win->AsFixed();
+    FindAllResult* res = win->currentTab->findAll;
+    if (!res || res->pages.size() == 0) {
+        return;
+    }
+
+    // the rectangles are sorted by page, so only look at those of the visible pages
+    // (there might be too many matches in the whole document to go through on every paint)
+    Vec<RectI> rects;
+    int* pagesStart = res->pages.LendData();
+    int* pagesEnd = pagesStart + res->pages.size();
+    for (int pageNo = dm->FirstVisiblePageNo(); dm->ValidPageNo(pageNo); pageNo++) {
+        if (0.0 == dm->GetPageInfo(pageNo)->visibleRatio) {
+            break;
+        }
+        int* first = std::lower_bound(pagesStart, pagesEnd, pageNo);
+        int* last = std::upper_bound(first, pagesEnd, pageNo);
+        for (int* page = first; page < last; page++) {
+            RectI rect = res->rects.at(page - pagesStart);
+            rects.Append(dm->CvtToScreen(pageNo, rect.Convert<double>()));
+        }
+    }
+
+    PaintTransparentRectangles(hdc, win->canvasRc, rects, gGlobalPrefs->fixedPageUI.selectionColor, 0x3f, 0);
+}
+
 void PaintForwardSearchMark(WindowInfo* win, HDC hdc) {
     CrashIf(!win->AsFixed());
     DisplayModel* dm = win->AsFixed();
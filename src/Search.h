@@ -38,17 +38,31 @@ LRESULT OnCopyData(HWND hwnd, WPARAM wparam, LPARAM lparam);
 #define HIDE_FWDSRCHMARK_DECAYINTERVAL_IN_MS 100
 #define HIDE_FWDSRCHMARK_STEPS 5
 
+// the matches of the last "Find all" in a tab, which stay highlighted
+// until the document is closed or reloaded or Escape is pressed
+struct FindAllResult {
+    // number of matches found so far
+    int count = 0;
+    // the rectangles of the matches (in page coordinates) and their pages,
+    // in ascending page order (only up to a limit for very frequent terms)
+    Vec<int> pages;
+    Vec<RectI> rects;
+};
+
 bool NeedsFindUI(WindowInfo* win);
 void ClearSearchResult(WindowInfo* win);
 bool OnInverseSearch(WindowInfo* win, int x, int y);
 void ShowForwardSearchResult(WindowInfo* win, const WCHAR* fileName, UINT line, UINT col, UINT ret, UINT page,
                              Vec<RectI>& rects);
 void PaintForwardSearchMark(WindowInfo* win, HDC hdc);
+void PaintFindAllResult(WindowInfo* win, HDC hdc);
+void ClearFindAllResult(WindowInfo* win);
 void OnMenuFindPrev(WindowInfo* win);
 void OnMenuFindNext(WindowInfo* win);
 void OnMenuFind(WindowInfo* win);
 void OnMenuFindMatchCase(WindowInfo* win);
 void OnMenuFindSel(WindowInfo* win, TextSearchDirection direction);
+void OnMenuFindAll(WindowInfo* win);
 void AbortFinding(WindowInfo* win, bool hideMessage);
 void FindTextOnThread(WindowInfo* win, TextSearchDirection direction, bool showProgress);
 
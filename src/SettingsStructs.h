@@ -320,6 +320,9 @@ struct GlobalPrefs {
     // actual resolution of the main screen in DPI (if this value isn't
     // positive, the system's UI setting is used)
     int customScreenDPI;
+    // maximum amount of memory in MB used for caching rendered pages (if
+    // this value isn't positive, it's determined by the screen size)
+    int renderCacheSize;
     // if true, we store display settings for each document separately
     // (i.e. everything after UseDefaultState in FileStates)
     bool rememberStatePerDocument;
@@ -614,6 +617,7 @@ static const FieldInfo gGlobalPrefsFields[] = {
     {offsetof(GlobalPrefs, annotationDefaults), Type_Prerelease, (intptr_t)&gAnnotationDefaultsInfo},
     {offsetof(GlobalPrefs, defaultPasswords), Type_StringArray, 0},
     {offsetof(GlobalPrefs, customScreenDPI), Type_Int, 0},
+    {offsetof(GlobalPrefs, renderCacheSize), Type_Int, 0},
     {(size_t)-1, Type_Comment, 0},
     {offsetof(GlobalPrefs, rememberStatePerDocument), Type_Bool, true},
     {offsetof(GlobalPrefs, uiLanguage), Type_Utf8String, 0},
@@ -645,13 +649,13 @@ static const FieldInfo gGlobalPrefsFields[] = {
     {(size_t)-1, Type_Comment, (intptr_t) "Settings after this line have not been recognized by the current version"},
 };
 static const StructInfo gGlobalPrefsInfo = {
-    sizeof(GlobalPrefs), 54, gGlobalPrefsFields,
+    sizeof(GlobalPrefs), 55, gGlobalPrefsFields,
     "\0\0MainWindowBackground\0EscToExit\0ReuseInstance\0UseSysColors\0RestoreSession\0TabWidth\0\0FixedPageUI\0EbookUI"
     "\0ComicBookUI\0ChmUI\0ExternalViewers\0ShowMenubar\0ReloadModifiedDocuments\0FullPathInTitle\0ZoomLevels\0ZoomIncr"
-    "ement\0\0PrinterDefaults\0ForwardSearch\0AnnotationDefaults\0DefaultPasswords\0CustomScreenDPI\0\0RememberStatePer"
-    "Document\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0Versio"
-    "nToSkip\0RememberOpenedFiles\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0Window"
-    "State\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0ShowStartPage\0UseTabs\0\0FileStates\0SessionData\0ReopenOnce\0TimeOf"
-    "LastUpdateCheck\0OpenCountWeek\0\0"};
+    "ement\0\0PrinterDefaults\0ForwardSearch\0AnnotationDefaults\0DefaultPasswords\0CustomScreenDPI\0RenderCacheSize\0"
+    "\0RememberStatePerDocument\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0Check"
+    "ForUpdates\0VersionToSkip\0RememberOpenedFiles\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0D"
+    "efaultZoom\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0ShowStartPage\0UseTabs\0\0FileStates\0SessionData\0"
+    "ReopenOnce\0TimeOfLastUpdateCheck\0OpenCountWeek\0\0"};
 
 #endif
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/SyncUtil.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -25,6 +26,7 @@
 #include "ChmModel.h"
 #include "DisplayModel.h"
 #include "EbookController.h"
+#include "TileCache.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
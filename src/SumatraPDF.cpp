@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/SyncUtil.h"
 #include "utils/WinDynCalls.h"
 #include "utils/CryptoUtil.h"
 #include "utils/DirIter.h"
@@ -43,6 +44,7 @@
 #include "EbookController.h"
 #include "FileHistory.h"
 #include "PdfSync.h"
+#include "TileCache.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
@@ -668,11 +670,14 @@ class ControllerCallbackHandler : public ControllerCallback {
     void Repaint() override {
         win->RepaintAsync();
     }
+    void RepaintSharedViews(EngineBase* engine) override;
     void PageNoChanged(Controller* ctrl, int pageNo) override;
     void UpdateScrollbars(SizeI canvas) override;
     void RequestRendering(int pageNo) override;
+    void PrefetchRendering(int pageNo, RectI area) override;
     void CleanUp(DisplayModel* dm) override;
     void RenderThumbnail(DisplayModel* dm, SizeI size, const onBitmapRenderedCb&) override;
+    void PropertiesLoaded(Controller* ctrl) override;
     void GotoLink(PageDestination* dest) override {
         win->linkHandler->GotoLink(dest);
     }
@@ -680,6 +685,7 @@ class ControllerCallbackHandler : public ControllerCallback {
     void SaveDownload(const WCHAR* url, std::string_view data) override;
     void HandleLayoutedPages(EbookController* ctrl, EbookFormattingData* data) override;
     void RequestDelayedLayout(int delay) override;
+    void RequestPageSizesUpdate(int delay) override;
 };
 
 void ControllerCallbackHandler::RenderThumbnail(DisplayModel* dm, SizeI size, const onBitmapRenderedCb& saveThumbnail) {
@@ -750,6 +756,49 @@ void ControllerCallbackHandler::RequestRendering(int pageNo) {
     }
 }
 
+void ControllerCallbackHandler::PrefetchRendering(int pageNo, RectI area) {
+    CrashIf(!win->AsFixed());
+    if (!win->AsFixed()) {
+        return;
+    }
+
+    DisplayModel* dm = win->AsFixed();
+    if (dm->ShouldCacheRendering(pageNo)) {
+        gRenderCache.Prefetch(dm, pageNo, area);
+    }
+}
+
+void ControllerCallbackHandler::RepaintSharedViews(EngineBase* engine) {
+    // this is called from rendering threads, so gWindows may only be accessed
+    // from the UI thread (engine is only compared, as it might be gone by then)
+    uitask::Post([=] {
+        for (WindowInfo* w : gWindows) {
+            if (w->AsFixed() && w->AsFixed()->GetEngine() == engine) {
+                w->RepaintAsync();
+            }
+        }
+    });
+}
+
+// the ToC and page labels of progressively loaded documents only become available
+// once the whole file has been read (this is only called for the current tab)
+void ControllerCallbackHandler::PropertiesLoaded(Controller* ctrl) {
+    if (win->ctrl != ctrl) {
+        return;
+    }
+    TabInfo* tab = win->currentTab;
+    if (tab->showTocWhenLoaded && !win->presentation) {
+        ClearTocBox(win);
+        SetSidebarVisibility(win, true, gGlobalPrefs->showFavorites);
+    }
+    tab->showTocWhenLoaded = false;
+
+    ToggleWindowStyle(win->hwndPageBox, ES_NUMBER, !ctrl->HasPageLabels());
+    UpdateToolbarPageText(win, ctrl->PageCount());
+    AutoFreeWstr label(ctrl->GetPageLabel(ctrl->CurrentPageNo()));
+    win::SetText(win->hwndPageBox, label);
+}
+
 void ControllerCallbackHandler::CleanUp(DisplayModel* dm) {
     gRenderCache.CancelRendering(dm);
     gRenderCache.FreeForDisplayModel(dm);
@@ -782,6 +831,10 @@ void ControllerCallbackHandler::RequestDelayedLayout(int delay) {
     SetTimer(win->hwndCanvas, EBOOK_LAYOUT_TIMER_ID, delay, nullptr);
 }
 
+void ControllerCallbackHandler::RequestPageSizesUpdate(int delay) {
+    SetTimer(win->hwndCanvas, PAGE_SIZES_TIMER_ID, delay, nullptr);
+}
+
 void ControllerCallbackHandler::UpdateScrollbars(SizeI canvas) {
     CrashIf(!win->AsFixed());
     DisplayModel* dm = win->AsFixed();
@@ -862,7 +915,69 @@ void ControllerCallbackHandler::PageNoChanged(Controller* ctrl, int pageNo) {
     }
 }
 
-static Controller* CreateControllerForFile(const WCHAR* filePath, PasswordUI* pwdUI, WindowInfo* win) {
+// if the same version of a file is already open in another tab or window,
+// its engine (with the parsed document, its display lists and rendered tiles)
+// is shared instead of loading the file again. Engines with unsaved annotations
+// aren't shared, so that a new view doesn't start out with unsaved changes.
+static EngineBase* FindSharedEngine(const WCHAR* filePath, FILETIME fileTime) {
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            DisplayModel* dm = tab->AsFixed();
+            if (dm && !dm->userAnnotsModified && FileTimeEq(dm->fileTime, fileTime) &&
+                path::IsSame(dm->FilePath(), filePath)) {
+                return dm->GetEngine();
+            }
+        }
+    }
+    return nullptr;
+}
+
+// views sharing an engine also share its annotations (as the engine only holds one
+// set of them), so changes made in one view are copied to all the others
+static void UpdateSharedUserAnnots(DisplayModel* dm) {
+    EngineBase* engine = dm->GetEngine();
+    if (!engine->IsShared()) {
+        return;
+    }
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            DisplayModel* other = tab->AsFixed();
+            if (!other || other == dm || other->GetEngine() != engine) {
+                continue;
+            }
+            delete other->userAnnots;
+            other->userAnnots = dm->userAnnots ? new Vec<PageAnnotation>(*dm->userAnnots) : nullptr;
+            other->userAnnotsModified = dm->userAnnotsModified;
+        }
+    }
+    dm->RepaintSharedViews();
+}
+
+// gives a view which has just been created for a shared engine the
+// annotations of the other views (returns false if there are none)
+static bool CopySharedUserAnnots(DisplayModel* dm) {
+    EngineBase* engine = dm->GetEngine();
+    if (!engine->IsShared()) {
+        return false;
+    }
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            DisplayModel* other = tab->AsFixed();
+            if (other && other != dm && other->GetEngine() == engine) {
+                delete dm->userAnnots;
+                dm->userAnnots = other->userAnnots ? new Vec<PageAnnotation>(*other->userAnnots) : nullptr;
+                dm->userAnnotsModified = other->userAnnotsModified;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// set shareEngine to false when reloading a document, as the file might have
+// changed without its modification time changing (e.g. with coarse timestamps)
+static Controller* CreateControllerForFile(const WCHAR* filePath, PasswordUI* pwdUI, WindowInfo* win,
+                                           bool shareEngine = true) {
     logf(L"CreateControllerForFile: '%s'\n", filePath);
     if (!win->cbHandler) {
         win->cbHandler = new ControllerCallbackHandler(win);
@@ -872,12 +987,19 @@ static Controller* CreateControllerForFile(const WCHAR* filePath, PasswordUI* pw
 
     bool enableChmAndEbook = gGlobalPrefs->chmUI.useFixedPageUI;
     // enableChmAndEbook = true;
-    EngineBase* engine = EngineManager::CreateEngine(filePath, pwdUI, enableChmAndEbook, enableChmAndEbook);
+    FILETIME fileTime = file::GetModificationTime(filePath);
+    EngineBase* engine = shareEngine ? FindSharedEngine(filePath, fileTime) : nullptr;
+    if (engine) {
+        engine->AddRef();
+    } else {
+        engine = EngineManager::CreateEngine(filePath, pwdUI, enableChmAndEbook, enableChmAndEbook);
+    }
 
     if (engine) {
     LoadEngineInFixedPageUI:
         ctrl = new DisplayModel(engine, win->cbHandler);
         CrashIf(!ctrl || !ctrl->AsFixed() || ctrl->AsChm() || ctrl->AsEbook());
+        ctrl->AsFixed()->fileTime = fileTime;
     } else if (ChmModel::IsSupportedFile(filePath) && !gGlobalPrefs->chmUI.useFixedPageUI) {
         ChmModel* chmModel = ChmModel::Create(filePath, win->cbHandler);
         if (chmModel) {
@@ -1039,6 +1161,9 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
     ClearTocBox(win);
     delete win->linkOnLastButtonDown;
     win->linkOnLastButtonDown = nullptr;
+    // the matches of "Find all" were for the previously loaded document
+    delete tab->findAll;
+    tab->findAll = nullptr;
 
     AssertCrash(!win->IsAboutWindow() && win->IsDocLoaded() == (win->ctrl != nullptr));
     // TODO: https://code.google.com/p/sumatrapdf/issues/detail?id=1570
@@ -1057,10 +1182,12 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
                 gRenderCache.KeepForDisplayModel(prevCtrl->AsFixed(), dm);
                 dm->CopyNavHistory(*prevCtrl->AsFixed());
             }
-            // reload user annotations
-            dm->userAnnots = LoadFileModifications(args.fileName);
-            dm->userAnnotsModified = false;
-            dm->GetEngine()->UpdateUserAnnotations(dm->userAnnots);
+            // reload user annotations (unless another view shares the engine and has them already)
+            if (!CopySharedUserAnnots(dm)) {
+                dm->userAnnots = LoadFileModifications(args.fileName);
+                dm->userAnnotsModified = false;
+                dm->GetEngine()->UpdateUserAnnotations(dm->userAnnots);
+            }
             // tell UI Automation about content change
             if (win->uia_provider)
                 win->uia_provider->OnDocumentLoad(dm);
@@ -1150,6 +1277,9 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
     // AssertCrash(!win->IsDocLoaded() || !args.showWin || !win->canvasRc.IsEmpty() || win->AsChm());
 
     SetSidebarVisibility(win, showToc, gGlobalPrefs->showFavorites);
+    // the ToC of progressively loaded documents isn't available yet
+    // (cf. ControllerCallbackHandler::PropertiesLoaded)
+    tab->showTocWhenLoaded = showToc && win->AsFixed() && win->AsFixed()->IsLoadingProperties();
     // restore scroll state after the canvas size has been restored
     if ((args.showWin || ss.page != 1) && win->AsFixed()) {
         win->AsFixed()->SetScrollState(ss);
@@ -1190,7 +1320,7 @@ void ReloadDocument(WindowInfo* win, bool autorefresh) {
     }
 
     HwndPasswordUI pwdUI(win->hwndFrame);
-    Controller* ctrl = CreateControllerForFile(tab->filePath, &pwdUI, win);
+    Controller* ctrl = CreateControllerForFile(tab->filePath, &pwdUI, win, false);
     // We don't allow PDF-repair if it is an autorefresh because
     // a refresh event can occur before the file is finished being written,
     // in which case the repair could fail. Instead, if the file is broken,
@@ -1706,6 +1836,9 @@ void LoadModelIntoTab(WindowInfo* win, TabInfo* tdata) {
         dm->SetScrollState(dm->GetScrollState());
         if (dm->GetPresentationMode() != (win->presentation != PM_DISABLED))
             dm->SetPresentationMode(!dm->GetPresentationMode());
+        // apply the page sizes and properties the engine has determined while the tab wasn't shown
+        if (dm->HasProvisionalPageSizes() || dm->IsLoadingProperties())
+            dm->UpdateProvisionalPageSizes();
     } else if (win->AsChm()) {
         win->ctrl->GoToPage(win->ctrl->CurrentPageNo(), false);
     } else if (win->AsEbook()) {
@@ -2191,6 +2324,8 @@ static void CloseDocumentInTab(WindowInfo* win, bool keepUIEnabled, bool deleteM
     if (deleteModel) {
         delete currentTab->ctrl;
         currentTab->ctrl = nullptr;
+        delete currentTab->findAll;
+        currentTab->findAll = nullptr;
         FileWatcherUnsubscribe(win->currentTab->watcher);
         win->currentTab->watcher = nullptr;
     } else {
@@ -2570,8 +2705,10 @@ static void OnMenuSaveAs(WindowInfo* win) {
         if (!gGlobalPrefs->annotationDefaults.saveIntoDocument || !engine || !engine->SupportsAnnotation(true)) {
             ok = SaveFileModifications(realDstFileName, win->AsFixed()->userAnnots);
         }
-        if (ok && path::IsSame(srcFileName, realDstFileName))
+        if (ok && path::IsSame(srcFileName, realDstFileName)) {
             win->AsFixed()->userAnnotsModified = false;
+            UpdateSharedUserAnnots(win->AsFixed());
+        }
     }
     if (!ok) {
         MessageBoxWarning(win->hwndFrame, errorMsg ? errorMsg.get() : _TR("Failed to save a file"));
@@ -3140,6 +3277,7 @@ static void OnMenuOptions(HWND hwnd) {
         gFileHistory.Clear(true);
         CleanUpThumbnailCache(gFileHistory);
     }
+    EnableMetadataCache(gGlobalPrefs->rememberOpenedFiles);
     UpdateDocumentColors();
 
     // note: ideally we would also update state for useTabs changes but that's complicated since
@@ -3586,6 +3724,10 @@ static void OnFrameKeyEsc(WindowInfo* win) {
         ClearSearchResult(win);
         return;
     }
+    if (win->currentTab && win->currentTab->findAll) {
+        ClearFindAllResult(win);
+        return;
+    }
     if (gGlobalPrefs->escToExit && MayCloseWindow(win)) {
         CloseWindow(win, true);
         return;
@@ -3681,6 +3823,7 @@ static void OnFrameKeyA(WindowInfo* win) {
     }
     dm->userAnnotsModified = true;
     dm->GetEngine()->UpdateUserAnnotations(dm->userAnnots);
+    UpdateSharedUserAnnots(dm);
     ClearSearchResult(win); // causes invalidated tiles to be rerendered
 }
 
@@ -4238,6 +4381,10 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wPara
             OnMenuFindSel(win, TextSearchDirection::Backward);
             break;
 
+        case IDM_FIND_ALL:
+            OnMenuFindAll(win);
+            break;
+
         case IDM_VISIT_WEBSITE:
             LaunchBrowser(WEBSITE_MAIN_URL);
             break;
@@ -4350,6 +4497,15 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wPara
             DownloadDebugSymbols();
             break;
 
+        case IDM_DEBUG_RENDER_STATS: {
+            AutoFree stats(DumpRenderStats());
+            log(stats.Get());
+            AutoFreeWstr statsW(strconv::Utf8ToWchar(stats.Get()));
+            CopyTextToClipboard(statsW);
+            win->ShowNotification(L"Render stats copied to clipboard");
+            break;
+        }
+
         case IDM_DEBUG_MUI:
             mui::SetDebugPaint(!mui::IsDebugPaint());
             win::menu::SetChecked(GetMenu(win->hwndFrame), IDM_DEBUG_MUI, !mui::IsDebugPaint());
@@ -28,6 +28,8 @@
 
 #define EBOOK_LAYOUT_TIMER_ID 7
 
+#define PAGE_SIZES_TIMER_ID 8
+
 // permissions that can be revoked through sumatrapdfrestrict.ini or the -restrict command line flag
 enum {
     // enables Update checks, crash report submitting and hyperlinks
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/SyncUtil.h"
 #include "utils/WinDynCalls.h"
 #include "utils/CmdLineParser.h"
 #include "utils/DbgHelpDyn.h"
@@ -35,6 +36,7 @@
 #include "FileHistory.h"
 #include "GlobalPrefs.h"
 #include "PdfSync.h"
+#include "TileCache.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
@@ -856,8 +858,12 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     }
 
     gCrashOnOpen = i.crashOnOpen;
+    // the log is a file of the user's choosing, which restricted mode doesn't allow
+    if (i.renderStatsLogPath && HasPermission(Perm_DiskAccess))
+        LogRenderStatsToFile(i.renderStatsLogPath);
 
     GetFixedPageUiColors(gRenderCache.textColor, gRenderCache.backgroundColor);
+    gRenderCache.SetMaxMemory(gGlobalPrefs->renderCacheSize);
 
     gIsStartup = true;
     if (!RegisterWinClass()) {
@@ -875,6 +881,8 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         }
     }
 
+    EnableMetadataCache(HasPermission(Perm_SavePreferences | Perm_DiskAccess) && gGlobalPrefs->rememberOpenedFiles);
+
     if (i.printerName) {
         // note: this prints all PDF files. Another option would be to
         // print only the first one
@@ -1050,6 +1058,8 @@ Exit:
     while (gWindows.size() > 0) {
         DeleteWindowInfo(gWindows.at(0));
     }
+    // also before a fast exit, so that the log is complete
+    CloseRenderStatsLog();
 
     if (fastExit) {
         // leave all the remaining clean-up to the OS
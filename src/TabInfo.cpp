@@ -22,6 +22,9 @@
 #include "TabInfo.h"
 #include "AppUtil.h"
 #include "Selection.h"
+#include "TextSelection.h"
+#include "TextSearch.h"
+#include "Search.h"
 #include "Translations.h"
 #include "ParseBKM.h"
 
@@ -39,6 +42,7 @@ TabInfo::~TabInfo() {
         delete altBookmarks;
     }
     delete selectionOnPage;
+    delete findAll;
     delete ctrl;
 }
 
@@ -2,6 +2,7 @@
    License: GPLv3 */
 
 struct SelectionOnPage;
+struct FindAllResult;
 struct WatchedFile;
 struct Bookmarks;
 
@@ -17,6 +18,8 @@ class TabInfo {
     // state of the table of contents
     bool showToc = false;
     bool showTocPresentation = false;
+    // whether to show the ToC once the engine has loaded it in the background
+    bool showTocWhenLoaded = false;
     // an array of ids for ToC items that have been expanded/collapsed by user
     Vec<int> tocState;
     // canvas dimensions when the document was last visible
@@ -28,6 +31,8 @@ class TabInfo {
     // list of rectangles of the last rectangular, text or image selection
     // (split by page, in user coordinates)
     Vec<SelectionOnPage>* selectionOnPage = nullptr;
+    // matches of the last "Find all" (cf. OnMenuFindAll)
+    FindAllResult* findAll = nullptr;
     // previous View settings, needed when unchecking the Fit Width/Page toolbar buttons
     float prevZoomVirtual = INVALID_ZOOM;
     DisplayMode prevDisplayMode = DM_AUTOMATIC;
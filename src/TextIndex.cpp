@@ -0,0 +1,367 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
+
+#include "TreeModel.h"
+#include "EngineBase.h"
+#include "TextSelection.h"
+#include "TextIndex.h"
+
+// minimal number of signature bits per distinct trigram of a page. As two bits
+// are set per trigram, at most one in 20 trigrams not on a page still matches
+#define SIG_BITS_PER_TRIGRAM 8
+#define SIG_MIN_BITS 64
+
+// the indexes of documents which take at least this long (in ms) to index are cached on disk
+#define MIN_CACHE_INDEXING_TIME 1000
+#define TEXT_INDEX_CACHE_EXT L".textindex"
+#define TEXT_INDEX_CACHE_MAGIC 0x49545053 /* 'SPTI' */
+// increase when changing the layout of the cache files or how signatures are computed
+#define TEXT_INDEX_CACHE_VERSION 1
+
+// a cache file starts with this header, followed by the signature sizes of all pages
+// (padded to a multiple of 8 bytes), the signatures of all pages and the MD5 digest
+// of all preceding data (so that incompletely written files are detected)
+struct TextIndexCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    unsigned char fingerprint[16];
+    uint32_t pageCount;
+    uint32_t reserved;
+};
+
+static WCHAR* gCacheDir = nullptr;
+
+void SetTextIndexCacheDir(const WCHAR* dir) {
+    str::ReplacePtr(&gCacheDir, dir);
+}
+
+// the indexes of all engines currently shown (only accessed on the UI thread)
+static Vec<TextIndex*> gTextIndexes;
+
+class TextIndexThread : public ThreadBase {
+    TextIndex* index;
+
+  public:
+    explicit TextIndexThread(TextIndex* index) : ThreadBase("TextIndexThread"), index(index) {
+    }
+    ~TextIndexThread() override {
+    }
+
+    void Run() override;
+};
+
+void TextIndexThread::Run() {
+    // indexing shouldn't slow down rendering or searching
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+    if (!index->LoadCache()) {
+        // the text is extracted from a clone of the engine, so that indexing doesn't
+        // block rendering or push the viewed pages out of the engine's caches
+        // (clones reload the file by name, so they mustn't be used once it has changed)
+        EngineBase* clone = nullptr;
+        if (index->engine->IsFileUnchanged()) {
+            clone = index->engine->Clone();
+        }
+        if (clone && !clone->IsSameFileVersion(index->engine)) {
+            delete clone;
+            clone = nullptr;
+        }
+        // without a clone (e.g. for documents loaded from a stream), no pages are
+        // indexed and all of them are always searched
+        DWORD start = GetTickCount();
+        for (int pageNo = 1; clone && pageNo <= index->pageCount && !WasCancelRequested(); pageNo++) {
+            AutoFreeWstr text(clone->ExtractPageText(pageNo));
+            index->IndexPage(pageNo, text);
+        }
+        if (clone && !WasCancelRequested() && GetTickCount() - start >= MIN_CACHE_INDEXING_TIME) {
+            index->SaveCache();
+        }
+        delete clone;
+    }
+    // index might be deleted right after this
+    index->ThreadDone();
+}
+
+TextIndex::TextIndex(EngineBase* engine) : engine(engine) {
+    engine->AddRef();
+    pageCount = engine->PageCount();
+    sigs = AllocArray<uint64_t*>(pageCount);
+    sigBits = AllocArray<int>(pageCount);
+    InitializeCriticalSection(&access);
+}
+
+TextIndex::~TextIndex() {
+    if (thread) {
+        // the thread is done or about to be (cf. Release)
+        thread->RequestCancel();
+        thread->Join();
+        delete thread;
+    }
+
+    for (int i = 0; i < pageCount; i++) {
+        if (!IsCached(sigs[i])) {
+            free(sigs[i]);
+        }
+    }
+    free(sigs);
+    free(sigBits);
+    delete cacheFile;
+    free(cachePath);
+    DeleteCriticalSection(&access);
+    engine->Release();
+}
+
+TextIndex* TextIndex::GetForEngine(EngineBase* engine) {
+    for (TextIndex* index : gTextIndexes) {
+        if (index->engine == engine) {
+            index->refCount++;
+            return index;
+        }
+    }
+    TextIndex* index = new TextIndex(engine);
+    // don't store anything about the content of encrypted documents
+    if (!engine->IsPasswordProtected()) {
+        index->SetCacheFile(engine->FileName());
+    }
+    index->StartBuilding();
+    gTextIndexes.Append(index);
+    return index;
+}
+
+void TextIndex::Release() {
+    if (--refCount > 0) {
+        return;
+    }
+    gTextIndexes.Remove(this);
+    {
+        ScopedCritSec scope(&access);
+        if (threadRunning) {
+            // closing a document mustn't wait for the page being indexed
+            deleteWhenDone = true;
+            thread->RequestCancel();
+            return;
+        }
+    }
+    delete this;
+}
+
+void TextIndex::StartBuilding() {
+    if (thread) {
+        return;
+    }
+    threadRunning = true;
+    thread = new TextIndexThread(this);
+    thread->Start();
+}
+
+void TextIndex::ThreadDone() {
+    bool deleteIndex;
+    {
+        ScopedCritSec scope(&access);
+        threadRunning = false;
+        deleteIndex = deleteWhenDone;
+    }
+    if (deleteIndex) {
+        uitask::Post([=] { delete this; });
+    }
+}
+
+static uint64_t TrigramHash(const WCHAR* s) {
+    uint64_t h = ((uint64_t)s[0] << 32) | ((uint64_t)s[1] << 16) | (uint64_t)s[2];
+    // mix the bits (cf. splitmix64), as both halves of the hash are used
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+static bool SigHas(uint64_t* sig, int bits, uint64_t hash) {
+    uint64_t bit1 = hash & (bits - 1);
+    uint64_t bit2 = (hash >> 32) & (bits - 1);
+    return (sig[bit1 / 64] & (1ULL << (bit1 % 64))) && (sig[bit2 / 64] & (1ULL << (bit2 % 64)));
+}
+
+// collects the hashes of all trigrams of text, case folded the same way as by TextSearch::MatchEnd
+static void GetTrigramHashes(const WCHAR* text, size_t len, std::vector<uint64_t>& hashes) {
+    if (len < 3) {
+        return;
+    }
+    AutoFreeWstr folded(str::DupN(text, len));
+    CharLowerBuffW(folded, (DWORD)len);
+    for (size_t i = 0; i + 2 < len; i++) {
+        hashes.push_back(TrigramHash(folded + i));
+    }
+}
+
+void TextIndex::IndexPage(int pageNo, const WCHAR* text) {
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    std::vector<uint64_t> hashes;
+    GetTrigramHashes(text, text ? str::Len(text) : 0, hashes);
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    int bits = SIG_MIN_BITS;
+    while ((size_t)bits < hashes.size() * SIG_BITS_PER_TRIGRAM) {
+        bits *= 2;
+    }
+    uint64_t* sig = AllocArray<uint64_t>(bits / 64);
+    for (uint64_t hash : hashes) {
+        uint64_t bit1 = hash & (bits - 1);
+        uint64_t bit2 = (hash >> 32) & (bits - 1);
+        sig[bit1 / 64] |= 1ULL << (bit1 % 64);
+        sig[bit2 / 64] |= 1ULL << (bit2 % 64);
+    }
+
+    ScopedCritSec scope(&access);
+    if (!sigs[pageNo - 1]) {
+        indexedCount++;
+    }
+    if (!IsCached(sigs[pageNo - 1])) {
+        free(sigs[pageNo - 1]);
+    }
+    sigs[pageNo - 1] = sig;
+    sigBits[pageNo - 1] = bits;
+}
+
+int TextIndex::MarkPagesToSkip(const WCHAR* text, std::vector<bool>& pagesToSkip) {
+    CrashIf(pagesToSkip.size() != (size_t)pageCount);
+    // TextSearch::MatchEnd matches the characters of the leading word consecutively
+    // and on the page where the match starts (while the rest of the text might be
+    // spread over several lines or pages), so that's the part the index can check
+    size_t len = 0;
+    while (isnoncjkwordchar(text[len])) {
+        len++;
+    }
+    std::vector<uint64_t> hashes;
+    GetTrigramHashes(text, len, hashes);
+
+    ScopedCritSec scope(&access);
+    if (hashes.empty()) {
+        return indexedCount;
+    }
+    for (int i = 0; i < pageCount; i++) {
+        if (!sigs[i] || pagesToSkip[i]) {
+            continue;
+        }
+        for (uint64_t hash : hashes) {
+            if (!SigHas(sigs[i], sigBits[i], hash)) {
+                pagesToSkip[i] = true;
+                break;
+            }
+        }
+    }
+    return indexedCount;
+}
+
+void TextIndex::SetCacheFile(const WCHAR* filePath) {
+    CrashIf(thread);
+    str::ReplacePtr(&cachePath, nullptr);
+    if (!gCacheDir || !filePath || !file::GetFingerprint(filePath, fingerprint)) {
+        return;
+    }
+    AutoFree hex(_MemToHex(&fingerprint));
+    AutoFreeWstr fname(strconv::FromAnsi(hex));
+    cachePath = str::Format(L"%s\\%s%s", gCacheDir, fname.Get(), TEXT_INDEX_CACHE_EXT);
+}
+
+bool TextIndex::IsCached(uint64_t* sig) const {
+    if (!cacheFile) {
+        return false;
+    }
+    const char* start = cacheFile->data.data();
+    return start <= (const char*)sig && (const char*)sig < start + cacheFile->data.size();
+}
+
+static size_t SigSizesLen(int pageCount) {
+    return ((size_t)pageCount * sizeof(uint32_t) + 7) & ~(size_t)7;
+}
+
+// the signatures are used right from the mapped file instead of being copied
+// (the index of a document with thousands of pages takes several MB)
+bool TextIndex::LoadCache() {
+    if (!cachePath) {
+        return false;
+    }
+    file::MappedFile* mf = file::Map(cachePath);
+    if (!mf) {
+        return false;
+    }
+
+    const char* data = mf->data.data();
+    size_t len = mf->data.size();
+    size_t sigsOffset = sizeof(TextIndexCacheHeader) + SigSizesLen(pageCount);
+    bool ok = len >= sigsOffset + 16;
+    if (ok) {
+        len -= 16;
+        unsigned char digest[16];
+        CalcMD5Digest((const unsigned char*)data, len, digest);
+        ok = memeq(digest, data + len, sizeof(digest));
+    }
+    if (ok) {
+        TextIndexCacheHeader* hdr = (TextIndexCacheHeader*)data;
+        ok = hdr->magic == TEXT_INDEX_CACHE_MAGIC && hdr->version == TEXT_INDEX_CACHE_VERSION &&
+             memeq(hdr->fingerprint, fingerprint, sizeof(fingerprint)) && hdr->pageCount == (uint32_t)pageCount;
+    }
+    const uint32_t* bits = (const uint32_t*)(data + sizeof(TextIndexCacheHeader));
+    size_t words = 0;
+    for (int i = 0; ok && i < pageCount; i++) {
+        ok = bits[i] >= SIG_MIN_BITS && (bits[i] & (bits[i] - 1)) == 0 && bits[i] / 64 <= (len - sigsOffset) / 8 - words;
+        words += bits[i] / 64;
+    }
+    if (!ok || sigsOffset + words * 8 != len) {
+        // the cache file is stale or corrupted and will be rebuilt
+        delete mf;
+        file::Delete(cachePath);
+        return false;
+    }
+
+    ScopedCritSec scope(&access);
+    CrashIf(indexedCount != 0 || cacheFile);
+    cacheFile = mf;
+    // the mapping is read-only, which is fine as signatures are never modified
+    uint64_t* sig = (uint64_t*)(data + sigsOffset);
+    for (int i = 0; i < pageCount; i++) {
+        sigs[i] = sig;
+        sigBits[i] = (int)bits[i];
+        sig += bits[i] / 64;
+    }
+    indexedCount = pageCount;
+    return true;
+}
+
+bool TextIndex::SaveCache() {
+    if (!cachePath) {
+        return false;
+    }
+
+    str::Str data;
+    {
+        ScopedCritSec scope(&access);
+        if (indexedCount < pageCount) {
+            return false;
+        }
+        TextIndexCacheHeader hdr = {TEXT_INDEX_CACHE_MAGIC, TEXT_INDEX_CACHE_VERSION};
+        memcpy(hdr.fingerprint, fingerprint, sizeof(fingerprint));
+        hdr.pageCount = (uint32_t)pageCount;
+        data.Append((const char*)&hdr, sizeof(hdr));
+        for (int i = 0; i < pageCount; i++) {
+            uint32_t bits = (uint32_t)sigBits[i];
+            data.Append((const char*)&bits, sizeof(bits));
+        }
+        data.AppendBlanks(SigSizesLen(pageCount) - (size_t)pageCount * sizeof(uint32_t));
+        for (int i = 0; i < pageCount; i++) {
+            data.Append((const char*)sigs[i], sigBits[i] / 8);
+        }
+    }
+    unsigned char digest[16];
+    CalcMD5Digest((const unsigned char*)data.Get(), data.size(), digest);
+    data.Append((const char*)digest, sizeof(digest));
+
+    AutoFreeWstr cacheDir(path::GetDir(cachePath));
+    return dir::Create(cacheDir) && file::WriteFile(cachePath, data.AsView());
+}
@@ -0,0 +1,82 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+class TextIndexThread;
+namespace file {
+class MappedFile;
+}
+
+// lets TextIndex keep the indexes of documents which take long to index in dir
+// (nullptr disables the cache). Note: only call this on the UI thread
+void SetTextIndexCacheDir(const WCHAR* dir);
+
+/* An index of the trigrams (three consecutive characters, case folded) found on
+   each page of a document, so that TextSearch can skip the pages which can't
+   contain the search text without extracting and scanning them.
+
+   For every page, the trigrams are stored in a bit signature (a Bloom filter),
+   which is much more compact than a list of positions or pages per trigram.
+   False positives only cost a scan of the page, so every page which might contain
+   the text is still searched the usual way.
+
+   The index is built page by page on a background thread and shared by all views
+   of the same engine. Pages which haven't been indexed yet are always searched.
+   Once the index is complete, it's saved to a cache file (named after the document's
+   path, size and modification time), which is memory mapped and used instead of
+   extracting all the text again when the same document is opened another time. */
+class TextIndex {
+    EngineBase* engine = nullptr;
+    int pageCount = 0;
+
+    // for every page, the bits of its signature (nullptr until it has been indexed)
+    uint64_t** sigs = nullptr;
+    // number of bits in the signature of a page (a power of 2)
+    int* sigBits = nullptr;
+    int indexedCount = 0;
+
+    TextIndexThread* thread = nullptr;
+    // number of views using this index (only accessed on the UI thread)
+    int refCount = 1;
+    // if the index is released while still being built, the thread has it
+    // deleted once it's done (both protected by access)
+    bool threadRunning = false;
+    bool deleteWhenDone = false;
+    friend class TextIndexThread;
+
+    // the cache file for this document (nullptr if it isn't cached)
+    WCHAR* cachePath = nullptr;
+    unsigned char fingerprint[16] = {0};
+    // the loaded cache file, into which the signatures of all pages point
+    file::MappedFile* cacheFile = nullptr;
+    bool IsCached(uint64_t* sig) const;
+
+    CRITICAL_SECTION access;
+
+    explicit TextIndex(EngineBase* engine);
+    ~TextIndex();
+
+    // indexes all pages on a background thread
+    void StartBuilding();
+    void ThreadDone();
+    // call before StartBuilding to reuse the index of filePath across sessions
+    void SetCacheFile(const WCHAR* filePath);
+
+  public:
+    // returns the index of engine (shared with all other views of it), which
+    // is built in the background. Note: only call this and Release on the UI thread
+    static TextIndex* GetForEngine(EngineBase* engine);
+    // doesn't wait for the background thread (which is canceled) to finish
+    void Release();
+
+    // both return false if there's no (valid) cache file
+    bool LoadCache();
+    bool SaveCache();
+
+    void IndexPage(int pageNo, const WCHAR* text);
+    int IndexedCount() const {
+        return indexedCount;
+    }
+    // marks the indexed pages which can't contain a match for text (as found by
+    // TextSearch) as pages to skip and returns the number of indexed pages
+    int MarkPagesToSkip(const WCHAR* text, std::vector<bool>& pagesToSkip);
+};
@@ -3,24 +3,24 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/StrFinder.h"
 
 #include "TreeModel.h"
 #include "EngineBase.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
+#include "TextIndex.h"
 #include "TextSearch.h"
 
 #define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
-// ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
-// cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
-#define isnoncjkwordchar(c) (isWordChar(c) && (unsigned short)(c) < 0x2E80)
 
 static void markAllPagesNonSkip(std::vector<bool>& pagesToSkip) {
     for (size_t i = 0; i < pagesToSkip.size(); i++) {
         pagesToSkip[i] = false;
     }
 }
-TextSearch::TextSearch(EngineBase* engine, PageTextCache* textCache) : TextSelection(engine, textCache) {
+TextSearch::TextSearch(EngineBase* engine, PageTextCache* textCache, TextIndex* textIndex)
+    : TextSelection(engine, textCache), textIndex(textIndex) {
     nPages = engine->PageCount();
     pagesToSkip.resize(nPages);
     markAllPagesNonSkip(pagesToSkip);
@@ -30,6 +30,15 @@ TextSearch::~TextSearch() {
     Clear();
 }
 
+void TextSearch::Clear() {
+    str::ReplacePtr(&findText, nullptr);
+    str::ReplacePtr(&anchor, nullptr);
+    str::ReplacePtr(&lastText, nullptr);
+    delete anchorFinder;
+    anchorFinder = nullptr;
+    Reset();
+}
+
 void TextSearch::Reset() {
     pageText = nullptr;
     TextSelection::Reset();
@@ -75,6 +84,7 @@ void TextSearch::SetText(const WCHAR* text) {
         this->findText[str::Len(this->findText) - 1] = '\0';
 
     markAllPagesNonSkip(pagesToSkip);
+    indexedPages = 0;
 }
 
 void TextSearch::SetSensitive(bool sensitive) {
@@ -82,8 +92,19 @@ void TextSearch::SetSensitive(bool sensitive) {
         return;
     }
     this->caseSensitive = sensitive;
+    delete anchorFinder;
+    anchorFinder = nullptr;
 
     markAllPagesNonSkip(pagesToSkip);
+    indexedPages = 0;
+}
+
+// the index is built in the background, so pages indexed since
+// the last search might be skippable now
+void TextSearch::UpdatePagesToSkip() {
+    if (textIndex && textIndex->IndexedCount() != indexedPages) {
+        indexedPages = textIndex->MarkPagesToSkip(findText, pagesToSkip);
+    }
 }
 
 void TextSearch::SetDirection(TextSearchDirection direction) {
@@ -134,7 +155,7 @@ TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
             return notFound;
         /* Going from page n to page n+1 is a space, too.*/
         lookingAtWs = (!*end && (currentPage < nPages)) || str::IsWs(*end);
-        if (caseSensitive ? *match == *end : CharLower((LPWSTR)LOWORD(*match)) == CharLower((LPWSTR)LOWORD(*end)))
+        if (caseSensitive ? *match == *end : StrFinder::ToLower(*match) == StrFinder::ToLower(*end))
             /* characters are identical */;
         else if (str::IsWs(*match) && lookingAtWs)
             /* treat all whitespace as identical and end of page as whitespace.
@@ -202,20 +223,20 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     // a findText = textCache->GetData(findPage) here.
     findPage = pageNo;
 
+    if (anchor && !anchorFinder) {
+        anchorFinder = new StrFinder(anchor, str::Len(anchor), !caseSensitive);
+    }
+    const WCHAR* pageEnd = pageText + str::Len(pageText);
+
     const WCHAR* found;
     PageAndOffset fg;
     do {
         if (!anchor) {
             found = GetNextIndex(pageText, findIndex, forward);
         } else if (forward) {
-            const WCHAR* s = pageText + findIndex;
-            if (caseSensitive) {
-                found = StrStr(s, anchor);
-            } else {
-                found = StrStrI(s, anchor);
-            }
+            found = anchorFinder->Find(pageText + findIndex, pageEnd);
         } else {
-            found = StrRStrI(pageText, pageText + findIndex, anchor);
+            found = anchorFinder->FindLast(pageText, pageText + findIndex, pageEnd);
         }
         if (!found)
             return false;
@@ -242,6 +263,8 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
 bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
     if (str::IsEmpty(findText))
         return false;
+    UpdatePagesToSkip();
+    textCache->ExtractInBackground(pageNo, forward ? nPages : 1, &pagesToSkip);
 
     int next = forward ? 1 : -1;
     while (1 <= pageNo && pageNo <= nPages && (!tracker || !tracker->WasCanceled())) {
@@ -320,3 +343,39 @@ TextSel* TextSearch::FindNext(ProgressUpdateUI* tracker) {
     }
     return nullptr;
 }
+
+int TextSearch::FindAll(const WCHAR* text, const TextSearchHitsCb& onHits, int batchSize, int maxRects,
+                        ProgressUpdateUI* tracker) {
+    SetDirection(TextSearchDirection::Forward);
+
+    int count = 0;
+    int rectCount = 0;
+    TextSearchHits* batch = new TextSearchHits();
+    for (TextSel* sel = FindFirst(1, text, tracker); sel; sel = FindNext(tracker)) {
+        TextSearchHit hit;
+        GetGlyphRange(&hit.startPage, &hit.startGlyph, &hit.endPage, &hit.endGlyph);
+        hit.firstRect = (int)batch->rects.size();
+        hit.rectCount = std::max(std::min(sel->len, maxRects - rectCount), 0);
+        batch->pages.Append(sel->pages, hit.rectCount);
+        batch->rects.Append(sel->rects, hit.rectCount);
+        batch->hits.Append(hit);
+        rectCount += hit.rectCount;
+        count++;
+
+        if ((int)batch->hits.size() >= batchSize) {
+            bool more = onHits(batch);
+            batch = nullptr;
+            if (!more) {
+                return count;
+            }
+            batch = new TextSearchHits();
+        }
+    }
+
+    if (batch->hits.size() > 0) {
+        onHits(batch);
+    } else {
+        delete batch;
+    }
+    return count;
+}
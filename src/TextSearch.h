@@ -3,9 +3,31 @@
 
 enum class TextSearchDirection : bool { Backward = false, Forward = true };
 
+class TextIndex;
+class StrFinder;
+
+// a match found by TextSearch::FindAll, whose rectangles are
+// rects[firstRect] to rects[firstRect + rectCount - 1] of its batch
+struct TextSearchHit {
+    int startPage, startGlyph;
+    int endPage, endGlyph;
+    int firstRect, rectCount;
+};
+
+// a batch of matches found by TextSearch::FindAll, in document order
+struct TextSearchHits {
+    Vec<TextSearchHit> hits;
+    // the rectangles of all matches (in page coordinates) and their pages
+    Vec<int> pages;
+    Vec<RectI> rects;
+};
+
+// receives (and owns) the next batch of matches, returns false to stop the search
+typedef std::function<bool(TextSearchHits*)> TextSearchHitsCb;
+
 class TextSearch : public TextSelection {
   public:
-    TextSearch(EngineBase* engine, PageTextCache* textCache);
+    TextSearch(EngineBase* engine, PageTextCache* textCache, TextIndex* textIndex = nullptr);
     ~TextSearch();
 
     void SetSensitive(bool sensitive);
@@ -13,6 +35,11 @@ class TextSearch : public TextSelection {
     void SetLastResult(TextSelection* sel);
     TextSel* FindFirst(int page, const WCHAR* text, ProgressUpdateUI* tracker = nullptr);
     TextSel* FindNext(ProgressUpdateUI* tracker = nullptr);
+    // finds all matches from the first to the last page and passes them to onHits
+    // in batches of up to batchSize matches. Only the first maxRects rectangles are
+    // included, later matches are just counted. Returns the number of matches
+    int FindAll(const WCHAR* text, const TextSearchHitsCb& onHits, int batchSize, int maxRects,
+                ProgressUpdateUI* tracker = nullptr);
 
     // note: the result might not be a valid page number!
     int GetCurrentPageNo() const {
@@ -33,6 +60,8 @@ class TextSearch : public TextSelection {
 
     WCHAR* findText = nullptr;
     WCHAR* anchor = nullptr;
+    // searches for anchor (created as needed, as it depends on caseSensitive)
+    StrFinder* anchorFinder = nullptr;
     int findPage = 0;
     int searchHitStartAt = 0; // when text found spans several pages, searchHitStartAt < findPage
     bool forward = true;
@@ -48,12 +77,7 @@ class TextSearch : public TextSelection {
     bool FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker);
     PageAndOffset MatchEnd(const WCHAR* start) const;
 
-    void Clear() {
-        str::ReplacePtr(&findText, nullptr);
-        str::ReplacePtr(&anchor, nullptr);
-        str::ReplacePtr(&lastText, nullptr);
-        Reset();
-    }
+    void Clear();
     void Reset();
 
   private:
@@ -63,4 +87,9 @@ class TextSearch : public TextSelection {
     WCHAR* lastText = nullptr;
     int nPages = 0;
     std::vector<bool> pagesToSkip;
+    // pages the index rules out are skipped as well (cf. UpdatePagesToSkip)
+    TextIndex* textIndex = nullptr;
+    int indexedPages = 0;
+
+    void UpdatePagesToSkip();
 };
@@ -3,24 +3,113 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
 
 #include "TreeModel.h"
 #include "EngineBase.h"
 #include "TextSelection.h"
 
-PageTextCache::PageTextCache(EngineBase* engine) : engine(engine) {
+// extraction threads without any pages to extract for this long (in ms) quit
+#define TEXT_EXTRACTION_IDLE_TIMEOUT 5000
+
+class TextExtractionThread : public ThreadBase {
+    PageTextCache* cache;
+    // kept alive while cloning, as the cache might be deleted in the meantime
+    EngineBase* engine;
+
+  public:
+    // set once the thread no longer uses the cache (so that it can be joined while holding cache->access)
+    bool done = false;
+    // cloning can't be canceled, so instead of waiting for it, StopExtracting
+    // abandons a thread which is still cloning (and which then deletes itself)
+    enum { Cloning, Extracting, Abandoned };
+    LONG volatile state = Cloning;
+
+    explicit TextExtractionThread(PageTextCache* cache)
+        : ThreadBase("TextExtractionThread"), cache(cache), engine(cache->engine) {
+        engine->AddRef();
+    }
+    ~TextExtractionThread() override {
+        if (engine) {
+            engine->Release();
+        }
+    }
+
+    void Run() override;
+};
+
+void TextExtractionThread::Run() {
+    // an engine only extracts the text of one page at a time
+    // (clones reload the file by name, so they mustn't be used once it has changed)
+    EngineBase* clone = nullptr;
+    if (engine->IsFileUnchanged()) {
+        clone = engine->Clone();
+    }
+    if (clone && !clone->IsSameFileVersion(engine)) {
+        delete clone;
+        clone = nullptr;
+    }
+    if (InterlockedCompareExchange(&state, Extracting, Cloning) == Abandoned) {
+        // StopExtracting has given up on this thread, so the cache might be gone
+        delete clone;
+        // the engine must only be deleted on the UI thread
+        EngineBase* engineToRelease = engine;
+        uitask::Post([=] { engineToRelease->Release(); });
+        engine = nullptr;
+        delete this;
+        return;
+    }
+
+    EnterCriticalSection(&cache->access);
+    if (!clone) {
+        // e.g. documents loaded from a stream can't be cloned
+        cache->maxThreads = 0;
+    }
+    bool idle = false;
+    while (clone && !WasCancelRequested()) {
+        int pageNo = cache->NextPageToExtract();
+        if (!pageNo) {
+            if (idle) {
+                break;
+            }
+            idle = !SleepConditionVariableCS(&cache->extractionMoved, &cache->access, TEXT_EXTRACTION_IDLE_TIMEOUT);
+            continue;
+        }
+        idle = false;
+        cache->extracting[pageNo - 1] = true;
+        LeaveCriticalSection(&cache->access);
+
+        RectI* pageCoords = nullptr;
+        WCHAR* pageText = clone->ExtractPageText(pageNo, &pageCoords);
+
+        EnterCriticalSection(&cache->access);
+        cache->StoreData(pageNo, pageText, pageCoords);
+    }
+    done = true;
+    LeaveCriticalSection(&cache->access);
+
+    delete clone;
+}
+
+PageTextCache::PageTextCache(EngineBase* engine, int maxThreads) : engine(engine), maxThreads(maxThreads) {
     int count = engine->PageCount();
     coords = AllocArray<RectI*>(count);
     text = AllocArray<WCHAR*>(count);
     lens = AllocArray<int>(count);
+    extracting = AllocArray<bool>(count);
 #ifdef DEBUG
     debug_size = count * (sizeof(RectI*) + sizeof(WCHAR*) + sizeof(int));
 #endif
 
     InitializeCriticalSection(&access);
+    InitializeConditionVariable(&pageExtracted);
+    InitializeConditionVariable(&extractionMoved);
 }
 
 PageTextCache::~PageTextCache() {
+    StopExtracting();
+
     EnterCriticalSection(&access);
 
     for (int i = 0; i < engine->PageCount(); i++) {
@@ -31,6 +120,7 @@ PageTextCache::~PageTextCache() {
     free(coords);
     free(text);
     free(lens);
+    free(extracting);
 
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
@@ -41,20 +131,46 @@ bool PageTextCache::HasData(int pageNo) {
     return text[pageNo - 1] != nullptr;
 }
 
+// Note: make sure to only call with access
+void PageTextCache::StoreData(int pageNo, WCHAR* pageText, RectI* pageCoords) {
+    CrashIf(text[pageNo - 1] || !extracting[pageNo - 1]);
+    coords[pageNo - 1] = pageCoords;
+    if (!pageText) {
+        text[pageNo - 1] = str::Dup(L"");
+        lens[pageNo - 1] = 0;
+    } else {
+        text[pageNo - 1] = pageText;
+        lens[pageNo - 1] = (int)str::Len(pageText);
+    }
+#ifdef DEBUG
+    debug_size += (lens[pageNo - 1] + 1) * (sizeof(WCHAR) + sizeof(RectI));
+#endif
+
+    extracting[pageNo - 1] = false;
+    WakeAllConditionVariable(&pageExtracted);
+}
+
 const WCHAR* PageTextCache::GetData(int pageNo, int* lenOut, RectI** coordsOut) {
     ScopedCritSec scope(&access);
 
+    // the extraction threads may only get a few pages ahead of the last page asked for
+    int step = extractFrom <= extractTo ? 1 : -1;
+    if ((pageNo - extractFrom) * step > 0 && (extractTo - pageNo) * step >= 0) {
+        extractFrom = pageNo;
+        WakeAllConditionVariable(&extractionMoved);
+    }
+
+    while (extracting[pageNo - 1]) {
+        SleepConditionVariableCS(&pageExtracted, &access, INFINITE);
+    }
     if (!text[pageNo - 1]) {
-        text[pageNo - 1] = engine->ExtractPageText(pageNo, &coords[pageNo - 1]);
-        if (!text[pageNo - 1]) {
-            text[pageNo - 1] = str::Dup(L"");
-            lens[pageNo - 1] = 0;
-        } else {
-            lens[pageNo - 1] = (int)str::Len(text[pageNo - 1]);
-        }
-#ifdef DEBUG
-        debug_size += (lens[pageNo - 1] + 1) * (sizeof(WCHAR) + sizeof(RectI));
-#endif
+        extracting[pageNo - 1] = true;
+        // let the extraction threads store their pages in the meantime
+        LeaveCriticalSection(&access);
+        RectI* pageCoords = nullptr;
+        WCHAR* pageText = engine->ExtractPageText(pageNo, &pageCoords);
+        EnterCriticalSection(&access);
+        StoreData(pageNo, pageText, pageCoords);
     }
 
     if (lenOut)
@@ -64,6 +180,85 @@ const WCHAR* PageTextCache::GetData(int pageNo, int* lenOut, RectI** coordsOut)
     return text[pageNo - 1];
 }
 
+// returns the skipCount+1-th page still to be extracted within TEXT_EXTRACTION_LOOKAHEAD
+// pages from extractFrom (or 0 if there aren't that many)
+// Note: make sure to only call with access
+int PageTextCache::NextPageToExtract(int skipCount) {
+    int step = extractFrom <= extractTo ? 1 : -1;
+    for (int i = 0; i < TEXT_EXTRACTION_LOOKAHEAD; i++) {
+        int pageNo = extractFrom + i * step;
+        if (pageNo < 1 || pageNo > engine->PageCount() || (pageNo - extractTo) * step > 0) {
+            break;
+        }
+        bool skip = text[pageNo - 1] || extracting[pageNo - 1] || (!extractSkip.empty() && extractSkip[pageNo - 1]);
+        if (!skip && skipCount-- == 0) {
+            return pageNo;
+        }
+    }
+    return 0;
+}
+
+void PageTextCache::ExtractInBackground(int fromPage, int toPage, const std::vector<bool>* skip) {
+    ScopedCritSec scope(&access);
+    if (maxThreads == 0) {
+        return;
+    }
+    extractFrom = fromPage;
+    extractTo = toPage;
+    extractSkip.clear();
+    if (skip) {
+        extractSkip = *skip;
+    }
+    WakeAllConditionVariable(&extractionMoved);
+
+    // cloning an engine isn't cheap, so only start as many threads as there are pages to extract
+    int running = 0;
+    for (TextExtractionThread*& thread : threads) {
+        if (thread && thread->done) {
+            thread->Join();
+            delete thread;
+            thread = nullptr;
+        }
+        if (thread) {
+            running++;
+        }
+    }
+    for (TextExtractionThread*& thread : threads) {
+        if (!thread && running < maxThreads && NextPageToExtract(running) != 0) {
+            thread = new TextExtractionThread(this);
+            thread->Start();
+            running++;
+        }
+    }
+}
+
+// stops all extraction threads for good
+void PageTextCache::StopExtracting() {
+    {
+        ScopedCritSec scope(&access);
+        maxThreads = 0;
+        for (TextExtractionThread* thread : threads) {
+            if (thread) {
+                thread->RequestCancel();
+            }
+        }
+        WakeAllConditionVariable(&extractionMoved);
+    }
+    // the threads need access to store the pages they're extracting
+    for (TextExtractionThread*& thread : threads) {
+        if (!thread) {
+            continue;
+        }
+        // don't wait for a thread to finish reloading the document
+        if (InterlockedCompareExchange(&thread->state, TextExtractionThread::Abandoned,
+                                       TextExtractionThread::Cloning) != TextExtractionThread::Cloning) {
+            thread->Join();
+            delete thread;
+        }
+        thread = nullptr;
+    }
+}
+
 TextSelection::TextSelection(EngineBase* engine, PageTextCache* textCache)
     : engine(engine), textCache(textCache), startPage(-1), endPage(-1), startGlyph(-1), endGlyph(-1) {
     result.len = 0;
@@ -231,6 +426,9 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx) {
 
     result.len = 0;
     int fromPage = std::min(startPage, endPage), toPage = std::max(startPage, endPage);
+    if (fromPage < toPage) {
+        textCache->ExtractInBackground(fromPage, toPage);
+    }
     int fromGlyph = (fromPage == endPage ? endGlyph : startGlyph);
     int toGlyph = (fromPage == endPage ? startGlyph : endGlyph);
     if (fromPage == toPage && fromGlyph > toGlyph)
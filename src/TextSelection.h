@@ -8,6 +8,15 @@ inline unsigned int distSq(int x, int y) {
 inline bool isWordChar(WCHAR c) {
     return IsCharAlphaNumeric(c) || c == '_';
 }
+// ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
+// cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
+#define isnoncjkwordchar(c) (isWordChar(c) && (unsigned short)(c) < 0x2E80)
+
+#define MAX_TEXT_EXTRACTION_THREADS 4
+// how many pages the extraction threads may get ahead of the last page asked for
+#define TEXT_EXTRACTION_LOOKAHEAD 16
+
+class TextExtractionThread;
 
 class PageTextCache {
     EngineBase* engine = nullptr;
@@ -18,14 +27,38 @@ class PageTextCache {
     size_t debug_size;
 #endif
 
+    // pages currently being extracted (by GetData or an extraction thread)
+    bool* extracting = nullptr;
+    CONDITION_VARIABLE pageExtracted;
+
+    // the extraction threads extract the pages from extractFrom to extractTo
+    // (in either direction) except for those in extractSkip, each using
+    // its own clone of the engine so that they can run in parallel
+    friend class TextExtractionThread;
+    TextExtractionThread* threads[MAX_TEXT_EXTRACTION_THREADS] = {};
+    int maxThreads = 0;
+    int extractFrom = 0, extractTo = 0;
+    std::vector<bool> extractSkip;
+    CONDITION_VARIABLE extractionMoved;
+
     CRITICAL_SECTION access;
 
+    void StoreData(int pageNo, WCHAR* pageText, RectI* pageCoords);
+    int NextPageToExtract(int skipCount = 0);
+
   public:
-    explicit PageTextCache(EngineBase* engine);
+    // extracts the text of several pages at once on up to maxThreads threads
+    // (for engines which can be cloned and extract their pages' text slowly)
+    explicit PageTextCache(EngineBase* engine, int maxThreads = 0);
     ~PageTextCache();
 
     bool HasData(int pageNo);
     const WCHAR* GetData(int pageNo, int* lenOut = nullptr, RectI** coordsOut = nullptr);
+    // starts extracting the pages from fromPage to toPage (which might come before fromPage)
+    // ahead of GetData asking for them, without the pages marked in skip (if given)
+    void ExtractInBackground(int fromPage, int toPage, const std::vector<bool>* skip = nullptr);
+    // stops the extraction threads for good (called when the cache is deleted)
+    void StopExtracting();
 };
 
 // TODO: replace with Vec<TextSel>
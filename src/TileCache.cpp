@@ -0,0 +1,469 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// this file is also compiled for the Linux benchmark, without BaseUtil.h
+#ifdef _WIN32
+#include "utils/BaseUtil.h"
+#else
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#define CrashIf(cond) assert(!(cond))
+#endif
+#include "utils/SyncUtil.h"
+
+#include "TileCache.h"
+
+TileCache::~TileCache() {
+    ScopedMutex scope(&access);
+    // entries are deleted without Remove, as the policy might already be gone
+    while (lruFirst) {
+        TileCacheEntry* entry = lruFirst;
+        lruFirst = entry->lruNext;
+        delete entry;
+    }
+    for (CompressedCacheEntry* centry : compressed) {
+        delete centry;
+    }
+}
+
+TileCacheEntry** TileCache::GetBucket(void* doc, int pageNo, int rotation, TilePosition tile) {
+    size_t hash = (size_t)doc / sizeof(void*);
+    hash = hash * 31 + pageNo;
+    hash = hash * 31 + rotation / 90;
+    hash = hash * 31 + tile.res;
+    hash = hash * 31 + tile.row;
+    hash = hash * 31 + tile.col;
+    return &buckets[hash % BITMAP_CACHE_BUCKETS];
+}
+
+void TileCache::Insert(TileCacheEntry* entry) {
+    ScopedMutex scope(&access);
+    void* doc = policy->GetDocument(entry->owner);
+    TileCacheEntry** bucket = GetBucket(doc, entry->pageNo, entry->rotation, entry->tile);
+    entry->hashNext = *bucket;
+    *bucket = entry;
+
+    entry->lruPrev = lruLast;
+    entry->lruNext = nullptr;
+    if (lruLast)
+        lruLast->lruNext = entry;
+    else
+        lruFirst = entry;
+    lruLast = entry;
+
+    cacheCount++;
+    cacheMemory += entry->memSize;
+}
+
+void TileCache::Remove(TileCacheEntry* entry) {
+    ScopedMutex scope(&access);
+    void* doc = policy->GetDocument(entry->owner);
+    TileCacheEntry** link = GetBucket(doc, entry->pageNo, entry->rotation, entry->tile);
+    while (*link != entry) {
+        CrashIf(!*link);
+        link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+    entry->hashNext = nullptr;
+
+    if (entry->lruPrev)
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        lruFirst = entry->lruNext;
+    if (entry->lruNext)
+        entry->lruNext->lruPrev = entry->lruPrev;
+    else
+        lruLast = entry->lruPrev;
+    entry->lruPrev = entry->lruNext = nullptr;
+
+    CrashIf(cacheCount <= 0 || cacheMemory < entry->memSize);
+    cacheCount--;
+    cacheMemory -= entry->memSize;
+}
+
+// moves the entry to the most recently used end of the list
+void TileCache::MarkUsed(TileCacheEntry* entry) {
+    ScopedMutex scope(&access);
+    if (entry == lruLast)
+        return;
+    if (entry->lruPrev)
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        lruFirst = entry->lruNext;
+    entry->lruNext->lruPrev = entry->lruPrev;
+
+    entry->lruPrev = lruLast;
+    entry->lruNext = nullptr;
+    lruLast->lruNext = entry;
+    lruLast = entry;
+}
+
+/* Find a bitmap for a page defined by <owner> and <pageNo> and optionally also
+   <rotation> and <zoom> in the cache. If <owner> doesn't have one, a bitmap
+   rendered for another owner of the same document will do just as well. */
+TileCacheEntry* TileCache::Find(void* owner, int pageNo, int rotation, float zoom, TilePosition* tile) {
+    ScopedMutex scope(&access);
+    void* doc = policy->GetDocument(owner);
+    TileCacheEntry* shared = nullptr;
+    // only lookups for a specific tile can use the hash index
+    TileCacheEntry* entry = tile ? *GetBucket(doc, pageNo, rotation, *tile) : lruLast;
+    for (; entry; entry = tile ? entry->hashNext : entry->lruPrev) {
+        if ((pageNo != entry->pageNo) || (rotation != entry->rotation) ||
+            (INVALID_ZOOM != zoom && zoom != entry->zoom) || (tile && !(entry->tile == *tile)))
+            continue;
+        if (owner == entry->owner)
+            break;
+        if (!shared && doc == policy->GetDocument(entry->owner))
+            shared = entry;
+    }
+    if (!entry)
+        entry = shared;
+    if (entry) {
+        MarkUsed(entry);
+        entry->refs++;
+    }
+    return entry;
+}
+
+bool TileCache::Exists(void* owner, int pageNo, int rotation, float zoom, TilePosition* tile) {
+    TileCacheEntry* entry = Find(owner, pageNo, rotation, zoom, tile);
+    if (entry)
+        DropCacheEntry(entry);
+    return entry != nullptr;
+}
+
+bool TileCache::DropCacheEntry(TileCacheEntry* entry) {
+    ScopedMutex scope(&access);
+    if (0 == --entry->refs) {
+        delete entry;
+        return true;
+    }
+    return false;
+}
+
+#define SOLID_CHECK_BLOCK 256
+
+// returns whether all count values start with first (T is a pixel or a palette index)
+template <typename T>
+static bool IsSolidRow(const T* values, size_t count, T first) {
+    // compare blocks of values without branching, so that
+    // the compiler can vectorize the inner loop
+    for (size_t i = 0; i < count; i += SOLID_CHECK_BLOCK) {
+        size_t end = std::min(i + SOLID_CHECK_BLOCK, count);
+        T diff = 0;
+        for (size_t j = i; j < end; j++) {
+            diff |= values[j] ^ first;
+        }
+        if (diff != 0)
+            return false;
+    }
+    return true;
+}
+
+// returns whether all pixels of the bitmap have the same color
+// (for 8-bit bitmaps, whether they all use the same palette index)
+static bool IsSolidColor(TileBitmap* bmp, uint32_t* colorOut) {
+    const uint8_t* bits = bmp->GetBits();
+    int dx = bmp->Dx(), dy = bmp->Dy(), stride = bmp->Stride();
+    if (!bits || dx <= 0 || dy <= 0)
+        return false;
+
+    if (8 == bmp->Bpp()) {
+        int paletteSize = 0;
+        const uint32_t* palette = bmp->GetPalette(&paletteSize);
+        uint8_t first = bits[0];
+        if (!palette || first >= paletteSize)
+            return false;
+        // rows are padded, so they're compared one by one
+        for (int y = 0; y < dy; y++) {
+            if (!IsSolidRow(bits + (size_t)y * stride, dx, first))
+                return false;
+        }
+        *colorOut = palette[first];
+        return true;
+    }
+    if (32 != bmp->Bpp())
+        return false;
+
+    uint32_t first = *(const uint32_t*)bits;
+    // without padding, all rows are compared at once
+    size_t rowLen = stride == dx * 4 ? (size_t)dx * dy : dx;
+    int rows = stride == dx * 4 ? 1 : dy;
+    for (int y = 0; y < rows; y++) {
+        if (!IsSolidRow((const uint32_t*)(bits + (size_t)y * stride), rowLen, first))
+            return false;
+    }
+    *colorOut = first;
+    return true;
+}
+
+void TileCache::Add(void* owner, int pageNo, int rotation, float zoom, TilePosition tile, TileBitmap* bitmap) {
+    // tiles of a single color (e.g. page margins or blank pages) are
+    // cached without a bitmap and painted by filling them
+    uint32_t solidColor = 0;
+    bool isSolid = bitmap && IsSolidColor(bitmap, &solidColor);
+    if (isSolid) {
+        delete bitmap;
+        bitmap = nullptr;
+    }
+
+    ScopedMutex scope(&access);
+    /* It's possible there still is a cached bitmap with different zoom/rotation */
+    FreePage(owner, pageNo, &tile);
+
+    TileCacheEntry* entry = new TileCacheEntry(owner, pageNo, rotation, zoom, tile, bitmap);
+    if (isSolid) {
+        entry->isSolid = true;
+        entry->solidColor = solidColor;
+    }
+    Insert(entry);
+    FreeOverLimit(entry);
+}
+
+// get the maximum resolution available for the given page
+uint16_t TileCache::GetMaxTileRes(void* owner, int pageNo, int rotation) {
+    ScopedMutex scope(&access);
+    uint16_t maxRes = 0;
+    for (TileCacheEntry* entry = lruFirst; entry; entry = entry->lruNext) {
+        if (entry->owner == owner && entry->pageNo == pageNo && entry->rotation == rotation) {
+            maxRes = std::max(entry->tile.res, maxRes);
+        }
+    }
+    return maxRes;
+}
+
+// Bitmaps for pages not nearby go first, then bitmaps for tiles not visible.
+// Visible tiles are kept even if that exceeds the limit, as they'd immediately
+// be rendered again.
+void TileCache::FreeOverLimit(TileCacheEntry* keep) {
+    ScopedMutex scope(&access);
+    for (int pass = 0; pass < 2; pass++) {
+        TileCacheEntry* entry = lruFirst;
+        while (entry && (cacheMemory > maxCacheMemory || cacheCount > MAX_BITMAPS_CACHED)) {
+            TileCacheEntry* next = entry->lruNext;
+            bool shouldFree;
+            if (entry == keep)
+                shouldFree = false;
+            else if (0 == pass)
+                shouldFree = !policy->IsNearby(entry);
+            else
+                shouldFree = !policy->IsVisible(entry);
+            if (shouldFree) {
+                Remove(entry);
+                policy->Evicted(entry);
+                Compress(entry);
+                DropCacheEntry(entry);
+            }
+            entry = next;
+        }
+    }
+}
+
+// compressed bitmaps start with a header: if its highest bit is set, the following
+// word is repeated (header & ~RLE_RUN_FLAG) times, else (header) words follow.
+// Rows are encoded as 32-bit words whatever their format (8-bit rows are padded
+// to a multiple of 4 bytes), so a word is either a pixel or four palette indexes.
+#define RLE_RUN_FLAG 0x80000000
+
+// returns the number of words written to out or 0 if they wouldn't fit into maxLen
+static size_t CompressPixels(const uint32_t* pixels, size_t count, uint32_t* out, size_t maxLen) {
+    size_t len = 0;
+    // index of the header of the current block of literal pixels
+    size_t literalHeader = (size_t)-1;
+    for (size_t i = 0; i < count;) {
+        size_t run = 1;
+        while (i + run < count && pixels[i + run] == pixels[i] && run < ~RLE_RUN_FLAG)
+            run++;
+        if (run > 2) {
+            if (len + 2 > maxLen)
+                return 0;
+            out[len++] = RLE_RUN_FLAG | (uint32_t)run;
+            out[len++] = pixels[i];
+            literalHeader = (size_t)-1;
+        } else {
+            if ((size_t)-1 == literalHeader) {
+                if (len + 1 > maxLen)
+                    return 0;
+                literalHeader = len;
+                out[len++] = 0;
+            }
+            if (len + run > maxLen)
+                return 0;
+            for (size_t j = 0; j < run; j++) {
+                out[len++] = pixels[i];
+            }
+            out[literalHeader] += (uint32_t)run;
+        }
+        i += run;
+    }
+    return len;
+}
+
+bool CompressedCacheEntry::Decompress(uint8_t* bits) const {
+    uint32_t* pixels = (uint32_t*)bits;
+    size_t count = (size_t)stride / 4 * dy;
+    size_t pos = 0;
+    for (size_t i = 0; i < dataLen;) {
+        uint32_t header = data[i++];
+        size_t n = header & ~RLE_RUN_FLAG;
+        if (n > count - pos)
+            return false;
+        if ((header & RLE_RUN_FLAG) != 0) {
+            if (i >= dataLen)
+                return false;
+            uint32_t pixel = data[i++];
+            for (size_t j = 0; j < n; j++) {
+                pixels[pos + j] = pixel;
+            }
+        } else {
+            if (n > dataLen - i)
+                return false;
+            memcpy(pixels + pos, data + i, n * sizeof(uint32_t));
+            i += n;
+        }
+        pos += n;
+    }
+    return pos == count;
+}
+
+// keeps a compressed copy of an entry which is about to be evicted
+// (only for bitmaps which compress to at most half their size)
+void TileCache::Compress(TileCacheEntry* entry) {
+    ScopedMutex scope(&access);
+    size_t maxMemory = maxCacheMemory / COMPRESSED_MEMORY_RATIO;
+    TileBitmap* bmp = entry->bitmap;
+    if (!bmp || entry->outOfDate || entry->memSize / 2 > maxMemory)
+        return;
+    const uint32_t* pixels = (const uint32_t*)bmp->GetBits();
+    int paletteSize = 0;
+    const uint32_t* palette = bmp->Bpp() == 8 ? bmp->GetPalette(&paletteSize) : nullptr;
+    if (!pixels || (bmp->Bpp() != 32 && !palette) || bmp->Stride() % 4 != 0)
+        return;
+
+    size_t count = (size_t)bmp->Stride() / 4 * bmp->Dy();
+    uint32_t* data = (uint32_t*)malloc(count / 2 * sizeof(uint32_t));
+    if (!data)
+        return;
+    size_t len = CompressPixels(pixels, count, data, count / 2);
+    if (0 == len) {
+        free(data);
+        return;
+    }
+
+    CompressedCacheEntry* centry = new CompressedCacheEntry();
+    centry->owner = entry->owner;
+    centry->pageNo = entry->pageNo;
+    centry->rotation = entry->rotation;
+    centry->zoom = entry->zoom;
+    centry->tile = entry->tile;
+    centry->dx = bmp->Dx();
+    centry->dy = bmp->Dy();
+    centry->bpp = bmp->Bpp();
+    centry->stride = bmp->Stride();
+    if (palette)
+        centry->palette.assign(palette, palette + paletteSize);
+    centry->dataLen = len;
+    centry->data = (uint32_t*)realloc(data, len * sizeof(uint32_t));
+    compressed.push_back(centry);
+    compressedMemory += len * sizeof(uint32_t);
+    FreeCompressedOverLimit();
+}
+
+void TileCache::FreeCompressedOverLimit() {
+    ScopedMutex scope(&access);
+    while (compressed.size() > 0 && (compressedMemory > maxCacheMemory / COMPRESSED_MEMORY_RATIO ||
+                                     compressed.size() > MAX_BITMAPS_CACHED)) {
+        CompressedCacheEntry* oldest = compressed.front();
+        compressed.erase(compressed.begin());
+        compressedMemory -= oldest->dataLen * sizeof(uint32_t);
+        delete oldest;
+    }
+}
+
+CompressedCacheEntry* TileCache::TakeCompressed(void* owner, int pageNo, int rotation, float zoom,
+                                                TilePosition tile) {
+    ScopedMutex scope(&access);
+    void* doc = policy->GetDocument(owner);
+    for (size_t i = compressed.size(); i > 0; i--) {
+        CompressedCacheEntry* centry = compressed.at(i - 1);
+        if (centry->pageNo != pageNo || centry->rotation != rotation || centry->zoom != zoom ||
+            !(centry->tile == tile) || policy->GetDocument(centry->owner) != doc)
+            continue;
+        compressed.erase(compressed.begin() + (i - 1));
+        compressedMemory -= centry->dataLen * sizeof(uint32_t);
+        return centry;
+    }
+    return nullptr;
+}
+
+void TileCache::FreeCompressed(void* owner, int pageNo, TilePosition* tile) {
+    ScopedMutex scope(&access);
+    for (size_t i = compressed.size(); i > 0; i--) {
+        CompressedCacheEntry* centry = compressed.at(i - 1);
+        bool shouldFree = centry->owner == owner && (ALL_PAGES == pageNo || centry->pageNo == pageNo);
+        if (tile && ALL_PAGES != pageNo) {
+            shouldFree = shouldFree && (centry->tile == *tile || (tile->row == (uint16_t)-1 && centry->tile.res > 0 &&
+                                                                    centry->tile.res != tile->res));
+        }
+        if (shouldFree) {
+            compressed.erase(compressed.begin() + (i - 1));
+            compressedMemory -= centry->dataLen * sizeof(uint32_t);
+            delete centry;
+        }
+    }
+}
+
+void TileCache::FreeCompressedForDocument(void* owner, int pageNo) {
+    ScopedMutex scope(&access);
+    void* doc = policy->GetDocument(owner);
+    for (size_t i = compressed.size(); i > 0; i--) {
+        CompressedCacheEntry* centry = compressed.at(i - 1);
+        if (policy->GetDocument(centry->owner) == doc && (ALL_PAGES == pageNo || centry->pageNo == pageNo)) {
+            compressed.erase(compressed.begin() + (i - 1));
+            compressedMemory -= centry->dataLen * sizeof(uint32_t);
+            delete centry;
+        }
+    }
+}
+
+void TileCache::SetMaxMemory(size_t maxMemory) {
+    ScopedMutex scope(&access);
+    maxCacheMemory = maxMemory;
+    FreeOverLimit();
+    FreeCompressedOverLimit();
+}
+
+void TileCache::FreePage(void* owner, int pageNo, TilePosition* tile) {
+    ScopedMutex scope(&access);
+    TileCacheEntry* entry = lruFirst;
+    while (entry) {
+        TileCacheEntry* next = entry->lruNext;
+        bool shouldFree;
+        if (pageNo != ALL_PAGES) {
+            // a specific page
+            shouldFree = (entry->owner == owner) && (entry->pageNo == pageNo);
+            if (tile) {
+                // a given tile of the page or all tiles not rendered at a given resolution
+                // (and at resolution 0 for quick zoom previews)
+                shouldFree =
+                    shouldFree && (entry->tile == *tile ||
+                                   (tile->row == (uint16_t)-1 && entry->tile.res > 0 && entry->tile.res != tile->res) ||
+                                   (tile->row == (uint16_t)-1 && entry->tile.res == 0 && entry->outOfDate));
+            }
+        } else {
+            // all pages of this owner
+            shouldFree = (entry->owner == owner);
+        }
+
+        if (shouldFree) {
+            Remove(entry);
+            DropCacheEntry(entry);
+        }
+        entry = next;
+    }
+    FreeCompressed(owner, pageNo, tile);
+}
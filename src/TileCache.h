@@ -0,0 +1,281 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// The bitmap cache behind RenderCache: a hash index and a least-recently-used list
+// of rendered tiles, limited by memory use, with a second tier of run-length encoded
+// copies of evicted tiles, as well as the order in which RenderCache's threads pick
+// queued rendering requests. It doesn't depend on Win32 (or BaseUtil.h), so that it
+// can be benchmarked headless on Linux (cf. tools/bench_unix/cache_bench.cpp).
+// Needs <stdint.h>, <vector> and utils/SyncUtil.h.
+
+#define INVALID_TILE_RES ((uint16_t)-1)
+// matches tiles at any zoom level (same value as in DisplayModel.h)
+#define INVALID_ZOOM -99.0f
+// matches all pages of an owner (same value as INVALID_PAGE_NO)
+#define ALL_PAGES -1
+
+// the cache is limited by the memory used for bitmaps (see TileCache::SetMaxMemory)
+// and by their number, as each cached bitmap holds a GDI handle
+#define MAX_BITMAPS_CACHED 1024
+// number of hash buckets for looking up cached bitmaps
+#define BITMAP_CACHE_BUCKETS 1024
+// evicted bitmaps are kept compressed in up to 1/COMPRESSED_MEMORY_RATIO
+// of the memory allowed for cached bitmaps
+#define COMPRESSED_MEMORY_RATIO 4
+
+/* A page is split into tiles of at most TILE_MAX_W x TILE_MAX_H pixels.
+   A given tile starts at (col / 2^res * page_width, row / 2^res * page_height). */
+struct TilePosition {
+    uint16_t res, row, col;
+
+    explicit TilePosition(uint16_t res = INVALID_TILE_RES, uint16_t row = -1, uint16_t col = -1)
+        : res(res), row(row), col(col) {
+    }
+    bool operator==(const TilePosition& other) const {
+        return res == other.res && row == other.row && col == other.col;
+    }
+};
+
+/* The pixels of a rendered tile, independent of where they're stored
+   (a DIB section for RenderCache, plain memory for benchmarks) */
+class TileBitmap {
+  public:
+    virtual ~TileBitmap() {
+    }
+    virtual int Dx() const = 0;
+    virtual int Dy() const = 0;
+    // bits per pixel (32 for BGRA pixels, 8 for palette indexes)
+    virtual int Bpp() const {
+        return 32;
+    }
+    // bytes per row (rows are padded to a multiple of 4 bytes, as for DIBs)
+    virtual int Stride() const {
+        return Dx() * 4;
+    }
+    // returns Dy() rows of Stride() bytes from top to bottom
+    // (or nullptr if they can't be accessed directly)
+    virtual uint8_t* GetBits() = 0;
+    // returns the BGRA colors 8-bit pixels index into (nullptr for 32-bit bitmaps)
+    virtual const uint32_t* GetPalette(int* count) {
+        *count = 0;
+        return nullptr;
+    }
+    // returns Dx() * Dy() 32-bit BGRA pixels (or nullptr for other formats)
+    uint32_t* GetPixels() {
+        if (Bpp() != 32 || Stride() != Dx() * 4)
+            return nullptr;
+        return (uint32_t*)GetBits();
+    }
+};
+
+class MemoryTileBitmap : public TileBitmap {
+    int dx, dy;
+    uint32_t* pixels;
+
+  public:
+    MemoryTileBitmap(int dx, int dy) : dx(dx), dy(dy) {
+        pixels = (uint32_t*)malloc((size_t)dx * dy * sizeof(uint32_t));
+    }
+    ~MemoryTileBitmap() override {
+        free(pixels);
+    }
+    int Dx() const override {
+        return dx;
+    }
+    int Dy() const override {
+        return dy;
+    }
+    uint8_t* GetBits() override {
+        return (uint8_t*)pixels;
+    }
+};
+
+/* We keep a cache of rendered bitmaps. TileCacheEntry keeps data
+   that uniquely identifies a rendered tile (owner, pageNo, rotation,
+   zoom, tile) and the corresponding rendered bitmap. */
+struct TileCacheEntry {
+    // the view the tile was rendered for (a DisplayModel for RenderCache)
+    void* owner;
+    int pageNo;
+    int rotation;
+    float zoom;
+    TilePosition tile;
+
+    // owned by the TileCacheEntry (nullptr for solid color tiles)
+    TileBitmap* bitmap;
+    // the tile is filled with solidColor (a BGRA pixel) instead of painting a bitmap
+    bool isSolid = false;
+    uint32_t solidColor = 0;
+    bool outOfDate = false;
+    int refs = 1;
+    // memory used by bitmap (in bytes)
+    size_t memSize;
+
+    // used by TileCache for its hash index and its least-recently-used list
+    TileCacheEntry* hashNext = nullptr;
+    TileCacheEntry* lruPrev = nullptr;
+    TileCacheEntry* lruNext = nullptr;
+
+    TileCacheEntry(void* owner, int pageNo, int rotation, float zoom, TilePosition tile, TileBitmap* bitmap)
+        : owner(owner),
+          pageNo(pageNo),
+          rotation(rotation),
+          zoom(zoom),
+          tile(tile),
+          bitmap(bitmap),
+          memSize(bitmap ? (size_t)bitmap->Stride() * bitmap->Dy() : 0) {
+    }
+    ~TileCacheEntry() {
+        delete bitmap;
+    }
+};
+
+/* Bitmaps evicted from the cache because of memory pressure are kept around
+   run-length encoded, as restoring them is much faster than rendering them again
+   (cf. TileCache::Compress and TileCache::TakeCompressed) */
+struct CompressedCacheEntry {
+    void* owner;
+    int pageNo;
+    int rotation;
+    float zoom;
+    TilePosition tile;
+
+    int dx, dy;
+    // format of the evicted bitmap (cf. TileBitmap)
+    int bpp, stride;
+    // the colors of an 8-bit bitmap
+    std::vector<uint32_t> palette;
+    // run-length encoded rows as 32-bit words (owned by the CompressedCacheEntry)
+    uint32_t* data;
+    size_t dataLen;
+
+    ~CompressedCacheEntry() {
+        free(data);
+    }
+    // decodes the dy rows of stride bytes (returns false if data is corrupted)
+    bool Decompress(uint8_t* bits) const;
+};
+
+/* Decides which entries TileCache evicts first when it's over its limits */
+class TileCachePolicy {
+  public:
+    virtual ~TileCachePolicy() {
+    }
+    // entries for pages which aren't nearby are evicted in a first pass...
+    virtual bool IsNearby(TileCacheEntry* entry) = 0;
+    // ... and those for tiles which aren't visible in a second one
+    virtual bool IsVisible(TileCacheEntry* entry) = 0;
+    // called for every entry evicted by FreeOverLimit
+    virtual void Evicted(TileCacheEntry* entry) {
+        (void)entry;
+    }
+    // owners showing the same document share their tiles (e.g. DisplayModels
+    // sharing an engine); by default, every owner shows a different document
+    virtual void* GetDocument(void* owner) {
+        return owner;
+    }
+};
+
+class TileCache {
+  private:
+    // cached bitmaps are looked up by (document, pageNo, rotation, tile) and evicted
+    // least recently used first (lruFirst) once there are too many of them
+    TileCacheEntry* buckets[BITMAP_CACHE_BUCKETS] = {};
+    TileCacheEntry* lruFirst = nullptr;
+    TileCacheEntry* lruLast = nullptr;
+    int cacheCount = 0;
+    size_t cacheMemory = 0;
+    size_t maxCacheMemory = 0;
+    // oldest entries first
+    std::vector<CompressedCacheEntry*> compressed;
+    size_t compressedMemory = 0;
+    TileCachePolicy* policy;
+
+    TileCacheEntry** GetBucket(void* doc, int pageNo, int rotation, TilePosition tile);
+    void MarkUsed(TileCacheEntry* entry);
+    void Compress(TileCacheEntry* entry);
+    void FreeCompressedOverLimit();
+
+  public:
+    // protects all entries (lock it while iterating over them or while changing
+    // an entry's zoom or outOfDate; its owner may only change while it's removed)
+    Mutex access;
+
+    explicit TileCache(TileCachePolicy* policy) : policy(policy) {
+    }
+    ~TileCache();
+
+    // returns a tile cached for another owner of the same document if owner doesn't
+    // have its own (call DropCacheEntry when you no longer need a found entry)
+    TileCacheEntry* Find(void* owner, int pageNo, int rotation, float zoom = INVALID_ZOOM,
+                         TilePosition* tile = nullptr);
+    bool Exists(void* owner, int pageNo, int rotation, float zoom = INVALID_ZOOM, TilePosition* tile = nullptr);
+    bool DropCacheEntry(TileCacheEntry* entry);
+    // replaces any cached bitmap for the same tile (takes ownership of bitmap)
+    void Add(void* owner, int pageNo, int rotation, float zoom, TilePosition tile, TileBitmap* bitmap);
+
+    // adds the entry to the hash index and as the most recently used entry
+    void Insert(TileCacheEntry* entry);
+    // removes the entry from the cache (call DropCacheEntry afterwards)
+    void Remove(TileCacheEntry* entry);
+    // least recently used entry first (only while holding access)
+    TileCacheEntry* First() const {
+        return lruFirst;
+    }
+    uint16_t GetMaxTileRes(void* owner, int pageNo, int rotation);
+
+    // frees all bitmaps of a given page (or all pages of owner), optionally only
+    // a given tile (or, for tile.row == -1, all tiles not at resolution tile.res)
+    void FreePage(void* owner, int pageNo = ALL_PAGES, TilePosition* tile = nullptr);
+    // same as FreePage for the compressed copies of evicted bitmaps
+    void FreeCompressed(void* owner, int pageNo = ALL_PAGES, TilePosition* tile = nullptr);
+    // frees the compressed copies of a page (or all pages) of owner's document
+    // for all of its owners (e.g. once the page's content has changed)
+    void FreeCompressedForDocument(void* owner, int pageNo = ALL_PAGES);
+    // frees the least recently used bitmaps while the cache uses more memory
+    // or holds more bitmaps than allowed (except for keep)
+    void FreeOverLimit(TileCacheEntry* keep = nullptr);
+    void SetMaxMemory(size_t maxMemory);
+
+    // removes the compressed copy of an evicted tile of owner's document and returns
+    // it (or nullptr), so that the caller can decompress it into a new bitmap
+    CompressedCacheEntry* TakeCompressed(void* owner, int pageNo, int rotation, float zoom, TilePosition tile);
+
+    int Count() const {
+        return cacheCount;
+    }
+    size_t CompressedCount() const {
+        return compressed.size();
+    }
+};
+
+/* Rendering requests are appended at the end of a queue. A Request has a priority
+   (lower values are more important) and the queue is protected by the caller. */
+
+// returns the index of the request to render next: the most important one (and the
+// most recent one among requests of the same importance) for which canStart is true.
+// Returns -1 if there's none
+template <typename Request, typename CanStart>
+int PickNextRequest(const Request* requests, size_t count, CanStart canStart) {
+    int next = -1;
+    for (int i = (int)count - 1; i >= 0; i--) {
+        if (next != -1 && !(requests[i].priority < requests[next].priority))
+            continue;
+        if (!canStart(requests[i]))
+            continue;
+        next = i;
+    }
+    return next;
+}
+
+// returns the index of the request to drop when the queue is full:
+// the least important one (and the oldest one among those)
+template <typename Request>
+size_t PickRequestToDrop(const Request* requests, size_t count) {
+    size_t drop = 0;
+    for (size_t i = 1; i < count; i++) {
+        if (requests[drop].priority < requests[i].priority)
+            drop = i;
+    }
+    return drop;
+}
@@ -104,6 +104,7 @@
 #define IDM_RENAME_FILE                 580
 #define IDM_FIND_NEXT_SEL               581
 #define IDM_FIND_PREV_SEL               582
+#define IDM_FIND_ALL                    583
 #define IDM_DEBUG_SHOW_LINKS            585
 #define IDM_DEBUG_CRASH_ME              586
 #define IDM_LOAD_MOBI_SAMPLE            587
@@ -111,6 +112,7 @@
 #define IDM_DEBUG_MUI                   589
 #define IDM_DEBUG_ANNOTATION            590
 #define IDM_DEBUG_DOWNLOAD_SYMBOLS      591
+#define IDM_DEBUG_RENDER_STATS          592
 #define IDM_ADVANCED_OPTIONS            596
 #define IDM_FAV_FIRST                   600
 #define IDM_FAV_LAST                    800
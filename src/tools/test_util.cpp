@@ -26,6 +26,7 @@ extern void JsonTest();
 extern void SettingsUtilTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
+extern void StrFinderTest();
 extern void StrFormatTest();
 extern void StrTest();
 extern void TrivialHtmlParser_UnitTests();
@@ -52,6 +53,7 @@ int main(int argc, char** argv) {
     SettingsUtilTest();
     SimpleLogTest();
     SquareTreeTest();
+    StrFinderTest();
     StrTest();
     TrivialHtmlParser_UnitTests();
     // VarintGobTest();
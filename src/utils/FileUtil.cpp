@@ -6,7 +6,13 @@
 
 #if OS_WIN
 #include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
 #include "utils/WinUtil.h"
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 // we pad data read with 3 zeros for convenience. That way returned
@@ -459,6 +465,73 @@ bool Exists(std::string_view path) {
 
 #endif
 
+#if OS_WIN
+MappedFile::~MappedFile() {
+    if (data.data()) {
+        UnmapViewOfFile(data.data());
+    }
+}
+
+MappedFile* Map(const char* path) {
+    AutoFreeWstr pathW(strconv::FromUtf8(path));
+    return Map(pathW.Get());
+}
+
+MappedFile* Map(const WCHAR* path) {
+    // allow others to keep reading and writing the file (as with _wfopen)
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    ScopedHandle h(CreateFileW(path, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (h == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(h, &size) || size.QuadPart <= 0 || (uint64_t)size.QuadPart > (uint64_t)SIZE_MAX) {
+        return nullptr;
+    }
+    // the view keeps the mapping (and the file) open, so the handles can be closed right away
+    ScopedHandle hMap(CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (!hMap) {
+        return nullptr;
+    }
+    void* data = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        return nullptr;
+    }
+    MappedFile* res = new MappedFile();
+    res->data = {(const char*)data, (size_t)size.QuadPart};
+    return res;
+}
+
+#else
+MappedFile::~MappedFile() {
+    if (data.data()) {
+        munmap((void*)data.data(), data.size());
+    }
+}
+
+MappedFile* Map(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > (uint64_t)SIZE_MAX) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = (size_t)st.st_size;
+    // the mapping stays valid after closing the file descriptor
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    MappedFile* res = new MappedFile();
+    res->data = {(const char*)data, size};
+    return res;
+}
+#endif
+
 #if OS_WIN
 HANDLE OpenReadOnly(const WCHAR* filePath) {
     return CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
@@ -593,6 +666,25 @@ bool SetZoneIdentifier(const WCHAR* filePath, int zoneId) {
     return WritePrivateProfileString(L"ZoneTransfer", L"ZoneId", id, path);
 }
 
+bool GetFingerprint(const WCHAR* filePath, unsigned char digest[16]) {
+    AutoFree pathU(strconv::WstrToUtf8(filePath));
+    int64_t size = GetSize(filePath);
+    if (!pathU.Get() || size < 0) {
+        return false;
+    }
+    if (path::HasVariableDriveLetter(filePath)) {
+        pathU.Get()[0] = '?'; // ignore the drive letter, if it might change
+    }
+    FILETIME modified = GetModificationTime(filePath);
+
+    str::Str data;
+    data.Append(pathU.Get(), str::Len(pathU.Get()) + 1);
+    data.Append((const char*)&size, sizeof(size));
+    data.Append((const char*)&modified, sizeof(modified));
+    CalcMD5Digest((const unsigned char*)data.Get(), data.size(), digest);
+    return true;
+}
+
 #endif // OS_WIN
 } // namespace file
 
@@ -57,9 +57,31 @@ bool StartsWithN(const WCHAR* path, const char* magicNumber, size_t len);
 bool StartsWith(const WCHAR* path, const char* magicNumber);
 int GetZoneIdentifier(const WCHAR* path);
 bool SetZoneIdentifier(const WCHAR* path, int zoneId = URLZONE_INTERNET);
+// MD5 of path, size and modification time (cheap to compute, changes whenever the file does)
+bool GetFingerprint(const WCHAR* path, unsigned char digest[16]);
 
 HANDLE OpenReadOnly(const WCHAR* path);
 #endif
+
+// read-only memory mapping of a whole file, unmapped when deleted
+// Note: on Windows the file can't be truncated or replaced while it's mapped
+// (this fails with ERROR_USER_MAPPED_FILE) and I/O errors (e.g. on network drives)
+// raise in-page exceptions when the data is accessed; elsewhere, accessing data
+// beyond the end of a file truncated by another program raises SIGBUS.
+// So only map files which aren't expected to change.
+class MappedFile {
+  public:
+    std::string_view data;
+
+    MappedFile() = default;
+    ~MappedFile();
+};
+
+// returns nullptr if the file is empty or can't be mapped
+MappedFile* Map(const char* path);
+#if OS_WIN
+MappedFile* Map(const WCHAR* path);
+#endif
 } // namespace file
 
 namespace dir {
@@ -0,0 +1,326 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <wctype.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define STR_FINDER_SIMD
+#include <immintrin.h>
+#endif
+
+// lets the compiler use AVX2 instructions in a single function (MSVC always does)
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+#include "StrFinder.h"
+
+struct LowerCaseTable {
+    uint16_t chars[65536];
+
+    LowerCaseTable() {
+        for (int i = 0; i < 65536; i++) {
+            chars[i] = (uint16_t)i;
+        }
+#ifdef _WIN32
+        CharLowerBuffW((WCHAR*)chars, 65536);
+#else
+        for (int i = 0; i < 65536; i++) {
+            wint_t c = towlower((wint_t)i);
+            if (c < 65536) {
+                chars[i] = (uint16_t)c;
+            }
+        }
+#endif
+    }
+};
+
+static const uint16_t* GetLowerCaseTable() {
+    static LowerCaseTable table;
+    return table.chars;
+}
+
+WCHAR StrFinder::ToLower(WCHAR c) {
+    return (WCHAR)GetLowerCaseTable()[(uint16_t)c];
+}
+
+bool StrFinder::HasAVX2() {
+#if !defined(STR_FINDER_SIMD)
+    return false;
+#elif defined(_MSC_VER)
+    static int hasAVX2 = -1;
+    if (hasAVX2 < 0) {
+        int info[4];
+        __cpuid(info, 0);
+        bool ok = info[0] >= 7;
+        if (ok) {
+            // the OS must also save the AVX registers on context switches
+            __cpuid(info, 1);
+            ok = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+        }
+        if (ok) {
+            __cpuidex(info, 7, 0);
+            ok = (info[1] & (1 << 5)) != 0;
+        }
+        hasAVX2 = ok ? 1 : 0;
+    }
+    return hasAVX2 == 1;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// collects all characters which are c in lower case (returns 0 if there are too many)
+static int GetCaseVariants(WCHAR c, bool ignoreCase, uint16_t variants[STR_FINDER_MAX_VARIANTS]) {
+    if (!ignoreCase) {
+        variants[0] = (uint16_t)c;
+        return 1;
+    }
+    const uint16_t* lower = GetLowerCaseTable();
+    int count = 0;
+    for (int i = 0; i < 65536; i++) {
+        if (lower[i] != (uint16_t)c) {
+            continue;
+        }
+        if (count == STR_FINDER_MAX_VARIANTS) {
+            return 0;
+        }
+        variants[count++] = (uint16_t)i;
+    }
+    return count;
+}
+
+StrFinder::StrFinder(const WCHAR* needle, size_t len, bool ignoreCase, StrFinderMode mode)
+    : len(len), ignoreCase(ignoreCase) {
+    // the needle is compared in lower case if case is ignored
+    this->needle = (WCHAR*)malloc((len + 1) * sizeof(WCHAR));
+    for (size_t i = 0; i < len; i++) {
+        this->needle[i] = ignoreCase ? ToLower(needle[i]) : needle[i];
+    }
+    this->needle[len] = 0;
+
+#ifdef STR_FINDER_SIMD
+    if (len > 0 && mode != StrFinderMode::Scalar) {
+        firstCount = GetCaseVariants(this->needle[0], ignoreCase, firstVariants);
+        lastCount = GetCaseVariants(this->needle[len - 1], ignoreCase, lastVariants);
+        if (firstCount == 0 || lastCount == 0) {
+            firstCount = lastCount = 0;
+        }
+        // unused slots are compared against the first variant again
+        for (int i = firstCount; i > 0 && i < STR_FINDER_MAX_VARIANTS; i++) {
+            firstVariants[i] = firstVariants[0];
+        }
+        for (int i = lastCount; i > 0 && i < STR_FINDER_MAX_VARIANTS; i++) {
+            lastVariants[i] = lastVariants[0];
+        }
+        useAVX2 = mode == StrFinderMode::Auto && HasAVX2();
+    }
+#endif
+}
+
+StrFinder::~StrFinder() {
+    free(needle);
+}
+
+bool StrFinder::MatchesAt(const WCHAR* s) const {
+    if (!ignoreCase) {
+        return memcmp(s, needle, len * sizeof(WCHAR)) == 0;
+    }
+    const uint16_t* lower = GetLowerCaseTable();
+    for (size_t i = 0; i < len; i++) {
+        if (lower[(uint16_t)s[i]] != (uint16_t)needle[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const WCHAR* StrFinder::FindScalar(const WCHAR* start, const WCHAR* end) const {
+    const uint16_t* lower = GetLowerCaseTable();
+    for (const WCHAR* s = start; (size_t)(end - s) >= len; s++) {
+        WCHAR c = ignoreCase ? (WCHAR)lower[(uint16_t)*s] : *s;
+        if (c == needle[0] && MatchesAt(s)) {
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+// candidates are all positions before last (from which there's room for the entire needle)
+const WCHAR* StrFinder::FindLastScalar(const WCHAR* start, const WCHAR* last) const {
+    const uint16_t* lower = GetLowerCaseTable();
+    for (const WCHAR* s = last; s > start;) {
+        s--;
+        WCHAR c = ignoreCase ? (WCHAR)lower[(uint16_t)*s] : *s;
+        if (c == needle[0] && MatchesAt(s)) {
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+#ifdef STR_FINDER_SIMD
+
+static inline int LowestBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return (int)idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline int HighestBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanReverse(&idx, mask);
+    return (int)idx;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+// returns a byte mask of the characters in block which are one of the variants
+static inline __m128i MatchVariants(__m128i block, const __m128i* variants) {
+    __m128i m = _mm_cmpeq_epi16(block, variants[0]);
+    for (int i = 1; i < STR_FINDER_MAX_VARIANTS; i++) {
+        m = _mm_or_si128(m, _mm_cmpeq_epi16(block, variants[i]));
+    }
+    return m;
+}
+
+// returns a bit mask (two bits per character) of the positions in the 8 characters
+// at s at which the needle's first and last characters match
+static inline uint32_t MatchBlockSSE2(const WCHAR* s, size_t len, const __m128i* first, const __m128i* last) {
+    __m128i a = _mm_loadu_si128((const __m128i*)s);
+    __m128i b = _mm_loadu_si128((const __m128i*)(s + len - 1));
+    __m128i m = _mm_and_si128(MatchVariants(a, first), MatchVariants(b, last));
+    return (uint32_t)_mm_movemask_epi8(m);
+}
+
+const WCHAR* StrFinder::FindSSE2(const WCHAR* start, const WCHAR* end) const {
+    __m128i first[STR_FINDER_MAX_VARIANTS], last[STR_FINDER_MAX_VARIANTS];
+    for (int i = 0; i < STR_FINDER_MAX_VARIANTS; i++) {
+        first[i] = _mm_set1_epi16((short)firstVariants[i]);
+        last[i] = _mm_set1_epi16((short)lastVariants[i]);
+    }
+
+    const WCHAR* s = start;
+    for (; (size_t)(end - s) >= len + 7; s += 8) {
+        uint32_t mask = MatchBlockSSE2(s, len, first, last);
+        while (mask) {
+            int bit = LowestBit(mask);
+            if (MatchesAt(s + bit / 2)) {
+                return s + bit / 2;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+    return FindScalar(s, end);
+}
+
+const WCHAR* StrFinder::FindLastSSE2(const WCHAR* start, const WCHAR* last) const {
+    __m128i firstV[STR_FINDER_MAX_VARIANTS], lastV[STR_FINDER_MAX_VARIANTS];
+    for (int i = 0; i < STR_FINDER_MAX_VARIANTS; i++) {
+        firstV[i] = _mm_set1_epi16((short)firstVariants[i]);
+        lastV[i] = _mm_set1_epi16((short)lastVariants[i]);
+    }
+
+    // there's room for the entire needle from all positions before last
+    const WCHAR* s = last;
+    for (; s - start >= 8; s -= 8) {
+        uint32_t mask = MatchBlockSSE2(s - 8, len, firstV, lastV);
+        while (mask) {
+            int bit = HighestBit(mask) & ~1;
+            if (MatchesAt(s - 8 + bit / 2)) {
+                return s - 8 + bit / 2;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+    return FindLastScalar(start, s);
+}
+
+TARGET_AVX2
+const WCHAR* StrFinder::FindAVX2(const WCHAR* start, const WCHAR* end) const {
+    __m256i first[STR_FINDER_MAX_VARIANTS], last[STR_FINDER_MAX_VARIANTS];
+    for (int i = 0; i < STR_FINDER_MAX_VARIANTS; i++) {
+        first[i] = _mm256_set1_epi16((short)firstVariants[i]);
+        last[i] = _mm256_set1_epi16((short)lastVariants[i]);
+    }
+
+    const WCHAR* s = start;
+    for (; (size_t)(end - s) >= len + 15; s += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)s);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + len - 1));
+        __m256i ma = _mm256_cmpeq_epi16(a, first[0]);
+        __m256i mb = _mm256_cmpeq_epi16(b, last[0]);
+        for (int i = 1; i < STR_FINDER_MAX_VARIANTS; i++) {
+            ma = _mm256_or_si256(ma, _mm256_cmpeq_epi16(a, first[i]));
+            mb = _mm256_or_si256(mb, _mm256_cmpeq_epi16(b, last[i]));
+        }
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(ma, mb));
+        while (mask) {
+            int bit = LowestBit(mask);
+            if (MatchesAt(s + bit / 2)) {
+                return s + bit / 2;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+    return FindSSE2(s, end);
+}
+
+#else
+
+const WCHAR* StrFinder::FindSSE2(const WCHAR* start, const WCHAR* end) const {
+    return FindScalar(start, end);
+}
+
+const WCHAR* StrFinder::FindLastSSE2(const WCHAR* start, const WCHAR* last) const {
+    return FindLastScalar(start, last);
+}
+
+const WCHAR* StrFinder::FindAVX2(const WCHAR* start, const WCHAR* end) const {
+    return FindScalar(start, end);
+}
+
+#endif
+
+const WCHAR* StrFinder::Find(const WCHAR* start, const WCHAR* end) const {
+    if (len == 0 || end < start || (size_t)(end - start) < len) {
+        return nullptr;
+    }
+    if (firstCount == 0) {
+        return FindScalar(start, end);
+    }
+    return useAVX2 ? FindAVX2(start, end) : FindSSE2(start, end);
+}
+
+const WCHAR* StrFinder::FindLast(const WCHAR* start, const WCHAR* last, const WCHAR* end) const {
+    if (len == 0 || end < start || (size_t)(end - start) < len) {
+        return nullptr;
+    }
+    // matches must start before last and end before end
+    if (last > end - len + 1) {
+        last = end - len + 1;
+    }
+    if (last <= start) {
+        return nullptr;
+    }
+    if (firstCount == 0) {
+        return FindLastScalar(start, last);
+    }
+    return FindLastSSE2(start, last);
+}
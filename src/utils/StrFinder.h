@@ -0,0 +1,61 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Searches UTF-16 text for a string, optionally ignoring case (two characters match
+// if they're the same in lower case, as with CharLowerBuff). Candidate positions are
+// found by comparing the needle's first and last characters (in all their case
+// variants) against 8 or 16 characters at once using SSE2 or AVX2, so that only a few
+// positions have to be compared in full. Like SyncUtil.h, this doesn't depend on
+// BaseUtil.h so that it can be benchmarked on Linux (cf. tools/bench_unix/strfind_bench.cpp).
+// Needs <stdint.h> (and <windows.h> on Windows).
+
+#ifndef _WIN32
+typedef char16_t WCHAR;
+#endif
+
+// at most this many characters are compared at once per needle position,
+// characters with more case variants are searched for without SIMD
+#define STR_FINDER_MAX_VARIANTS 4
+
+enum class StrFinderMode {
+    // uses AVX2 or SSE2, if supported by the processor
+    Auto,
+    SSE2,
+    Scalar,
+};
+
+class StrFinder {
+    WCHAR* needle = nullptr;
+    size_t len = 0;
+    bool ignoreCase = false;
+    bool useAVX2 = false;
+
+    // the case variants of the needle's first and last characters
+    uint16_t firstVariants[STR_FINDER_MAX_VARIANTS] = {};
+    uint16_t lastVariants[STR_FINDER_MAX_VARIANTS] = {};
+    int firstCount = 0, lastCount = 0;
+
+    bool MatchesAt(const WCHAR* s) const;
+    const WCHAR* FindScalar(const WCHAR* start, const WCHAR* end) const;
+    const WCHAR* FindLastScalar(const WCHAR* start, const WCHAR* last) const;
+    const WCHAR* FindSSE2(const WCHAR* start, const WCHAR* end) const;
+    const WCHAR* FindLastSSE2(const WCHAR* start, const WCHAR* last) const;
+    const WCHAR* FindAVX2(const WCHAR* start, const WCHAR* end) const;
+
+  public:
+    StrFinder(const WCHAR* needle, size_t len, bool ignoreCase, StrFinderMode mode = StrFinderMode::Auto);
+    ~StrFinder();
+    StrFinder(const StrFinder&) = delete;
+    StrFinder& operator=(const StrFinder&) = delete;
+
+    // returns the first match which lies completely within [start, end) (or nullptr)
+    const WCHAR* Find(const WCHAR* start, const WCHAR* end) const;
+    // returns the last match which starts before last and lies completely
+    // within [start, end) (or nullptr), like StrRStrI
+    const WCHAR* FindLast(const WCHAR* start, const WCHAR* last, const WCHAR* end) const;
+
+    // same as CharLower for a single character (but much faster)
+    static WCHAR ToLower(WCHAR c);
+    // whether the processor supports AVX2, in which case Find uses it
+    static bool HasAVX2();
+};
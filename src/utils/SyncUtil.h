@@ -0,0 +1,202 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Locks, events and threads that behave the same on Windows and Unix, so that
+// code using them (e.g. TileCache) can also be built and benchmarked on Linux.
+// Unlike most of utils, this doesn't depend on BaseUtil.h (but on Windows,
+// <windows.h> must have been included before).
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// a recursive lock (like a CRITICAL_SECTION)
+class Mutex {
+#ifdef _WIN32
+    CRITICAL_SECTION cs;
+#else
+    pthread_mutex_t mutex;
+#endif
+
+  public:
+    Mutex() {
+#ifdef _WIN32
+        InitializeCriticalSection(&cs);
+#else
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+#endif
+    }
+    ~Mutex() {
+#ifdef _WIN32
+        DeleteCriticalSection(&cs);
+#else
+        pthread_mutex_destroy(&mutex);
+#endif
+    }
+    Mutex(const Mutex&) = delete;
+    Mutex& operator=(const Mutex&) = delete;
+
+    void Lock() {
+#ifdef _WIN32
+        EnterCriticalSection(&cs);
+#else
+        pthread_mutex_lock(&mutex);
+#endif
+    }
+    void Unlock() {
+#ifdef _WIN32
+        LeaveCriticalSection(&cs);
+#else
+        pthread_mutex_unlock(&mutex);
+#endif
+    }
+};
+
+class ScopedMutex {
+    Mutex* mutex = nullptr;
+
+  public:
+    explicit ScopedMutex(Mutex* mutex) : mutex(mutex) {
+        mutex->Lock();
+    }
+    ~ScopedMutex() {
+        mutex->Unlock();
+    }
+};
+
+// a manual-reset event (stays set until Reset is called)
+class Event {
+#ifdef _WIN32
+    HANDLE hEvent;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool isSet = false;
+#endif
+
+  public:
+    Event() {
+#ifdef _WIN32
+        hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+#else
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+#endif
+    }
+    ~Event() {
+#ifdef _WIN32
+        CloseHandle(hEvent);
+#else
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+#endif
+    }
+    Event(const Event&) = delete;
+    Event& operator=(const Event&) = delete;
+
+    void Set() {
+#ifdef _WIN32
+        SetEvent(hEvent);
+#else
+        pthread_mutex_lock(&mutex);
+        isSet = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+#endif
+    }
+    void Reset() {
+#ifdef _WIN32
+        ResetEvent(hEvent);
+#else
+        pthread_mutex_lock(&mutex);
+        isSet = false;
+        pthread_mutex_unlock(&mutex);
+#endif
+    }
+    // blocks until the event is set
+    void Wait() {
+#ifdef _WIN32
+        WaitForSingleObject(hEvent, INFINITE);
+#else
+        pthread_mutex_lock(&mutex);
+        while (!isSet) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        pthread_mutex_unlock(&mutex);
+#endif
+    }
+};
+
+typedef void (*ThreadFunc)(void* data);
+
+// a thread running func(data) until func returns
+class Thread {
+    ThreadFunc func = nullptr;
+    void* data = nullptr;
+#ifdef _WIN32
+    HANDLE hThread = nullptr;
+
+    static DWORD WINAPI ThreadProc(LPVOID self) {
+        ((Thread*)self)->func(((Thread*)self)->data);
+        return 0;
+    }
+#else
+    pthread_t thread;
+    bool started = false;
+
+    static void* ThreadProc(void* self) {
+        ((Thread*)self)->func(((Thread*)self)->data);
+        return nullptr;
+    }
+#endif
+
+  public:
+    Thread() = default;
+    // the thread keeps running if it hasn't been joined
+    ~Thread() {
+#ifdef _WIN32
+        if (hThread) {
+            CloseHandle(hThread);
+        }
+#else
+        if (started) {
+            pthread_detach(thread);
+        }
+#endif
+    }
+    Thread(const Thread&) = delete;
+    Thread& operator=(const Thread&) = delete;
+
+    // returns false if the thread couldn't be created
+    bool Start(ThreadFunc func, void* data) {
+        this->func = func;
+        this->data = data;
+#ifdef _WIN32
+        hThread = CreateThread(nullptr, 0, ThreadProc, this, 0, nullptr);
+        return hThread != nullptr;
+#else
+        started = pthread_create(&thread, nullptr, ThreadProc, this) == 0;
+        return started;
+#endif
+    }
+
+    // waits until the thread has finished
+    void Join() {
+#ifdef _WIN32
+        if (hThread) {
+            WaitForSingleObject(hThread, INFINITE);
+            CloseHandle(hThread);
+            hThread = nullptr;
+        }
+#else
+        if (started) {
+            pthread_join(thread, nullptr);
+            started = false;
+        }
+#endif
+    }
+};
@@ -49,4 +49,18 @@ void FileUtilTest() {
     utassert(!path::Match(L"C:\\dir.xps\\file.pdf", L"*.xps;*.djvu"));
     utassert(!path::Match(L"C:\\file.pdf", L"f??f.p?f"));
     utassert(!path::Match(L"C:\\.pdf", L"?.pdf"));
+
+    {
+        AutoFreeWstr tmpPath(path::GetTempPath(L"sum"));
+        utassert(tmpPath);
+        const char* s = "mapped file content";
+        utassert(file::WriteFile(tmpPath, s));
+        file::MappedFile* mf = file::Map(tmpPath);
+        utassert(mf && mf->data == s);
+        delete mf;
+        utassert(file::WriteFile(tmpPath, ""));
+        utassert(!file::Map(tmpPath));
+        utassert(file::Delete(tmpPath));
+        utassert(!file::Map(tmpPath));
+    }
 }
@@ -0,0 +1,71 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/StrFinder.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static const StrFinderMode gModes[] = {StrFinderMode::Auto, StrFinderMode::SSE2, StrFinderMode::Scalar};
+
+// expected is the offset of the first match (or -1)
+static void FindTest(const WCHAR* text, const WCHAR* needle, bool ignoreCase, int expected) {
+    const WCHAR* end = text + str::Len(text);
+    for (StrFinderMode mode : gModes) {
+        StrFinder finder(needle, str::Len(needle), ignoreCase, mode);
+        const WCHAR* found = finder.Find(text, end);
+        utassert(expected < 0 ? !found : found == text + expected);
+    }
+}
+
+// expected is the offset of the last match starting before last (or -1)
+static void FindLastTest(const WCHAR* text, int last, const WCHAR* needle, bool ignoreCase, int expected) {
+    const WCHAR* end = text + str::Len(text);
+    for (StrFinderMode mode : gModes) {
+        StrFinder finder(needle, str::Len(needle), ignoreCase, mode);
+        const WCHAR* found = finder.FindLast(text, text + last, end);
+        utassert(expected < 0 ? !found : found == text + expected);
+    }
+}
+
+void StrFinderTest() {
+    utassert(StrFinder::ToLower('A') == 'a');
+    utassert(StrFinder::ToLower('a') == 'a');
+    utassert(StrFinder::ToLower('1') == '1');
+    utassert(StrFinder::ToLower(0xC9) == 0xE9);
+
+    FindTest(L"", L"a", true, -1);
+    FindTest(L"a", L"", true, -1);
+    FindTest(L"abc", L"abcd", true, -1);
+    FindTest(L"abc", L"abc", false, 0);
+    FindTest(L"xABC", L"abc", false, -1);
+    FindTest(L"xABC", L"abc", true, 1);
+    FindTest(L"xAbC", L"aBc", true, 1);
+    FindTest(L"Caf\xC9 caf\xE9", L"caf\xE9", false, 5);
+    FindTest(L"Caf\xC9 caf\xE9", L"caf\xE9", true, 0);
+
+    // long enough for the SIMD kernels, with matches in and after the vectorized part
+    const WCHAR* text = L"The quick brown fox jumps over the lazy dog, then the quick brown fox sleeps.";
+    FindTest(text, L"the", false, 31);
+    FindTest(text, L"the", true, 0);
+    FindTest(text, L"LAZY DOG", true, 35);
+    FindTest(text, L"sleeps.", true, 70);
+    FindTest(text, L"sleeps!", true, -1);
+    FindTest(text, L"Quick Brown Fox Sleeps", true, 54);
+    FindTest(text, L"Quick Brown Fox Sleeps", false, -1);
+    FindTest(text, L"o", true, 12);
+
+    FindLastTest(text, 77, L"the", true, 50);
+    FindLastTest(text, 50, L"the", true, 45);
+    FindLastTest(text, 45, L"the", true, 31);
+    FindLastTest(text, 31, L"the", true, 0);
+    FindLastTest(text, 0, L"the", true, -1);
+    FindLastTest(text, 77, L"the", false, 50);
+    FindLastTest(text, 31, L"the", false, -1);
+    FindLastTest(text, 77, L"QUICK", true, 54);
+    FindLastTest(text, 54, L"QUICK", true, 4);
+    // matches may extend beyond last
+    FindLastTest(text, 71, L"sleeps.", true, 70);
+    FindLastTest(text, 70, L"sleeps.", true, -1);
+}
@@ -0,0 +1,386 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// Headless load test for TileCache, the bitmap cache behind RenderCache.
+// A synthetic document is scrolled through at a given speed (with some jitter)
+// while rendering threads fill in the missing tiles in the order RenderCache does
+// (cf. PickNextRequest), restoring them from their compressed copies if possible.
+// Prints the cache hit rate and how long visible tiles took to appear as JSON.
+//
+// usage: bench_cache_unix [-pages <n>] [-frames <n>] [-speed <rows>] [-jitter <rows>]
+//                         [-threads <n>] [-render-ms <ms>] [-cache-mb <n>] [-tile <dx>x<dy>]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "utils/SyncUtil.h"
+#include "TileCache.h"
+
+// pages are split into 2^TILE_RES x 2^TILE_RES tiles (like large pages in RenderCache)
+#define TILE_RES 1
+#define TILES_PER_ROW (1 << TILE_RES)
+#define TILES_PER_PAGE (TILES_PER_ROW * TILES_PER_ROW)
+// number of tile rows visible at once
+#define VIEW_ROWS 3
+// time between two frames painted by the "UI thread"
+#define FRAME_MS 16
+#define MAX_THREADS 16
+// same as MAX_PAGE_REQUESTS in RenderCache.h
+#define MAX_QUEUED_REQUESTS 64
+
+struct BenchOptions {
+    int pages = 200;
+    int frames = 2000;
+    // scroll distance per frame in tile rows
+    double speed = 0.25;
+    // random variation of the scroll distance per frame in tile rows
+    double jitter = 0.5;
+    int threads = 3;
+    double renderMs = 20;
+    int cacheMb = 64;
+    int tileDx = 640;
+    int tileDy = 400;
+};
+
+enum class TileState { Idle, Queued, Rendering };
+
+// the same order as RenderCache's RenderPriority
+enum class BenchPriority { Visible, Nearby };
+
+struct TileRequest {
+    int pageNo;
+    TilePosition tile;
+    BenchPriority priority;
+};
+
+struct Bench;
+
+// evicts tiles which aren't nearby or visible first (cf. RenderCache)
+class BenchPolicy : public TileCachePolicy {
+  public:
+    Bench* bench = nullptr;
+    std::atomic<int> evictions{0};
+
+    bool IsNearby(TileCacheEntry* entry) override;
+    bool IsVisible(TileCacheEntry* entry) override;
+    void Evicted(TileCacheEntry* entry) override {
+        (void)entry;
+        evictions++;
+    }
+};
+
+struct Bench {
+    BenchOptions opts;
+    BenchPolicy policy;
+    TileCache cache;
+    // the owner of all tiles (a DisplayModel for RenderCache)
+    int view = 0;
+    // first visible tile row (times 1000, so that it can be read atomically)
+    std::atomic<int> viewTop{0};
+
+    Mutex requestAccess;
+    // requests are appended at the end (cf. PickNextRequest)
+    std::vector<TileRequest> requests;
+    std::vector<TileState> states;
+    // time of the first cache miss for a tile not rendered yet (or < 0)
+    std::vector<double> missTimes;
+    std::vector<double> latencies;
+    Event startRendering;
+    std::atomic<bool> quit{false};
+
+    std::atomic<int> renders{0};
+    std::atomic<int> compressedHits{0};
+    int lookups = 0;
+    int hits = 0;
+
+    Bench() : cache(&policy) {
+        policy.bench = this;
+    }
+};
+
+static double NowInMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void SleepMs(double ms) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1000000);
+    nanosleep(&ts, nullptr);
+}
+
+static int TileIndex(int pageNo, TilePosition tile) {
+    return (pageNo - 1) * TILES_PER_PAGE + tile.row * TILES_PER_ROW + tile.col;
+}
+
+// the tile row of the document a tile is in
+static int DocRow(int pageNo, TilePosition tile) {
+    return (pageNo - 1) * TILES_PER_ROW + tile.row;
+}
+
+static bool IsRowVisible(Bench* b, int row, int margin = 0) {
+    int top = b->viewTop / 1000;
+    return row >= top - margin && row < top + VIEW_ROWS + margin;
+}
+
+bool BenchPolicy::IsNearby(TileCacheEntry* entry) {
+    return IsRowVisible(bench, DocRow(entry->pageNo, entry->tile), TILES_PER_ROW);
+}
+
+bool BenchPolicy::IsVisible(TileCacheEntry* entry) {
+    return IsRowVisible(bench, DocRow(entry->pageNo, entry->tile));
+}
+
+// fills a tile with lines of "text" (so that it compresses somewhat like a rendered
+// page would), leaving the bottom of every third page blank (which is a solid tile)
+static void RenderTile(Bench* b, int pageNo, TilePosition tile, uint32_t* pixels) {
+    int dx = b->opts.tileDx, dy = b->opts.tileDy;
+    bool isBlank = pageNo % 3 == 0 && tile.row == TILES_PER_ROW - 1;
+    for (int y = 0; y < dy; y++) {
+        uint32_t* line = pixels + (size_t)y * dx;
+        bool isText = !isBlank && (y / 8) % 3 != 2 && y > 32 && y < dy - 32;
+        for (int x = 0; x < dx; x++) {
+            uint32_t hash = (uint32_t)(x / 6) * 2654435761u ^ (uint32_t)(y / 8 + pageNo * 131) * 40503u;
+            line[x] = isText && (hash >> 29) != 0 ? 0xFF202020 : 0xFFFFFFFF;
+        }
+    }
+    SleepMs(b->opts.renderMs);
+}
+
+static void QueueRequest(Bench* b, int pageNo, TilePosition tile, BenchPriority priority) {
+    ScopedMutex scope(&b->requestAccess);
+    int idx = TileIndex(pageNo, tile);
+    if (TileState::Rendering == b->states[idx])
+        return;
+    if (TileState::Queued == b->states[idx]) {
+        // move it to the end, so that it's rendered before older requests
+        for (size_t i = 0; i < b->requests.size(); i++) {
+            TileRequest req = b->requests[i];
+            if (req.pageNo == pageNo && req.tile == tile) {
+                req.priority = std::min(req.priority, priority);
+                b->requests.erase(b->requests.begin() + i);
+                b->requests.push_back(req);
+                break;
+            }
+        }
+    } else {
+        if (b->requests.size() >= MAX_QUEUED_REQUESTS) {
+            // drop the least important request, unless they're all more important (cf. RenderCache::Render)
+            size_t drop = PickRequestToDrop(b->requests.data(), b->requests.size());
+            if (b->requests[drop].priority < priority)
+                return;
+            TileRequest& dropped = b->requests[drop];
+            b->states[TileIndex(dropped.pageNo, dropped.tile)] = TileState::Idle;
+            b->requests.erase(b->requests.begin() + drop);
+        }
+        b->states[idx] = TileState::Queued;
+        b->requests.push_back({pageNo, tile, priority});
+    }
+    b->startRendering.Set();
+}
+
+static bool GetNextRequest(Bench* b, TileRequest* req) {
+    ScopedMutex scope(&b->requestAccess);
+    // all tiles can be rendered concurrently (cf. EngineBase::HasParallelRendering)
+    int next = PickNextRequest(b->requests.data(), b->requests.size(), [](const TileRequest&) { return true; });
+    if (-1 == next) {
+        b->startRendering.Reset();
+        return false;
+    }
+    *req = b->requests[next];
+    b->requests.erase(b->requests.begin() + next);
+    b->states[TileIndex(req->pageNo, req->tile)] = TileState::Rendering;
+    return true;
+}
+
+static void RenderThread(void* data) {
+    Bench* b = (Bench*)data;
+    for (;;) {
+        TileRequest req;
+        if (!GetNextRequest(b, &req)) {
+            if (b->quit)
+                return;
+            b->startRendering.Wait();
+            continue;
+        }
+        int idx = TileIndex(req.pageNo, req.tile);
+        // requests for tiles scrolled out of view are dropped (cf. RenderCacheThread)
+        bool isNeeded = IsRowVisible(b, DocRow(req.pageNo, req.tile), TILES_PER_ROW);
+        if (isNeeded) {
+            MemoryTileBitmap* bmp = new MemoryTileBitmap(b->opts.tileDx, b->opts.tileDy);
+            CompressedCacheEntry* centry = b->cache.TakeCompressed(&b->view, req.pageNo, 0, 1.0f, req.tile);
+            if (centry && centry->Decompress(bmp->GetBits())) {
+                b->compressedHits++;
+            } else {
+                RenderTile(b, req.pageNo, req.tile, bmp->GetPixels());
+                b->renders++;
+            }
+            delete centry;
+            b->cache.Add(&b->view, req.pageNo, 0, 1.0f, req.tile, bmp);
+        }
+
+        ScopedMutex scope(&b->requestAccess);
+        b->states[idx] = TileState::Idle;
+        if (isNeeded && b->missTimes[idx] >= 0) {
+            b->latencies.push_back(NowInMs() - b->missTimes[idx]);
+            b->missTimes[idx] = -1;
+        }
+    }
+}
+
+// looks up all visible tiles (as RenderCache::Paint would) and
+// requests the missing ones as well as those of the next page
+static void PaintFrame(Bench* b) {
+    int top = b->viewTop / 1000;
+    int rows = b->opts.pages * TILES_PER_ROW;
+    for (int row = top; row < top + VIEW_ROWS + TILES_PER_ROW && row < rows; row++) {
+        bool isVisible = row < top + VIEW_ROWS;
+        int pageNo = row / TILES_PER_ROW + 1;
+        for (int col = 0; col < TILES_PER_ROW; col++) {
+            TilePosition tile(TILE_RES, (uint16_t)(row % TILES_PER_ROW), (uint16_t)col);
+            if (isVisible) {
+                b->lookups++;
+                TileCacheEntry* entry = b->cache.Find(&b->view, pageNo, 0, 1.0f, &tile);
+                if (entry) {
+                    b->hits++;
+                    b->cache.DropCacheEntry(entry);
+                    continue;
+                }
+                ScopedMutex scope(&b->requestAccess);
+                int idx = TileIndex(pageNo, tile);
+                if (b->missTimes[idx] < 0)
+                    b->missTimes[idx] = NowInMs();
+            } else if (b->cache.Exists(&b->view, pageNo, 0, 1.0f, &tile)) {
+                continue;
+            }
+            QueueRequest(b, pageNo, tile, isVisible ? BenchPriority::Visible : BenchPriority::Nearby);
+        }
+    }
+}
+
+static void RunScrollWorkload(Bench* b) {
+    int maxTop = std::max(0, b->opts.pages * TILES_PER_ROW - VIEW_ROWS) * 1000;
+    double direction = 1.0;
+    for (int frame = 0; frame < b->opts.frames; frame++) {
+        double jitter = b->opts.jitter * (2.0 * rand() / RAND_MAX - 1.0);
+        int top = b->viewTop + (int)((direction * b->opts.speed + jitter) * 1000);
+        // scroll back up after reaching the end of the document (and down again at the start)
+        if (top >= maxTop) {
+            top = maxTop;
+            direction = -1.0;
+        } else if (top <= 0) {
+            top = 0;
+            direction = 1.0;
+        }
+        b->viewTop = top;
+
+        double start = NowInMs();
+        PaintFrame(b);
+        double elapsed = NowInMs() - start;
+        if (elapsed < FRAME_MS)
+            SleepMs(FRAME_MS - elapsed);
+    }
+}
+
+static double Percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t idx = std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()));
+    return sorted[idx];
+}
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        const char* param = argv[++i];
+        if (!strcmp(arg, "-pages")) {
+            opts.pages = atoi(param);
+        } else if (!strcmp(arg, "-frames")) {
+            opts.frames = atoi(param);
+        } else if (!strcmp(arg, "-speed")) {
+            opts.speed = atof(param);
+        } else if (!strcmp(arg, "-jitter")) {
+            opts.jitter = atof(param);
+        } else if (!strcmp(arg, "-threads")) {
+            opts.threads = atoi(param);
+        } else if (!strcmp(arg, "-render-ms")) {
+            opts.renderMs = atof(param);
+        } else if (!strcmp(arg, "-cache-mb")) {
+            opts.cacheMb = atoi(param);
+        } else if (!strcmp(arg, "-tile")) {
+            if (sscanf(param, "%dx%d", &opts.tileDx, &opts.tileDy) != 2)
+                return false;
+        } else {
+            return false;
+        }
+    }
+    return opts.pages > 0 && opts.frames > 0 && opts.speed >= 0 && opts.jitter >= 0 && opts.threads > 0 &&
+           opts.threads <= MAX_THREADS && opts.renderMs >= 0 && opts.cacheMb > 0 && opts.tileDx > 0 &&
+           opts.tileDy > 0;
+}
+
+int main(int argc, char** argv) {
+    Bench* b = new Bench();
+    if (!ParseArgs(argc, argv, b->opts)) {
+        fprintf(stderr,
+                "usage: %s [-pages <n>] [-frames <n>] [-speed <rows>] [-jitter <rows>]\n"
+                "          [-threads <n>] [-render-ms <ms>] [-cache-mb <n>] [-tile <dx>x<dy>]\n",
+                argv[0]);
+        return 2;
+    }
+    srand(1);
+    int tileCount = b->opts.pages * TILES_PER_PAGE;
+    b->states.resize(tileCount, TileState::Idle);
+    b->missTimes.resize(tileCount, -1);
+    b->cache.SetMaxMemory((size_t)b->opts.cacheMb * 1024 * 1024);
+
+    Thread threads[MAX_THREADS];
+    for (int i = 0; i < b->opts.threads; i++) {
+        if (!threads[i].Start(RenderThread, b)) {
+            fprintf(stderr, "failed to start rendering thread\n");
+            return 1;
+        }
+    }
+
+    double start = NowInMs();
+    RunScrollWorkload(b);
+    double totalMs = NowInMs() - start;
+
+    {
+        ScopedMutex scope(&b->requestAccess);
+        b->quit = true;
+        b->requests.clear();
+        b->startRendering.Set();
+    }
+    for (int i = 0; i < b->opts.threads; i++) {
+        threads[i].Join();
+    }
+
+    std::vector<double>& lat = b->latencies;
+    std::sort(lat.begin(), lat.end());
+    double hitRate = b->lookups > 0 ? (double)b->hits / b->lookups : 0;
+    printf("{\n");
+    printf("  \"pages\": %d, \"frames\": %d, \"threads\": %d, \"render_ms\": %.1f, \"cache_mb\": %d,\n",
+           b->opts.pages, b->opts.frames, b->opts.threads, b->opts.renderMs, b->opts.cacheMb);
+    printf("  \"lookups\": %d, \"hits\": %d, \"hit_rate\": %.4f,\n", b->lookups, b->hits, hitRate);
+    printf("  \"renders\": %d, \"compressed_hits\": %d, \"evictions\": %d, \"cached\": %d, \"compressed\": %zu,\n",
+           (int)b->renders, (int)b->compressedHits, (int)b->policy.evictions, b->cache.Count(),
+           b->cache.CompressedCount());
+    printf("  \"latency_ms\": {\"count\": %zu, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f},\n",
+           lat.size(), Percentile(lat, 50), Percentile(lat, 90), Percentile(lat, 99), lat.empty() ? 0 : lat.back());
+    printf("  \"total_ms\": %.1f\n}\n", totalMs);
+
+    delete b;
+    return 0;
+}
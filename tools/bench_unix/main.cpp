@@ -0,0 +1,330 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// Headless load/render/text extraction benchmark for build servers.
+// Drives MuPDF through the same calls EnginePdf/EngineXps make
+// (load page, build display list, run it into a pixmap, extract text)
+// and prints per-page timings and peak memory usage as JSON.
+//
+// usage: bench_unix [-pages <ranges>] [-zoom <z1,z2,...>] [-repeat <n>] <file>...
+// e.g.   bench_unix -pages 1-5,10 -zoom 1,2.5 doc.pdf doc.xps
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <vector>
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+// same store limit as EngineFzUtil.h
+#define MAX_CONTEXT_MEMORY (256 * 1024 * 1024)
+#define MAX_ZOOMS 32
+
+struct PageRange {
+    int start;
+    int end;
+};
+
+struct BenchOptions {
+    std::vector<PageRange> pages;
+    std::vector<float> zooms;
+    int repeat = 1;
+    std::vector<const char*> files;
+};
+
+static double NowInMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// peak resident set size in KB (ru_maxrss is in KB on Linux)
+static long PeakMemoryKb() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return -1;
+    }
+    return ru.ru_maxrss;
+}
+
+// parses page ranges in the same format as ParsePageRanges:
+// "1-5,8,10-" where an open end means "until the last page"
+static bool ParsePageRanges(const char* s, std::vector<PageRange>& ranges) {
+    while (*s) {
+        char* end;
+        long start = strtol(s, &end, 10);
+        if (end == s || start < 1) {
+            return false;
+        }
+        PageRange r = {(int)start, (int)start};
+        s = end;
+        if (*s == '-') {
+            s++;
+            if (*s == ',' || !*s) {
+                r.end = INT_MAX;
+            } else {
+                long last = strtol(s, &end, 10);
+                if (end == s || last < start) {
+                    return false;
+                }
+                r.end = (int)last;
+                s = end;
+            }
+        }
+        ranges.push_back(r);
+        if (*s == ',') {
+            s++;
+        } else if (*s) {
+            return false;
+        }
+    }
+    return !ranges.empty();
+}
+
+static bool ParseZooms(const char* s, std::vector<float>& zooms) {
+    while (*s && zooms.size() < MAX_ZOOMS) {
+        char* end;
+        float zoom = strtof(s, &end);
+        if (end == s || zoom <= 0) {
+            return false;
+        }
+        zooms.push_back(zoom);
+        s = end;
+        if (*s == ',') {
+            s++;
+        } else if (*s) {
+            return false;
+        }
+    }
+    return !zooms.empty();
+}
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasParam = i + 1 < argc;
+        if (!strcmp(arg, "-pages") && hasParam) {
+            if (!ParsePageRanges(argv[++i], opts.pages)) {
+                return false;
+            }
+        } else if (!strcmp(arg, "-zoom") && hasParam) {
+            if (!ParseZooms(argv[++i], opts.zooms)) {
+                return false;
+            }
+        } else if (!strcmp(arg, "-repeat") && hasParam) {
+            opts.repeat = atoi(argv[++i]);
+            if (opts.repeat < 1) {
+                return false;
+            }
+        } else if (arg[0] == '-') {
+            return false;
+        } else {
+            opts.files.push_back(arg);
+        }
+    }
+    if (opts.pages.empty()) {
+        opts.pages.push_back({1, INT_MAX});
+    }
+    if (opts.zooms.empty()) {
+        opts.zooms.push_back(1.0f);
+    }
+    return !opts.files.empty();
+}
+
+static void PrintJsonStr(const char* s) {
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+struct PageTimings {
+    double loadMs = 0;
+    double listMs = 0;
+    double textMs = 0;
+    size_t textChars = 0;
+    std::vector<double> renderMs;
+    const char* error = nullptr;
+};
+
+static size_t CountTextChars(fz_stext_page* text) {
+    size_t count = 0;
+    for (fz_stext_block* block = text->first_block; block; block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) {
+            continue;
+        }
+        for (fz_stext_line* line = block->u.t.first_line; line; line = line->next) {
+            for (fz_stext_char* c = line->first_char; c; c = c->next) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// loads, renders (once per zoom level) and extracts text of a single page
+static void BenchPage(fz_context* ctx, fz_document* doc, int pageNo, const BenchOptions& opts, PageTimings& t) {
+    fz_page* page = nullptr;
+    fz_display_list* list = nullptr;
+    fz_stext_page* text = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+
+    fz_var(page);
+    fz_var(list);
+    fz_var(text);
+    fz_var(pix);
+    fz_var(dev);
+
+    fz_try(ctx) {
+        double start = NowInMs();
+        page = fz_load_page(ctx, doc, pageNo - 1);
+        t.loadMs = NowInMs() - start;
+
+        start = NowInMs();
+        list = fz_new_display_list_from_page(ctx, page);
+        t.listMs = NowInMs() - start;
+
+        fz_rect bounds = fz_bound_page(ctx, page);
+        for (float zoom : opts.zooms) {
+            start = NowInMs();
+            fz_matrix ctm = fz_scale(zoom, zoom);
+            fz_irect bbox = fz_round_rect(fz_transform_rect(bounds, ctm));
+            pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, nullptr, 1);
+            fz_clear_pixmap_with_value(ctx, pix, 0xff);
+            dev = fz_new_draw_device(ctx, fz_identity, pix);
+            fz_run_display_list(ctx, list, dev, ctm, fz_infinite_rect, nullptr);
+            fz_close_device(ctx, dev);
+            fz_drop_device(ctx, dev);
+            dev = nullptr;
+            fz_drop_pixmap(ctx, pix);
+            pix = nullptr;
+            t.renderMs.push_back(NowInMs() - start);
+        }
+
+        start = NowInMs();
+        fz_stext_options textOpts = {FZ_STEXT_PRESERVE_WHITESPACE};
+        text = fz_new_stext_page_from_display_list(ctx, list, &textOpts);
+        t.textChars = CountTextChars(text);
+        t.textMs = NowInMs() - start;
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_stext_page(ctx, text);
+        fz_drop_display_list(ctx, list);
+        fz_drop_page(ctx, page);
+    }
+    fz_catch(ctx) {
+        t.error = "failed to load or render page";
+    }
+}
+
+static void PrintPage(int pageNo, const PageTimings& t, const BenchOptions& opts) {
+    printf("        {\"page\": %d", pageNo);
+    if (t.error) {
+        printf(", \"error\": ");
+        PrintJsonStr(t.error);
+    } else {
+        printf(", \"load_ms\": %.3f, \"list_ms\": %.3f, \"render_ms\": {", t.loadMs, t.listMs);
+        for (size_t i = 0; i < t.renderMs.size(); i++) {
+            printf("%s\"%g\": %.3f", i > 0 ? ", " : "", opts.zooms[i], t.renderMs[i]);
+        }
+        printf("}, \"text_ms\": %.3f, \"text_chars\": %zu", t.textMs, t.textChars);
+    }
+    printf("}");
+}
+
+static void BenchFile(fz_context* ctx, const char* path, int run, const BenchOptions& opts, bool isLast) {
+    fz_document* doc = nullptr;
+    int pageCount = 0;
+    double openMs = 0;
+
+    printf("    {\"file\": ");
+    PrintJsonStr(path);
+    printf(", \"run\": %d", run);
+
+    fz_var(doc);
+    fz_var(pageCount);
+    fz_var(openMs);
+    fz_try(ctx) {
+        double start = NowInMs();
+        doc = fz_open_document(ctx, path);
+        if (fz_needs_password(ctx, doc)) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "document is password protected");
+        }
+        pageCount = fz_count_pages(ctx, doc);
+        openMs = NowInMs() - start;
+    }
+    fz_catch(ctx) {
+        fz_drop_document(ctx, doc);
+        printf(", \"error\": ");
+        PrintJsonStr(fz_caught_message(ctx));
+        printf("}%s\n", isLast ? "" : ",");
+        return;
+    }
+
+    printf(", \"open_ms\": %.3f, \"page_count\": %d, \"pages\": [\n", openMs, pageCount);
+    double start = NowInMs();
+    bool first = true;
+    for (const PageRange& r : opts.pages) {
+        int end = r.end < pageCount ? r.end : pageCount;
+        for (int pageNo = r.start; pageNo <= end; pageNo++) {
+            PageTimings t;
+            BenchPage(ctx, doc, pageNo, opts, t);
+            if (!first) {
+                printf(",\n");
+            }
+            PrintPage(pageNo, t, opts);
+            first = false;
+            fflush(stdout);
+        }
+    }
+    double totalMs = NowInMs() - start;
+    fz_drop_document(ctx, doc);
+
+    printf("%s    ], \"total_ms\": %.3f, \"peak_memory_kb\": %ld}%s\n", first ? "" : "\n", totalMs, PeakMemoryKb(), isLast ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    if (!ParseArgs(argc, argv, opts)) {
+        fprintf(stderr, "usage: %s [-pages <ranges>] [-zoom <z1,z2,...>] [-repeat <n>] <file>...\n", argv[0]);
+        return 2;
+    }
+
+    fz_context* ctx = fz_new_context(nullptr, nullptr, MAX_CONTEXT_MEMORY);
+    if (!ctx) {
+        fprintf(stderr, "failed to create MuPDF context\n");
+        return 1;
+    }
+    fz_register_document_handlers(ctx);
+
+    double start = NowInMs();
+    printf("{\n  \"results\": [\n");
+    size_t nFiles = opts.files.size();
+    for (int run = 1; run <= opts.repeat; run++) {
+        for (size_t i = 0; i < nFiles; i++) {
+            bool isLast = run == opts.repeat && i == nFiles - 1;
+            BenchFile(ctx, opts.files[i], run, opts, isLast);
+        }
+    }
+    printf("  ],\n  \"total_ms\": %.3f,\n  \"peak_memory_kb\": %ld\n}\n", NowInMs() - start, PeakMemoryKb());
+
+    fz_drop_context(ctx);
+    return 0;
+}
@@ -0,0 +1,198 @@
+/* Copyright 2019 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// Micro-benchmark for StrFinder, the substring search behind TextSearch.
+// Searches synthetic page text (words of mixed case, with some accented
+// characters) for all matches of a needle, folding the case of every
+// compared character (as StrStrI does) and with StrFinder's scalar, SSE2
+// and automatically chosen (AVX2, where available) kernels.
+// Prints the time per page and the number of matches as JSON.
+//
+// usage: bench_strfind_unix [-pages <n>] [-page-chars <n>] [-rounds <n>] [-case] [-needle <text>]
+
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wctype.h>
+
+#include <vector>
+
+#include "utils/StrFinder.h"
+
+#define MAX_NEEDLE_LEN 256
+
+struct BenchOptions {
+    int pages = 200;
+    int pageChars = 4000;
+    int rounds = 5;
+    bool matchCase = false;
+    const char* needle = "Search";
+};
+
+static double NowInMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static const char* gWords[] = {
+    "the",   "of",     "and",     "to",      "in",       "search", "text",     "page",    "document", "find",
+    "match", "letter", "case",    "string",  "research", "sea",    "searches", "chapter", "section",  "figure",
+    "table", "result", "example", "however", "between",  "which",  "through",  "number",  "should",   "because",
+};
+// accented letters and typographic punctuation, as found in many documents
+static const uint16_t gSpecialChars[] = {0xe9, 0xc9, 0xfc, 0xdc, 0xdf, 0x2019, 0x201c, 0x201d, 0x2013};
+
+static void GeneratePage(std::vector<WCHAR>& page, int chars) {
+    page.clear();
+    while ((int)page.size() < chars) {
+        const char* word = gWords[rand() % (sizeof(gWords) / sizeof(gWords[0]))];
+        int style = rand() % 8;
+        for (const char* c = word; *c; c++) {
+            WCHAR ch = (WCHAR)*c;
+            if (style == 0 || (style == 1 && c == word)) {
+                ch = (WCHAR)towupper(ch);
+            }
+            page.push_back(ch);
+        }
+        if (rand() % 16 == 0) {
+            page.push_back((WCHAR)gSpecialChars[rand() % (sizeof(gSpecialChars) / sizeof(gSpecialChars[0]))]);
+        }
+        page.push_back(rand() % 12 == 0 ? '\n' : ' ');
+    }
+    page.resize(chars);
+    page.push_back(0);
+}
+
+// compares every character in lower case (like StrStrI)
+static const WCHAR* FindFoldingPerChar(const WCHAR* s, const WCHAR* end, const WCHAR* needle, size_t len,
+                                       bool matchCase) {
+    for (; (size_t)(end - s) >= len; s++) {
+        size_t i = 0;
+        for (; i < len; i++) {
+            WCHAR a = s[i], b = needle[i];
+            if (matchCase ? a != b : towlower(a) != towlower(b)) {
+                break;
+            }
+        }
+        if (i == len) {
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+enum class Kernel { FoldPerChar, Scalar, SSE2, Auto };
+static const char* gKernelNames[] = {"fold_per_char", "scalar", "sse2", "auto"};
+
+struct KernelResult {
+    double msPerPage;
+    long matches;
+};
+
+static KernelResult RunKernel(Kernel kernel, const BenchOptions& opts, std::vector<std::vector<WCHAR>>& pages,
+                              const WCHAR* needle, size_t len) {
+    StrFinderMode mode = kernel == Kernel::SSE2 ? StrFinderMode::SSE2
+                         : kernel == Kernel::Auto ? StrFinderMode::Auto
+                                                  : StrFinderMode::Scalar;
+    StrFinder finder(needle, len, !opts.matchCase, mode);
+    long matches = 0;
+    double start = NowInMs();
+    for (int round = 0; round < opts.rounds; round++) {
+        for (std::vector<WCHAR>& page : pages) {
+            const WCHAR* s = page.data();
+            const WCHAR* end = s + page.size() - 1;
+            for (;;) {
+                const WCHAR* found = kernel == Kernel::FoldPerChar
+                                         ? FindFoldingPerChar(s, end, needle, len, opts.matchCase)
+                                         : finder.Find(s, end);
+                if (!found) {
+                    break;
+                }
+                matches++;
+                s = found + 1;
+            }
+        }
+    }
+    double totalMs = NowInMs() - start;
+    return {totalMs / ((double)opts.rounds * pages.size()), matches / opts.rounds};
+}
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, "-case")) {
+            opts.matchCase = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char* param = argv[++i];
+        if (!strcmp(arg, "-pages")) {
+            opts.pages = atoi(param);
+        } else if (!strcmp(arg, "-page-chars")) {
+            opts.pageChars = atoi(param);
+        } else if (!strcmp(arg, "-rounds")) {
+            opts.rounds = atoi(param);
+        } else if (!strcmp(arg, "-needle")) {
+            opts.needle = param;
+        } else {
+            return false;
+        }
+    }
+    size_t needleLen = strlen(opts.needle);
+    return opts.pages > 0 && opts.pageChars > 0 && opts.rounds > 0 && needleLen > 0 && needleLen < MAX_NEEDLE_LEN;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    if (!ParseArgs(argc, argv, opts)) {
+        fprintf(stderr, "usage: %s [-pages <n>] [-page-chars <n>] [-rounds <n>] [-case] [-needle <text>]\n",
+                argv[0]);
+        return 2;
+    }
+    // case folding beyond ASCII (for towlower and StrFinder's case table)
+    if (!setlocale(LC_CTYPE, "C.UTF-8")) {
+        setlocale(LC_CTYPE, "");
+    }
+    srand(1);
+    std::vector<std::vector<WCHAR>> pages(opts.pages);
+    for (std::vector<WCHAR>& page : pages) {
+        GeneratePage(page, opts.pageChars);
+    }
+    // the needle is taken as Latin-1
+    WCHAR needle[MAX_NEEDLE_LEN];
+    size_t len = strlen(opts.needle);
+    for (size_t i = 0; i < len; i++) {
+        needle[i] = (WCHAR)(unsigned char)opts.needle[i];
+    }
+
+    KernelResult results[4];
+    for (int k = 0; k < 4; k++) {
+        results[k] = RunKernel((Kernel)k, opts, pages, needle, len);
+    }
+
+    printf("{\n");
+    printf("  \"pages\": %d, \"page_chars\": %d, \"rounds\": %d, \"needle\": \"%s\", \"match_case\": %s, \"avx2\": %s,\n",
+           opts.pages, opts.pageChars, opts.rounds, opts.needle, opts.matchCase ? "true" : "false",
+           StrFinder::HasAVX2() ? "true" : "false");
+    printf("  \"kernels\": {\n");
+    for (int k = 0; k < 4; k++) {
+        printf("    \"%s\": {\"us_per_page\": %.2f, \"matches\": %ld, \"speedup\": %.2f}%s\n", gKernelNames[k],
+               results[k].msPerPage * 1000, results[k].matches, results[0].msPerPage / results[k].msPerPage,
+               k < 3 ? "," : "");
+    }
+    printf("  }\n}\n");
+
+    for (int k = 1; k < 4; k++) {
+        if (results[k].matches != results[0].matches) {
+            fprintf(stderr, "%s found %ld matches instead of %ld\n", gKernelNames[k], results[k].matches,
+                    results[0].matches);
+            return 1;
+        }
+    }
+    return 0;
+}